@@ -1,6 +1,10 @@
 #include "Animation.h"
 #include "GLTFHelpers.h"
 
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
 double GetAnimationDurationSeconds(const tinygltf::Animation& animation, const tinygltf::Model& model)
 {
 	double animationDuration = 0.0f;
@@ -17,95 +21,149 @@ double GetAnimationDurationSeconds(const tinygltf::Animation& animation, const t
 	return animationDuration;
 }
 
-std::vector<float> SampleWeightsAt(const PropertyAnimation<float>& animation, float normalizedTime, int numMorphTargets)
+void SampleWeightsAt(const PropertyAnimation<float>& animation, float time, std::span<float> outWeights)
 {
-	assert(animation.method == InterpolationType::LINEAR); // for now, too lazy
-
-	std::vector<float> samples(numMorphTargets);
-
-	if (normalizedTime <= animation.times.front())
+	// Each keyframe holds one weight per morph target, CUBICSPLINE keyframes hold in-tangents, values and out-tangents for all
+	// targets in that order
+	const bool cubicSpline = animation.method == InterpolationType::CUBICSPLINE;
+	const int numKeyframes = (int)animation.times.size();
+	const int keyframeStride = (int)animation.values.size() / numKeyframes;
+	const int numMorphTargets = cubicSpline ? keyframeStride / 3 : keyframeStride;
+	const int valueOffset = cubicSpline ? numMorphTargets : 0;
+	const int count = std::min((int)outWeights.size(), numMorphTargets);
+	const float* values = animation.values.data();
+	float* out = outWeights.data();
+
+	int previousKeyframeIdx;
+	float t;
+	if (!FindKeyframeInterval(animation.times, time, previousKeyframeIdx, t) || animation.method == InterpolationType::STEP)
 	{
-		for (int i = 0; i < numMorphTargets; i++)
-		{
-			samples[i] = animation.values[i];
-		}
-		return samples;
+		const float* previous = values + previousKeyframeIdx * keyframeStride + valueOffset;
+		std::copy(previous, previous + count, out);
+		return;
 	}
-	else if (normalizedTime >= animation.times.back())
+
+	// Coefficients are shared by all targets, the per target loops below are plain multiply-adds over contiguous arrays
+	const float* previous = values + previousKeyframeIdx * keyframeStride + valueOffset;
+	const float* next = previous + keyframeStride;
+	if (!cubicSpline)
 	{
-		for (int i = 0; i < numMorphTargets; i++)
+		for (int i = 0; i < count; i++)
 		{
-			samples[i] = animation.values[animation.values.size() - numMorphTargets + i];
+			out[i] = previous[i] + (next[i] - previous[i]) * t;
 		}
-		return samples;
-	}
-
-	int nextKeyframeTimeIndex = 0;
-
-	while (animation.times[nextKeyframeTimeIndex] <= normalizedTime)
-	{
-		nextKeyframeTimeIndex++;
+		return;
 	}
 
-	float previousKeyframeTime = animation.times[nextKeyframeTimeIndex - 1];
-	float nextKeyframeTime = animation.times[nextKeyframeTimeIndex];
-	float t = (normalizedTime - previousKeyframeTime) / (nextKeyframeTime - previousKeyframeTime);
-
-	int indexA = nextKeyframeTimeIndex - 1;
-	std::vector<float> weightsA(numMorphTargets);
-	for (int i = 0; i < numMorphTargets; i++)
+	// https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html#interpolation-cubic
+	const float deltaTime = animation.times[previousKeyframeIdx + 1] - animation.times[previousKeyframeIdx];
+	const float t2 = t * t;
+	const float t3 = t2 * t;
+	const float previousValueFactor = 2.0f * t3 - 3.0f * t2 + 1.0f;
+	const float previousOutTangentFactor = (t3 - 2.0f * t2 + t) * deltaTime;
+	const float nextValueFactor = -2.0f * t3 + 3.0f * t2;
+	const float nextInTangentFactor = (t3 - t2) * deltaTime;
+	const float* previousOutTangent = previous + numMorphTargets;
+	const float* nextInTangent = next - numMorphTargets;
+	for (int i = 0; i < count; i++)
 	{
-		weightsA[i] = animation.values[numMorphTargets * indexA + i];
+		out[i] = previous[i] * previousValueFactor + previousOutTangent[i] * previousOutTangentFactor + next[i] * nextValueFactor + nextInTangent[i] * nextInTangentFactor;
 	}
+}
 
-	int indexB = nextKeyframeTimeIndex;
-	std::vector<float> weightsB(numMorphTargets);
-	for (int i = 0; i < numMorphTargets; i++)
+// Turns local joint matrices into matrices relative to the skeleton's root(s), in place
+static void ConcatenateJointMatrices(const Skeleton& skeleton, std::span<glm::mat4x3> inOutMatrices)
+{
+	// Parents come before children so a parent's global matrix is always ready by the time its children need it
+	for (int i = 0; i < (int)skeleton.joints.size(); i++)
 	{
-		weightsB[i] = animation.values[numMorphTargets * indexB + i];
+		const int parent = skeleton.joints[i].parent;
+		if (parent >= 0)
+		{
+			inOutMatrices[i] = MultiplyAffine(inOutMatrices[parent], inOutMatrices[i]);
+		}
 	}
+}
 
-	for (int i = 0; i < numMorphTargets; i++)
+static void ComputeSkinningMatricesFromGlobal(const Skeleton& skeleton, SkinningPalette& palette)
+{
+	for (int i = 0; i < (int)skeleton.joints.size(); i++)
 	{
-		samples[i] = weightsA[i] + (weightsB[i] - weightsA[i]) * t;
+		const Joint& joint = skeleton.joints[i];
+		palette.skinningMatrices[joint.paletteIdx] = MultiplyAffine(palette.globalMatrices[i], joint.localToJoint);
 	}
-
-	return samples;
 }
 
-std::vector<glm::mat4> ComputeGlobalMatrices(const Skeleton& skeleton, const std::vector<Entity>& entities)
+void ComputeGlobalMatrices(const Skeleton& skeleton, const EntityStorage& entities, std::span<glm::mat4x3> outGlobalMatrices)
 {
-	const int numJoints = skeleton.joints.size();
-	std::vector<glm::mat4> globalMatrices(numJoints);
+	const int numJoints = (int)skeleton.joints.size();
+	assert(outGlobalMatrices.size() >= numJoints);
 
-	// Set all joint matrices to their local matrices
-	for (int i = 0; i < numJoints; i++)
+	// Local matrices first, batched, then concatenated in place
+	constexpr int batchSize = 64;
+	int entityIndices[batchSize];
+	for (int batchBegin = 0; batchBegin < numJoints; batchBegin += batchSize)
 	{
-		globalMatrices[i] = entities[skeleton.joints[i].entityIndex].localTransform.GetMatrix();
-	}
-
-	for (int i = 1; i < numJoints; i++)
-	{
-		auto& joint = skeleton.joints[i];
-		if (joint.parent >= 0)
+		const int batchCount = std::min(batchSize, numJoints - batchBegin);
+		for (int i = 0; i < batchCount; i++)
 		{
-			globalMatrices[i] = globalMatrices[joint.parent] * globalMatrices[i];
+			entityIndices[i] = skeleton.joints[batchBegin + i].entityIndex;
 		}
+		ComputeAffineMatrices(entities.localTransforms, std::span<const int>(entityIndices, batchCount), outGlobalMatrices.subspan(batchBegin));
 	}
 
-	return globalMatrices;
+	ConcatenateJointMatrices(skeleton, outGlobalMatrices);
+}
+
+void ComputeGlobalMatrices(const Skeleton& skeleton, std::span<const Transform> jointLocalTransforms, std::span<glm::mat4x3> outGlobalMatrices)
+{
+	assert(jointLocalTransforms.size() == skeleton.joints.size() && outGlobalMatrices.size() >= skeleton.joints.size());
+	ComputeAffineMatrices(jointLocalTransforms, outGlobalMatrices);
+	ConcatenateJointMatrices(skeleton, outGlobalMatrices);
+}
+
+void ComputeSkinningMatrices(const Skeleton& skeleton, const EntityStorage& entities, SkinningPalette& palette)
+{
+	const int numJoints = (int)skeleton.joints.size();
+	assert(palette.globalMatrices.size() == numJoints && palette.skinningMatrices.size() == numJoints);
+
+	ComputeGlobalMatrices(skeleton, entities, palette.globalMatrices);
+	ComputeSkinningMatricesFromGlobal(skeleton, palette);
 }
 
-std::vector<glm::mat4> ComputeSkinningMatrices(const Skeleton& skeleton, const std::vector<Entity>& entities)
+void ComputeSkinningMatrices(const Skeleton& skeleton, std::span<const Transform> jointLocalTransforms, SkinningPalette& palette)
 {
-	auto skinningMatrices = ComputeGlobalMatrices(skeleton, entities);
-	const int numJoints = skinningMatrices.size();
+	const int numJoints = (int)skeleton.joints.size();
+	assert(palette.globalMatrices.size() == numJoints && palette.skinningMatrices.size() == numJoints);
+
+	ComputeGlobalMatrices(skeleton, jointLocalTransforms, palette.globalMatrices);
+	ComputeSkinningMatricesFromGlobal(skeleton, palette);
+}
 
-	for (int i = 0; i < numJoints; i++)
+glm::mat3 ComputeSkinningNormalMatrix(const glm::mat4x3& skinningMatrix)
+{
+	const glm::mat3 m(skinningMatrix);
+	const float scaleSquared = glm::dot(m[0], m[0]);
+	const float tolerance = 1e-4f * scaleSquared;
+	const bool uniformScale = scaleSquared > 0.0f &&
+		std::abs(glm::dot(m[1], m[1]) - scaleSquared) <= tolerance && std::abs(glm::dot(m[2], m[2]) - scaleSquared) <= tolerance &&
+		std::abs(glm::dot(m[0], m[1])) <= tolerance && std::abs(glm::dot(m[0], m[2])) <= tolerance && std::abs(glm::dot(m[1], m[2])) <= tolerance;
+	if (uniformScale)
 	{
-		const auto localToJoint = glm::mat4(skeleton.joints[i].localToJoint);
-		skinningMatrices[i] = skinningMatrices[i] * localToJoint;
+		// m = s * R, so transpose(inverse(m)) = R / s = m / s^2
+		return m * (1.0f / scaleSquared);
 	}
-
-	return skinningMatrices;
+	return glm::transpose(glm::inverse(m));
 }
+
+void ComputeSkinningDualQuaternions(std::span<const glm::mat4x3> skinningMatrices, std::span<DualQuaternion> outDualQuaternions)
+{
+	for (int i = 0; i < skinningMatrices.size(); i++)
+	{
+		const glm::mat4x3& m = skinningMatrices[i];
+		const glm::mat3 rotation(glm::normalize(m[0]), glm::normalize(m[1]), glm::normalize(m[2]));
+		const glm::quat real = glm::normalize(glm::quat_cast(rotation));
+		outDualQuaternions[i].real = real;
+		outDualQuaternions[i].dual = glm::quat(0.0f, m[3].x, m[3].y, m[3].z) * real * 0.5f;
+	}
+}
\ No newline at end of file
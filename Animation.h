@@ -1,8 +1,11 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include "Entity.h"
 #include "GLTFHelpers.h"
+#include <glm/mat3x3.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/vec3.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -26,12 +29,78 @@ struct PropertyAnimation
 	InterpolationType method;
 };
 
+// Rotation stored with the "smallest three" scheme: the largest component is dropped (the quaternion is negated if needed so
+// that it is positive, letting it be rebuilt from the other three), its index goes in the top 2 bits and the remaining three
+// components are stored in 15 bits each over [-1/sqrt(2), 1/sqrt(2)]. 48 bits total instead of 128
+struct PackedQuat
+{
+	std::uint16_t bits[3];
+};
+
+inline glm::quat UnpackQuat(PackedQuat packed)
+{
+	constexpr float componentScale = 1.41421356f / 32767.0f; // maps [0, 32767] to [0, sqrt(2)]
+	constexpr float componentOffset = 0.70710678f;
+
+	const std::uint64_t bits = (std::uint64_t)packed.bits[0] | ((std::uint64_t)packed.bits[1] << 16) | ((std::uint64_t)packed.bits[2] << 32);
+	const int largestIdx = (int)(bits >> 45);
+
+	glm::quat q;
+	float sumSquares = 0.0f;
+	int shift = 30;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i == largestIdx) continue;
+		float component = (float)((bits >> shift) & 0x7FFF) * componentScale - componentOffset;
+		q[i] = component;
+		sumSquares += component * component;
+		shift -= 15;
+	}
+	q[largestIdx] = std::sqrt(std::max(0.0f, 1.0f - sumSquares));
+	return q;
+}
+
+// Compressed channels only use LINEAR or STEP interpolation, cubic splines are resampled during compression.
+// Translations and scales are quantized to 16 bits per component over the channel's range of values, unless the range is
+// too wide for 16 bits to meet the compression tolerance
+struct CompressedVec3Animation
+{
+	std::vector<glm::u16vec3> values;
+	std::vector<glm::vec3> unquantizedValues; // instead of values for channels with too wide a range
+	std::vector<float> times;
+	glm::vec3 rangeMin = glm::vec3(0.0f);
+	glm::vec3 rangeExtent = glm::vec3(0.0f);
+	InterpolationType method = InterpolationType::LINEAR;
+
+	glm::vec3 GetValue(int keyframeIdx) const
+	{
+		if (!unquantizedValues.empty())
+		{
+			return unquantizedValues[keyframeIdx];
+		}
+		return rangeMin + glm::vec3(values[keyframeIdx]) * (rangeExtent * (1.0f / 65535.0f));
+	}
+};
+
+struct CompressedQuatAnimation
+{
+	std::vector<PackedQuat> values;
+	std::vector<float> times;
+	InterpolationType method = InterpolationType::LINEAR;
+
+	glm::quat GetValue(int keyframeIdx) const
+	{
+		return UnpackQuat(values[keyframeIdx]);
+	}
+};
+
+// Channels that the entity doesn't animate have no keyframes
 struct EntityAnimation
 {
 	int entityIdx;
-	PropertyAnimation<glm::vec3> translations;
-	PropertyAnimation<glm::vec3> scales;
-	PropertyAnimation<glm::quat> rotations;
+	CompressedVec3Animation translations;
+	CompressedVec3Animation scales;
+	CompressedQuatAnimation rotations;
 	PropertyAnimation<float> weights;
 };
 
@@ -43,9 +112,90 @@ struct Animation
 };
 
 double GetAnimationDurationSeconds(const tinygltf::Animation& animation, const tinygltf::Model& model);
-std::vector<float> SampleWeightsAt(const PropertyAnimation<float>& animation, float normalizedTime, int numMorphTargets = 2);
-std::vector<glm::mat4> ComputeGlobalMatrices(const Skeleton& skeleton, const std::vector<Entity>& entites);
-std::vector<glm::mat4> ComputeSkinningMatrices(const Skeleton& skeleton, const std::vector<Entity>& entities);
+// Writes the weights of the first outWeights.size() morph targets. Supports all interpolation types and doesn't allocate
+void SampleWeightsAt(const PropertyAnimation<float>& animation, float time, std::span<float> outWeights);
+// Joint matrices relative to the skeleton's root(s), in joint order
+void ComputeGlobalMatrices(const Skeleton& skeleton, const EntityStorage& entities, std::span<glm::mat4x3> outGlobalMatrices);
+// Same, with the joints' local transforms given in joint order instead of read from their entities
+void ComputeGlobalMatrices(const Skeleton& skeleton, std::span<const Transform> jointLocalTransforms, std::span<glm::mat4x3> outGlobalMatrices);
+// Fills palette.globalMatrices and palette.skinningMatrices. Doesn't allocate
+void ComputeSkinningMatrices(const Skeleton& skeleton, const EntityStorage& entities, SkinningPalette& palette);
+void ComputeSkinningMatrices(const Skeleton& skeleton, std::span<const Transform> jointLocalTransforms, SkinningPalette& palette);
+// Transpose of the inverse of the skinning matrix's upper 3x3, which transforms normals and tangents. Skinning shaders blend
+// these per joint instead of inverting the blended matrix per vertex. Joints with uniform scale (nearly all of them) skip the
+// inverse: their 3x3 divided by the squared scale is exactly the same matrix
+glm::mat3 ComputeSkinningNormalMatrix(const glm::mat4x3& skinningMatrix);
+
+// Unit dual quaternion of a rigid transform: real is the rotation, dual is half the translation times it
+struct DualQuaternion
+{
+	glm::quat real;
+	glm::quat dual;
+};
+
+// Rigid part of each skinning matrix as a dual quaternion, for SkinningMode::DualQuaternion. Scale is dropped
+void ComputeSkinningDualQuaternions(std::span<const glm::mat4x3> skinningMatrices, std::span<DualQuaternion> outDualQuaternions);
+
+// Finds the keyframes surrounding time. Returns false if time lies outside the keyframes' time span, in which case
+// outPreviousKeyframeIdx is the nearest keyframe and no interpolation should be done
+inline bool FindKeyframeInterval(const std::vector<float>& times, float time, int& outPreviousKeyframeIdx, float& outT)
+{
+	if (time <= times.front())
+	{
+		outPreviousKeyframeIdx = 0;
+		return false;
+	}
+	if (time >= times.back())
+	{
+		outPreviousKeyframeIdx = (int)times.size() - 1;
+		return false;
+	}
+
+	auto nextKeyframeIter = std::upper_bound(times.begin(), times.end(), time);
+	outPreviousKeyframeIdx = (int)(nextKeyframeIter - times.begin()) - 1;
+	float previousTime = times[outPreviousKeyframeIdx];
+	outT = (time - previousTime) / (*nextKeyframeIter - previousTime);
+	return true;
+}
+
+inline glm::vec3 SampleAt(const CompressedVec3Animation& animation, float time)
+{
+	int previousKeyframeIdx;
+	float t;
+	if (!FindKeyframeInterval(animation.times, time, previousKeyframeIdx, t) || animation.method == InterpolationType::STEP)
+	{
+		return animation.GetValue(previousKeyframeIdx);
+	}
+	return glm::mix(animation.GetValue(previousKeyframeIdx), animation.GetValue(previousKeyframeIdx + 1), t);
+}
+
+inline glm::quat SampleAt(const CompressedQuatAnimation& animation, float time)
+{
+	int previousKeyframeIdx;
+	float t;
+	if (!FindKeyframeInterval(animation.times, time, previousKeyframeIdx, t) || animation.method == InterpolationType::STEP)
+	{
+		return animation.GetValue(previousKeyframeIdx);
+	}
+	return glm::slerp(animation.GetValue(previousKeyframeIdx), animation.GetValue(previousKeyframeIdx + 1), t);
+}
+
+// Overwrites the parts of transform that entityAnimation animates
+inline void SampleTransformAt(const EntityAnimation& entityAnimation, float time, Transform& transform)
+{
+	if (!entityAnimation.translations.times.empty())
+	{
+		transform.translation = SampleAt(entityAnimation.translations, time);
+	}
+	if (!entityAnimation.rotations.times.empty())
+	{
+		transform.rotation = SampleAt(entityAnimation.rotations, time);
+	}
+	if (!entityAnimation.scales.times.empty())
+	{
+		transform.scale = SampleAt(entityAnimation.scales, time);
+	}
+}
 
 // Use for translation, scale, or rotation. For translation or scale, lerp is used. For rotation (quaternions),
 // slerp is used. If time lies outside the time span, the nearest keyframe's value is returned and no interpolation is used
@@ -65,7 +215,7 @@ inline T SampleAt(const PropertyAnimation<T>& animation, float normalizedTime)
 
 		return animation.values[1]; // First value comes after in-tangent at index 0 for cubic spline interpolation
 	}
-	else if (normalizedTime > animation.times.back())
+	else if (normalizedTime >= animation.times.back())
 	{
 		if (animation.method != InterpolationType::CUBICSPLINE)
 		{
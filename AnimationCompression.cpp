@@ -0,0 +1,289 @@
+#include "AnimationCompression.h"
+
+#include <cassert>
+#include <cmath>
+
+PackedQuat PackQuat(glm::quat q)
+{
+	q = glm::normalize(q);
+
+	int largestIdx = 0;
+	for (int i = 1; i < 4; i++)
+	{
+		if (std::abs(q[i]) > std::abs(q[largestIdx]))
+		{
+			largestIdx = i;
+		}
+	}
+	// q and -q are the same rotation, make the dropped component positive so it can be rebuilt with a positive sqrt
+	if (q[largestIdx] < 0.0f)
+	{
+		q = -q;
+	}
+
+	std::uint64_t bits = (std::uint64_t)largestIdx << 45;
+	int shift = 30;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i == largestIdx) continue;
+		float normalized = glm::clamp(q[i] * 0.70710678f + 0.5f, 0.0f, 1.0f); // [-1/sqrt(2), 1/sqrt(2)] -> [0, 1]
+		bits |= (std::uint64_t)std::lround(normalized * 32767.0f) << shift;
+		shift -= 15;
+	}
+
+	PackedQuat packed;
+	packed.bits[0] = (std::uint16_t)(bits & 0xFFFF);
+	packed.bits[1] = (std::uint16_t)((bits >> 16) & 0xFFFF);
+	packed.bits[2] = (std::uint16_t)((bits >> 32) & 0xFFFF);
+	return packed;
+}
+
+float ComputeJointReach(int entityIdx, const EntityStorage& entities)
+{
+	const glm::vec3 scale = entities.localTransforms[entityIdx].scale;
+	float reach = 0.0f;
+	for (int childIdx = entities.firstChildren[entityIdx]; childIdx >= 0; childIdx = entities.nextSiblings[childIdx])
+	{
+		float childDistance = glm::length(entities.localTransforms[childIdx].translation * scale);
+		reach = std::max(reach, childDistance + ComputeJointReach(childIdx, entities));
+	}
+	return reach;
+}
+
+// Angle of the rotation between a and b. Computed from the chord between the quaternions rather than acos(dot(a, b)) since acos
+// loses most of its precision for the tiny angles compared against here
+static float RotationError(const glm::quat& a, glm::quat b)
+{
+	if (glm::dot(a, b) < 0.0f)
+	{
+		b = -b;
+	}
+	glm::quat difference = a - b;
+	float chord = std::sqrt(glm::dot(difference, difference));
+	return 4.0f * std::asin(std::min(1.0f, chord * 0.5f));
+}
+
+static float Vec3Error(const glm::vec3& a, const glm::vec3& b)
+{
+	return glm::length(a - b);
+}
+
+static glm::vec3 Interpolate(const glm::vec3& a, const glm::vec3& b, float t)
+{
+	return glm::mix(a, b, t);
+}
+
+static glm::quat Interpolate(const glm::quat& a, const glm::quat& b, float t)
+{
+	return glm::slerp(a, b, t);
+}
+
+static float KeyframeError(const glm::vec3& a, const glm::vec3& b) { return Vec3Error(a, b); }
+static float KeyframeError(const glm::quat& a, const glm::quat& b) { return RotationError(a, b); }
+
+// Resamples cubic spline channels into linear keyframes so every compressed channel can be stored without tangents
+template<typename T>
+static PropertyAnimation<T> ToLinearOrStep(const PropertyAnimation<T>& animation, float sampleRate)
+{
+	if (animation.method != InterpolationType::CUBICSPLINE)
+	{
+		return animation;
+	}
+
+	PropertyAnimation<T> resampled;
+	resampled.method = InterpolationType::LINEAR;
+
+	const float startTime = animation.times.front();
+	const float endTime = animation.times.back();
+	const int numSamples = std::max(2, (int)std::ceil((endTime - startTime) * sampleRate) + 1);
+	resampled.times.resize(numSamples);
+	resampled.values.resize(numSamples);
+	for (int i = 0; i < numSamples - 1; i++)
+	{
+		float time = startTime + (float)i / sampleRate;
+		resampled.times[i] = time;
+		resampled.values[i] = SampleAt(animation, time);
+	}
+	// The last key's value, which comes before its out-tangent
+	resampled.times.back() = endTime;
+	resampled.values.back() = animation.values[animation.values.size() - 2];
+	return resampled;
+}
+
+// Returns the indices of the keyframes to keep. A keyframe is dropped when interpolating between the kept keyframes around it
+// reproduces every dropped keyframe within tolerance
+template<typename T>
+static std::vector<int> ReduceKeyframes(const PropertyAnimation<T>& animation, float tolerance)
+{
+	const int numKeyframes = (int)animation.times.size();
+	std::vector<int> kept;
+	kept.push_back(0);
+
+	if (animation.method == InterpolationType::STEP)
+	{
+		for (int i = 1; i < numKeyframes; i++)
+		{
+			if (KeyframeError(animation.values[i], animation.values[kept.back()]) > tolerance)
+			{
+				kept.push_back(i);
+			}
+		}
+		return kept;
+	}
+
+	int segmentStart = 0;
+	for (int segmentEnd = segmentStart + 2; segmentEnd < numKeyframes; segmentEnd++)
+	{
+		const float startTime = animation.times[segmentStart];
+		const float segmentDuration = animation.times[segmentEnd] - startTime;
+		bool withinTolerance = true;
+		for (int i = segmentStart + 1; i < segmentEnd && withinTolerance; i++)
+		{
+			float t = (animation.times[i] - startTime) / segmentDuration;
+			T interpolated = Interpolate(animation.values[segmentStart], animation.values[segmentEnd], t);
+			withinTolerance = KeyframeError(interpolated, animation.values[i]) <= tolerance;
+		}
+
+		if (!withinTolerance)
+		{
+			segmentStart = segmentEnd - 1;
+			kept.push_back(segmentStart);
+		}
+	}
+
+	if (numKeyframes > 1)
+	{
+		kept.push_back(numKeyframes - 1);
+	}
+
+	// A constant channel only needs one keyframe
+	if (kept.size() == 2 && KeyframeError(animation.values[kept[0]], animation.values[kept[1]]) <= tolerance)
+	{
+		kept.pop_back();
+	}
+
+	return kept;
+}
+
+static std::vector<int> AllKeyframes(int numKeyframes)
+{
+	std::vector<int> indices(numKeyframes);
+	for (int i = 0; i < numKeyframes; i++)
+	{
+		indices[i] = i;
+	}
+	return indices;
+}
+
+static CompressedVec3Animation CompressVec3Animation(const PropertyAnimation<glm::vec3>& source, float tolerance, const AnimationCompressionSettings& settings,
+	AnimationCompressionStats& stats)
+{
+	CompressedVec3Animation compressed;
+	if (source.times.empty())
+	{
+		return compressed;
+	}
+
+	stats.uncompressedBytes += source.values.size() * sizeof(glm::vec3) + source.times.size() * sizeof(float);
+	stats.uncompressedKeyframes += (int)source.times.size();
+
+	PropertyAnimation<glm::vec3> animation = ToLinearOrStep(source, settings.cubicSplineSampleRate);
+
+	// Rounding to 16 bits moves each kept value by up to half a step per component, and interpolating between kept values
+	// moves by no more than that. Reduction only gets what's left of the tolerance. The kept keyframes' range can only be
+	// smaller than the range of all of them, so the bound holds. Channels where rounding would take more than half the
+	// tolerance (long root motion, mostly) aren't quantized
+	glm::vec3 sourceMin(FLT_MAX);
+	glm::vec3 sourceMax(-FLT_MAX);
+	for (const glm::vec3& value : animation.values)
+	{
+		sourceMin = glm::min(sourceMin, value);
+		sourceMax = glm::max(sourceMax, value);
+	}
+	const float quantizationError = 0.5f * glm::length(sourceMax - sourceMin) / 65535.0f;
+	const bool quantize = quantizationError <= 0.5f * tolerance;
+	const float reductionTolerance = quantize ? tolerance - quantizationError : tolerance;
+	std::vector<int> keptKeyframes = settings.removeKeyframes ? ReduceKeyframes(animation, reductionTolerance) : AllKeyframes((int)animation.times.size());
+	compressed.method = animation.method;
+
+	if (!quantize)
+	{
+		for (int keyframeIdx : keptKeyframes)
+		{
+			compressed.unquantizedValues.push_back(animation.values[keyframeIdx]);
+			compressed.times.push_back(animation.times[keyframeIdx]);
+		}
+		stats.compressedBytes += compressed.unquantizedValues.size() * sizeof(glm::vec3) + compressed.times.size() * sizeof(float);
+		stats.compressedKeyframes += (int)compressed.times.size();
+		return compressed;
+	}
+
+	glm::vec3 rangeMax(-FLT_MAX);
+	compressed.rangeMin = glm::vec3(FLT_MAX);
+	for (int keyframeIdx : keptKeyframes)
+	{
+		compressed.rangeMin = glm::min(compressed.rangeMin, animation.values[keyframeIdx]);
+		rangeMax = glm::max(rangeMax, animation.values[keyframeIdx]);
+	}
+	compressed.rangeExtent = rangeMax - compressed.rangeMin;
+
+	for (int keyframeIdx : keptKeyframes)
+	{
+		glm::vec3 normalized = animation.values[keyframeIdx] - compressed.rangeMin;
+		for (int i = 0; i < 3; i++)
+		{
+			normalized[i] = compressed.rangeExtent[i] > 0.0f ? normalized[i] / compressed.rangeExtent[i] : 0.0f;
+		}
+		compressed.values.emplace_back(glm::round(glm::clamp(normalized, 0.0f, 1.0f) * 65535.0f));
+		compressed.times.push_back(animation.times[keyframeIdx]);
+	}
+
+	stats.compressedBytes += compressed.values.size() * sizeof(glm::u16vec3) + compressed.times.size() * sizeof(float) + 2 * sizeof(glm::vec3);
+	stats.compressedKeyframes += (int)compressed.times.size();
+	return compressed;
+}
+
+static CompressedQuatAnimation CompressQuatAnimation(const PropertyAnimation<glm::quat>& source, float tolerance, const AnimationCompressionSettings& settings,
+	AnimationCompressionStats& stats)
+{
+	CompressedQuatAnimation compressed;
+	if (source.times.empty())
+	{
+		return compressed;
+	}
+
+	stats.uncompressedBytes += source.values.size() * sizeof(glm::quat) + source.times.size() * sizeof(float);
+	stats.uncompressedKeyframes += (int)source.times.size();
+
+	PropertyAnimation<glm::quat> animation = ToLinearOrStep(source, settings.cubicSplineSampleRate);
+	std::vector<int> keptKeyframes = settings.removeKeyframes ? ReduceKeyframes(animation, tolerance) : AllKeyframes((int)animation.times.size());
+
+	compressed.method = animation.method;
+	for (int keyframeIdx : keptKeyframes)
+	{
+		compressed.values.push_back(PackQuat(animation.values[keyframeIdx]));
+		compressed.times.push_back(animation.times[keyframeIdx]);
+	}
+
+	stats.compressedBytes += compressed.values.size() * sizeof(PackedQuat) + compressed.times.size() * sizeof(float);
+	stats.compressedKeyframes += (int)compressed.times.size();
+	return compressed;
+}
+
+EntityAnimation CompressEntityAnimation(const EntityAnimationSource& source, float jointReach, const AnimationCompressionSettings& settings,
+	AnimationCompressionStats& stats)
+{
+	// A rotation error of e radians (or scale error of e) moves a point at distance r by roughly r * e
+	const float reach = std::max(jointReach, settings.minJointReach);
+	const float translationTolerance = settings.maxPositionError;
+	const float rotationTolerance = settings.maxPositionError / reach;
+	const float scaleTolerance = settings.maxPositionError / reach;
+
+	EntityAnimation compressed;
+	compressed.entityIdx = source.entityIdx;
+	compressed.translations = CompressVec3Animation(source.translations, translationTolerance, settings, stats);
+	compressed.scales = CompressVec3Animation(source.scales, scaleTolerance, settings, stats);
+	compressed.rotations = CompressQuatAnimation(source.rotations, rotationTolerance, settings, stats);
+	compressed.weights = source.weights;
+	return compressed;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Animation.h"
+#include "Entity.h"
+#include <glm/vec3.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+// Channels of one entity exactly as decoded from the glTF accessors. Only used at import time, before compression
+struct EntityAnimationSource
+{
+	int entityIdx;
+	PropertyAnimation<glm::vec3> translations;
+	PropertyAnimation<glm::vec3> scales;
+	PropertyAnimation<glm::quat> rotations;
+	PropertyAnimation<float> weights;
+};
+
+struct AnimationCompressionSettings
+{
+	// Largest positional error (in model units) keyframe reduction may introduce at the farthest point a joint influences.
+	// Rotation and scale tolerances are derived per joint from this, so joints with long chains below them are kept more
+	// accurate than leaf joints
+	float maxPositionError = 0.0001f;
+	// Leaf joints still move the vertices skinned to them, assume they reach at least this far
+	float minJointReach = 0.1f;
+	// Cubic spline channels are resampled at this rate (samples per second) into linear keyframes before reduction
+	float cubicSplineSampleRate = 60.0f;
+	bool removeKeyframes = true;
+};
+
+struct AnimationCompressionStats
+{
+	std::size_t uncompressedBytes = 0;
+	std::size_t compressedBytes = 0;
+	int uncompressedKeyframes = 0;
+	int compressedKeyframes = 0;
+};
+
+PackedQuat PackQuat(glm::quat q);
+// Distance from the entity to its farthest descendant in the entity's rest pose
+float ComputeJointReach(int entityIdx, const EntityStorage& entities);
+EntityAnimation CompressEntityAnimation(const EntityAnimationSource& source, float jointReach, const AnimationCompressionSettings& settings,
+	AnimationCompressionStats& stats);
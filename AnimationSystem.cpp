@@ -0,0 +1,504 @@
+#include "AnimationSystem.h"
+#include "Frustum.h"
+#include "TransformSystem.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <unordered_map>
+
+static Transform InterpolateTransforms(const Transform& a, const Transform& b, float t)
+{
+	Transform transform;
+	transform.translation = glm::mix(a.translation, b.translation, t);
+	// Normalized lerp rather than slerp, the poses are at most a few frames apart
+	const glm::quat to = glm::dot(a.rotation, b.rotation) < 0.0f ? -b.rotation : b.rotation;
+	transform.rotation = glm::normalize(a.rotation * (1.0f - t) + to * t);
+	transform.scale = glm::mix(a.scale, b.scale, t);
+	return transform;
+}
+
+void AnimationSystem::Update(Scene& scene, float timeSeconds, JobSystem& jobSystem, const Camera* camera)
+{
+	if (skeletonLods.size() != scene.skeletons.size())
+	{
+		RebuildLodData(scene);
+		cachedAnimationEnabled.clear(); // entity to skeleton mapping of the channel list is stale too
+	}
+	if (cachedAnimationEnabled != scene.animationEnabled || entityLodSkeletons.size() != entityChannelsStart.size())
+	{
+		RebuildChannelList(scene);
+	}
+
+	const float frameDeltaSeconds = hasLastTime ? std::max(0.0f, timeSeconds - lastTimeSeconds) : 0.0f;
+	lastTimeSeconds = timeSeconds;
+	hasLastTime = true;
+	frame++;
+	UpdateLod(scene, camera, frameDeltaSeconds);
+
+	const int numAnimatedEntities = (int)entityChannelsStart.size();
+	jobSystem.ParallelFor(numAnimatedEntities, 16,
+		[&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const int lodSkeleton = entityLodSkeletons[i];
+				const SkeletonLod* lod = lodSkeleton >= 0 ? &skeletonLods[lodSkeleton] : nullptr;
+				if (lod != nullptr && lod->updateInterval == 0)
+				{
+					continue;
+				}
+
+				const int channelsStart = entityChannelsStart[i];
+				const int channelsEnd = i + 1 < numAnimatedEntities ? entityChannelsStart[i + 1] : (int)channels.size();
+				auto sampleChannels = [&](float entityTimeSeconds, Transform& outTransform)
+				{
+					for (int channelIdx = channelsStart; channelIdx < channelsEnd; channelIdx++)
+					{
+						const ChannelRef& channel = channels[channelIdx];
+						const Animation& animation = scene.animations[channel.animationIdx];
+						const EntityAnimation& entityAnimation = animation.entityAnimations[channel.entityAnimationIdx];
+
+						const float animationTime = animation.durationSeconds > 0.0f ? std::fmod(entityTimeSeconds, animation.durationSeconds) : 0.0f;
+						SampleTransformAt(entityAnimation, animationTime, outTransform);
+						std::span<float> morphTargetWeights = scene.entities.GetMorphTargetWeights(channel.entityIdx);
+						if (!entityAnimation.weights.times.empty() && !morphTargetWeights.empty())
+						{
+							SampleWeightsAt(entityAnimation.weights, animationTime, morphTargetWeights);
+						}
+					}
+				};
+
+				Transform& localTransform = scene.entities.localTransforms[channels[channelsStart].entityIdx];
+				if (lod == nullptr || lod->updateInterval == 1)
+				{
+					sampleChannels(timeSeconds, localTransform);
+					continue;
+				}
+
+				// Sampled ahead into the segment's end rather than the entity, which shows the pose along the segment
+				LodTransforms& ends = entityLodTransforms[i];
+				if (skeletonEvaluated[lodSkeleton])
+				{
+					// The new segment starts from the transform that would be shown this frame, so changing interval doesn't pop
+					ends.previous = lod->previousSegmentT >= 0.0f ? InterpolateTransforms(ends.previous, ends.next, lod->previousSegmentT) : localTransform;
+					ends.next = ends.previous;
+					sampleChannels(timeSeconds + skeletonSampleOffsets[lodSkeleton], ends.next);
+				}
+				localTransform = InterpolateTransforms(ends.previous, ends.next, lod->segmentT);
+			}
+		});
+
+	for (int i = 0; i < numAnimatedEntities; i++)
+	{
+		const int lodSkeleton = entityLodSkeletons[i];
+		if (lodSkeleton >= 0 && !skeletonEvaluated[lodSkeleton])
+		{
+			lodStats.skippedEntities++;
+			// Still moves along its segment unless frozen
+			if (skeletonLods[lodSkeleton].updateInterval == 0)
+			{
+				continue;
+			}
+		}
+		else
+		{
+			lodStats.sampledEntities++;
+		}
+		MarkTransformDirty(scene, channels[entityChannelsStart[i]].entityIdx);
+	}
+
+	UpdateAnimationInstances(scene, timeSeconds, jobSystem);
+
+	jobSystem.ParallelFor((int)scene.skeletons.size(), 4,
+		[&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				if (scene.skeletonPaletteIndices[i] == i)
+				{
+					UpdateSkeletonPalette(scene, i);
+				}
+			}
+		});
+}
+
+void AnimationSystem::UpdateLod(const Scene& scene, const Camera* camera, float frameDeltaSeconds)
+{
+	const int numSkeletons = (int)scene.skeletons.size();
+	skeletonEvaluated.assign(numSkeletons, true);
+	skeletonSampleOffsets.assign(numSkeletons, 0.0f);
+	lodStats = AnimationLodStats{};
+
+	const bool viewDependent = lodSettings.enabled && camera != nullptr;
+	Frustum frustum;
+	float tanHalfFov = 1.0f;
+	if (viewDependent)
+	{
+		frustum = Frustum::FromMatrix(camera->GetProjectionMatrix() * camera->GetViewMatrix());
+		tanHalfFov = std::tan(glm::radians(camera->zoom) * 0.5f);
+	}
+
+	for (int i = 0; i < numSkeletons; i++)
+	{
+		int updateInterval = 1;
+		const int boundsEntity = skeletonBoundsEntities[i];
+		if (viewDependent && boundsEntity >= 0 && boundsEntity < scene.globalTransforms.size())
+		{
+			// Bounding sphere of the transformed box, radius scaled by the largest axis scale
+			const BBox& bbox = scene.meshes[scene.entities.meshIndices[boundsEntity]].boundingBox;
+			const glm::mat4x3& world = scene.globalTransforms[boundsEntity];
+			const glm::vec3 center = world * glm::vec4(bbox.GetCenter(), 1.0f);
+			const float maxScale = std::max(glm::length(world[0]), std::max(glm::length(world[1]), glm::length(world[2])));
+			const float radius = glm::length(bbox.maxXYZ - bbox.minXYZ) * 0.5f * maxScale;
+
+			if (!frustum.IntersectsSphere(center, radius))
+			{
+				updateInterval = lodSettings.freezeOffscreen ? 0 : 4;
+			}
+			else
+			{
+				const float distance = glm::length(center - camera->position);
+				if (distance > radius)
+				{
+					const float screenSize = radius / (distance * tanHalfFov);
+					updateInterval = screenSize < lodSettings.quarterRateScreenSize ? 4 : screenSize < lodSettings.halfRateScreenSize ? 2 : 1;
+				}
+			}
+		}
+
+		SkeletonLod& lod = skeletonLods[i];
+		const bool intervalChanged = updateInterval != lod.updateInterval;
+		lod.updateInterval = updateInterval;
+
+		switch (updateInterval)
+		{
+		case 0: lodStats.frozenSkeletons++; break;
+		case 1: lodStats.fullRateSkeletons++; break;
+		case 2: lodStats.halfRateSkeletons++; break;
+		default: lodStats.quarterRateSkeletons++; break;
+		}
+
+		// Staggered by skeleton index so every frame evaluates about the same number of reduced rate skeletons. A skeleton
+		// switching interval, or without a segment, is evaluated right away to start a segment of the new length
+		const bool evaluate = updateInterval == 1 ||
+			(updateInterval > 1 && (intervalChanged || !lod.hasSegment || (frame + i) % updateInterval == 0));
+		skeletonEvaluated[i] = evaluate;
+		skeletonSampleOffsets[i] = updateInterval > 1 ? updateInterval * frameDeltaSeconds : 0.0f;
+		auto segmentT = [&lod, this]() { return std::min(1.0f, (float)(frame - lod.segmentStartFrame) / lod.segmentFrames); };
+		if (updateInterval <= 1)
+		{
+			lod.hasSegment = false;
+		}
+		else
+		{
+			if (evaluate)
+			{
+				lod.previousSegmentT = lod.hasSegment ? segmentT() : -1.0f;
+				lod.hasSegment = true;
+				lod.segmentStartFrame = frame;
+				lod.segmentFrames = updateInterval;
+			}
+			lod.segmentT = segmentT();
+		}
+		if (evaluate)
+		{
+			lodStats.evaluatedSkeletons++;
+		}
+		else if (updateInterval > 1)
+		{
+			lodStats.interpolatedSkeletons++;
+		}
+	}
+}
+
+void AnimationSystem::UpdateSkeletonPalette(Scene& scene, int skeletonIdx)
+{
+	const Skeleton& skeleton = scene.skeletons[skeletonIdx];
+	SkeletonLod& lod = skeletonLods[skeletonIdx];
+	SkinningPalette& palette = scene.skinningPalettes[skeletonIdx];
+
+	if (lod.updateInterval == 0)
+	{
+		return;
+	}
+	if (lod.updateInterval == 1)
+	{
+		ComputeSkinningMatrices(skeleton, scene.entities, palette);
+		return;
+	}
+
+	const int numJoints = (int)skeleton.joints.size();
+	if (skeletonEvaluated[skeletonIdx])
+	{
+		// The new segment starts from the palette that would be shown this frame, like the joints' transforms
+		if (lod.previousSegmentT >= 0.0f)
+		{
+			for (int i = 0; i < numJoints; i++)
+			{
+				lod.previousSkinningMatrices[i] += (lod.nextPalette.skinningMatrices[i] - lod.previousSkinningMatrices[i]) * lod.previousSegmentT;
+			}
+		}
+		else
+		{
+			lod.previousSkinningMatrices = palette.skinningMatrices;
+		}
+
+		// From the pose sampled ahead, which only the segment ends hold
+		thread_local std::vector<Transform> jointLocalTransforms;
+		jointLocalTransforms.resize(numJoints);
+		const std::vector<int>& jointEntries = skeletonJointEntries[skeletonIdx];
+		for (int i = 0; i < numJoints; i++)
+		{
+			jointLocalTransforms[i] = jointEntries[i] >= 0 ? entityLodTransforms[jointEntries[i]].next :
+				scene.entities.localTransforms[skeleton.joints[i].entityIndex];
+		}
+		if (lod.nextPalette.skinningMatrices.size() != numJoints)
+		{
+			lod.nextPalette = SkinningPalette(numJoints);
+		}
+		ComputeSkinningMatrices(skeleton, jointLocalTransforms, lod.nextPalette);
+	}
+
+	// Lerping the matrices rather than interpolating joint transforms and rebuilding the palette, the poses are at most a few
+	// frames apart
+	for (int i = 0; i < numJoints; i++)
+	{
+		palette.skinningMatrices[i] = lod.previousSkinningMatrices[i] + (lod.nextPalette.skinningMatrices[i] - lod.previousSkinningMatrices[i]) * lod.segmentT;
+	}
+}
+
+void AnimationSystem::UpdateAnimationInstances(Scene& scene, float timeSeconds, JobSystem& jobSystem)
+{
+	const int numSkeletons = (int)scene.skeletons.size();
+	assert(scene.skinningPalettes.size() >= numSkeletons);
+	scene.skeletonPaletteIndices.resize(numSkeletons);
+	for (int i = 0; i < numSkeletons; i++)
+	{
+		scene.skeletonPaletteIndices[i] = i;
+	}
+	if (scene.skeletonAnimationInstances.empty())
+	{
+		return;
+	}
+	if (clipBindings.size() != scene.animations.size())
+	{
+		RebuildClipBindings(scene);
+	}
+
+	poseCache.BeginFrame();
+	poseRequests.clear();
+	for (const SkeletonAnimationInstance& instance : scene.skeletonAnimationInstances)
+	{
+		const Animation& animation = scene.animations[instance.animationIdx];
+		const ClipBinding& binding = clipBindings[instance.animationIdx];
+		const Skeleton& skeleton = scene.skeletons[instance.skeletonIdx];
+		if (binding.sourceSkeletonIdx < 0 || scene.skeletons[binding.sourceSkeletonIdx].layoutHash != skeleton.layoutHash)
+		{
+			assert(false && "Animation instance's skeleton layout doesn't match the skeleton the animation targets");
+			continue;
+		}
+
+		float animationTime = 0.0f;
+		if (animation.durationSeconds > 0.0f)
+		{
+			animationTime = std::fmod(timeSeconds + instance.timeOffsetSeconds, animation.durationSeconds);
+			if (animationTime < 0.0f)
+			{
+				animationTime += animation.durationSeconds;
+			}
+		}
+
+		const PoseKey key{ instance.animationIdx, skeleton.layoutHash, poseCache.TimeToBucket(animationTime) };
+		bool needsCompute;
+		const int paletteIdx = numSkeletons + poseCache.Acquire(key, needsCompute);
+		if (needsCompute)
+		{
+			// The last bucket's center can lie past the end of the clip
+			const float bucketTime = std::min(poseCache.BucketToTime(key.timeBucket), animation.durationSeconds);
+			poseRequests.push_back(PoseRequest{ paletteIdx, instance.animationIdx, bucketTime });
+		}
+		scene.skeletonPaletteIndices[instance.skeletonIdx] = paletteIdx;
+	}
+
+	if (scene.skinningPalettes.size() < numSkeletons + poseCache.GetNumSlots())
+	{
+		scene.skinningPalettes.resize(numSkeletons + poseCache.GetNumSlots());
+	}
+
+	jobSystem.ParallelFor((int)poseRequests.size(), 4,
+		[&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				const PoseRequest& request = poseRequests[i];
+				ComputePose(scene, clipBindings[request.animationIdx], request, scene.skinningPalettes[request.paletteIdx]);
+			}
+		});
+}
+
+void AnimationSystem::ComputePose(const Scene& scene, const ClipBinding& binding, const PoseRequest& request, SkinningPalette& palette)
+{
+	const Skeleton& skeleton = scene.skeletons[binding.sourceSkeletonIdx];
+	const int numJoints = (int)skeleton.joints.size();
+	// Slots are reused across layouts, this only allocates when a slot switches to a layout with a different joint count
+	if (palette.globalMatrices.size() != numJoints)
+	{
+		palette = SkinningPalette(numJoints);
+	}
+
+	// Joints the clip doesn't animate keep the source skeleton's transforms
+	thread_local std::vector<Transform> jointLocalTransforms;
+	jointLocalTransforms.resize(numJoints);
+	for (int i = 0; i < numJoints; i++)
+	{
+		jointLocalTransforms[i] = scene.entities.localTransforms[skeleton.joints[i].entityIndex];
+	}
+
+	const Animation& animation = scene.animations[request.animationIdx];
+	for (int i = 0; i < animation.entityAnimations.size(); i++)
+	{
+		const int jointIdx = binding.entityAnimationJoints[i];
+		if (jointIdx >= 0)
+		{
+			SampleTransformAt(animation.entityAnimations[i], request.timeSeconds, jointLocalTransforms[jointIdx]);
+		}
+	}
+
+	ComputeSkinningMatrices(skeleton, jointLocalTransforms, palette);
+}
+
+void AnimationSystem::RebuildClipBindings(const Scene& scene)
+{
+	struct SkeletonJoint
+	{
+		int skeletonIdx;
+		int jointIdx;
+	};
+	std::unordered_map<int, SkeletonJoint> entityToJoint;
+	for (int skeletonIdx = 0; skeletonIdx < scene.skeletons.size(); skeletonIdx++)
+	{
+		const Skeleton& skeleton = scene.skeletons[skeletonIdx];
+		for (int jointIdx = 0; jointIdx < skeleton.joints.size(); jointIdx++)
+		{
+			entityToJoint.emplace(skeleton.joints[jointIdx].entityIndex, SkeletonJoint{ skeletonIdx, jointIdx });
+		}
+	}
+
+	clipBindings.assign(scene.animations.size(), ClipBinding{});
+	for (int animationIdx = 0; animationIdx < scene.animations.size(); animationIdx++)
+	{
+		const Animation& animation = scene.animations[animationIdx];
+		ClipBinding& binding = clipBindings[animationIdx];
+		binding.entityAnimationJoints.assign(animation.entityAnimations.size(), -1);
+		for (int i = 0; i < animation.entityAnimations.size(); i++)
+		{
+			auto iter = entityToJoint.find(animation.entityAnimations[i].entityIdx);
+			if (iter == entityToJoint.end())
+			{
+				continue;
+			}
+			// The first animated joint decides which skeleton the clip is bound to
+			if (binding.sourceSkeletonIdx < 0)
+			{
+				binding.sourceSkeletonIdx = iter->second.skeletonIdx;
+			}
+			if (iter->second.skeletonIdx == binding.sourceSkeletonIdx)
+			{
+				binding.entityAnimationJoints[i] = iter->second.jointIdx;
+			}
+		}
+	}
+}
+
+void AnimationSystem::RebuildLodData(const Scene& scene)
+{
+	skeletonLods.assign(scene.skeletons.size(), SkeletonLod{});
+	skeletonBoundsEntities.assign(scene.skeletons.size(), -1);
+	for (int entityIdx = 0; entityIdx < scene.entities.Size(); entityIdx++)
+	{
+		const int skeletonIdx = scene.entities.skeletonIndices[entityIdx];
+		if (skeletonIdx >= 0 && scene.entities.meshIndices[entityIdx] >= 0 && skeletonBoundsEntities[skeletonIdx] < 0)
+		{
+			skeletonBoundsEntities[skeletonIdx] = entityIdx;
+		}
+	}
+}
+
+void AnimationSystem::RebuildChannelList(const Scene& scene)
+{
+	cachedAnimationEnabled = scene.animationEnabled;
+	channels.clear();
+	entityChannelsStart.clear();
+
+	for (int animationIdx = 0; animationIdx < scene.animations.size(); animationIdx++)
+	{
+		if (!scene.animationEnabled[animationIdx])
+		{
+			continue;
+		}
+
+		const Animation& animation = scene.animations[animationIdx];
+		for (int entityAnimationIdx = 0; entityAnimationIdx < animation.entityAnimations.size(); entityAnimationIdx++)
+		{
+			channels.push_back(ChannelRef{ animation.entityAnimations[entityAnimationIdx].entityIdx, animationIdx, entityAnimationIdx });
+		}
+	}
+
+	// Stable so that animations keep their relative order for each entity
+	std::stable_sort(channels.begin(), channels.end(),
+		[](const ChannelRef& a, const ChannelRef& b) { return a.entityIdx < b.entityIdx; });
+
+	for (int i = 0; i < channels.size(); i++)
+	{
+		if (i == 0 || channels[i].entityIdx != channels[i - 1].entityIdx)
+		{
+			entityChannelsStart.push_back(i);
+		}
+	}
+
+	// Joints shared between skeletons follow the first one
+	std::vector<int> entitySkeletons(scene.entities.Size(), -1);
+	for (int skeletonIdx = (int)scene.skeletons.size() - 1; skeletonIdx >= 0; skeletonIdx--)
+	{
+		for (const Joint& joint : scene.skeletons[skeletonIdx].joints)
+		{
+			entitySkeletons[joint.entityIndex] = skeletonIdx;
+		}
+	}
+	entityLodSkeletons.clear();
+	for (int channelsStart : entityChannelsStart)
+	{
+		entityLodSkeletons.push_back(entitySkeletons[channels[channelsStart].entityIdx]);
+	}
+
+	skeletonJointEntries.resize(scene.skeletons.size());
+	for (int skeletonIdx = 0; skeletonIdx < scene.skeletons.size(); skeletonIdx++)
+	{
+		skeletonJointEntries[skeletonIdx].assign(scene.skeletons[skeletonIdx].joints.size(), -1);
+	}
+	for (int i = 0; i < entityChannelsStart.size(); i++)
+	{
+		const int skeletonIdx = entityLodSkeletons[i];
+		if (skeletonIdx < 0)
+		{
+			continue;
+		}
+		const std::vector<Joint>& joints = scene.skeletons[skeletonIdx].joints;
+		const int entityIdx = channels[entityChannelsStart[i]].entityIdx;
+		for (int jointIdx = 0; jointIdx < joints.size(); jointIdx++)
+		{
+			if (joints[jointIdx].entityIndex == entityIdx)
+			{
+				skeletonJointEntries[skeletonIdx][jointIdx] = i;
+			}
+		}
+	}
+
+	// Segment ends are per entry, so segments in flight restart from the entities' transforms
+	entityLodTransforms.assign(entityChannelsStart.size(), LodTransforms{});
+	for (SkeletonLod& lod : skeletonLods)
+	{
+		lod.hasSegment = false;
+	}
+}
\ No newline at end of file
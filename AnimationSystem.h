@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Camera.h"
+#include "JobSystem.h"
+#include "PoseCache.h"
+#include "Scene.h"
+
+#include <cstdint>
+#include <vector>
+
+// Update rate LOD for skeletons, driven by the projected size of their skinned mesh's bounding box. Screen sizes are the
+// bounding sphere's projected radius as a fraction of half the screen height
+struct AnimationLodSettings
+{
+	bool enabled = true;
+	float halfRateScreenSize = 0.1f; // below this the skeleton is evaluated every 2nd frame
+	float quarterRateScreenSize = 0.03f; // below this every 4th frame
+	bool freezeOffscreen = true; // otherwise off screen skeletons are evaluated every 4th frame
+};
+
+struct AnimationLodStats
+{
+	int fullRateSkeletons = 0;
+	int halfRateSkeletons = 0;
+	int quarterRateSkeletons = 0;
+	int frozenSkeletons = 0;
+	int evaluatedSkeletons = 0; // joints freshly sampled this frame
+	int interpolatedSkeletons = 0; // joints interpolated between evaluated poses this frame
+	int sampledEntities = 0;
+	int skippedEntities = 0;
+};
+
+// Per-frame update stage for animations. Samples every enabled animation into the local transforms and morph target weights
+// of the entities it animates, then rebuilds every skeleton's skinning palette. Skeleton animation instances are resolved
+// through the pose cache, so instances sharing clip, layout and time bucket sample and build one palette between them.
+// Skeletons that appear small on screen are only evaluated every 2nd or 4th frame, staggered so each frame evaluates an even
+// share of them. They are sampled ahead by their update interval, off the scene graph, and both their joints' local
+// transforms and their palettes are interpolated toward that pose on the frames in between, so whatever is attached under
+// a joint follows the skin rather than running ahead of it. Off screen skeletons are frozen. All steps are spread across
+// the job system.
+class AnimationSystem
+{
+public:
+	// Without a camera every skeleton updates at full rate
+	void Update(Scene& scene, float timeSeconds, JobSystem& jobSystem, const Camera* camera = nullptr);
+
+	void SetLodSettings(const AnimationLodSettings& settings) { lodSettings = settings; }
+	const AnimationLodStats& GetLodStats() const { return lodStats; }
+
+	const PoseCache& GetPoseCache() const { return poseCache; }
+	// Quantum of the pose cache's time buckets, trades pose sharing against playback smoothness
+	void SetPoseTimeQuantum(float timeQuantumSeconds) { poseCache = PoseCache(timeQuantumSeconds); }
+
+private:
+	struct ChannelRef
+	{
+		int entityIdx;
+		int animationIdx;
+		int entityAnimationIdx;
+	};
+
+	// Which joint of its source skeleton each of an animation's entity animations drives, -1 for non-joint entities
+	struct ClipBinding
+	{
+		int sourceSkeletonIdx = -1;
+		std::vector<int> entityAnimationJoints;
+	};
+
+	struct PoseRequest
+	{
+		int paletteIdx;
+		int animationIdx;
+		float timeSeconds;
+	};
+
+	struct SkeletonLod
+	{
+		int updateInterval = 1; // in frames, 0 when frozen
+		// The joints are interpolated from their previous to their next evaluated transforms (see LodTransforms), and the
+		// palette from previousSkinningMatrices to nextPalette, over segmentFrames frames starting at segmentStartFrame. Only
+		// used for intervals above 1
+		bool hasSegment = false;
+		std::uint32_t segmentStartFrame = 0;
+		int segmentFrames = 1;
+		float segmentT = 0.0f; // this frame's
+		float previousSegmentT = -1.0f; // on frames starting a segment, how far along the one before it was, -1 if none
+		std::vector<glm::mat4x3> previousSkinningMatrices;
+		SkinningPalette nextPalette;
+	};
+
+	// Ends of the segment an entity driven by a reduced rate skeleton is interpolated along
+	struct LodTransforms
+	{
+		Transform previous;
+		Transform next;
+	};
+
+	void RebuildChannelList(const Scene& scene);
+	void RebuildClipBindings(const Scene& scene);
+	void RebuildLodData(const Scene& scene);
+	void UpdateLod(const Scene& scene, const Camera* camera, float frameDeltaSeconds);
+	void UpdateSkeletonPalette(Scene& scene, int skeletonIdx);
+	void UpdateAnimationInstances(Scene& scene, float timeSeconds, JobSystem& jobSystem);
+	static void ComputePose(const Scene& scene, const ClipBinding& binding, const PoseRequest& request, SkinningPalette& palette);
+
+	// Channels of all enabled animations grouped by the entity they animate. Entities are the unit of parallel work so two
+	// animations targeting the same entity never race; within an entity animations are applied in order, later ones winning
+	std::vector<ChannelRef> channels;
+	std::vector<int> entityChannelsStart; // one past the last entry is channels.size()
+	std::vector<std::uint8_t> cachedAnimationEnabled;
+	std::vector<int> entityLodSkeletons; // per entry of entityChannelsStart, skeleton whose LOD decides when the entity is sampled, -1 for always
+	std::vector<LodTransforms> entityLodTransforms; // per entry of entityChannelsStart
+	std::vector<std::vector<int>> skeletonJointEntries; // per skeleton and joint, its entry of entityChannelsStart if the skeleton's LOD drives it, else -1
+
+	std::vector<ClipBinding> clipBindings; // per animation
+	PoseCache poseCache;
+	std::vector<PoseRequest> poseRequests; // scratch
+
+	AnimationLodSettings lodSettings;
+	AnimationLodStats lodStats;
+	std::vector<SkeletonLod> skeletonLods;
+	std::vector<int> skeletonBoundsEntities; // per skeleton, the skinned mesh entity whose bounding box drives its LOD, -1 if none
+	std::vector<std::uint8_t> skeletonEvaluated; // per skeleton, this frame
+	std::vector<float> skeletonSampleOffsets; // per skeleton, how far ahead of the current time it's sampled this frame
+	std::uint32_t frame = 0;
+	float lastTimeSeconds = 0.0f;
+	bool hasLastTime = false;
+};
\ No newline at end of file
@@ -0,0 +1,477 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+static BBox EmptyBox()
+{
+	return BBox{ .minXYZ = glm::vec3(FLT_MAX), .maxXYZ = glm::vec3(-FLT_MAX) };
+}
+
+static void Grow(BBox& box, const BBox& other)
+{
+	box.minXYZ = glm::min(box.minXYZ, other.minXYZ);
+	box.maxXYZ = glm::max(box.maxXYZ, other.maxXYZ);
+}
+
+static float SurfaceArea(const BBox& box)
+{
+	const glm::vec3 size = box.maxXYZ - box.minXYZ;
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static bool IntersectsSphere(const BBox& box, const glm::vec3& center, float radius)
+{
+	const glm::vec3 offset = center - glm::clamp(center, box.minXYZ, box.maxXYZ);
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+// Slab test, the distance the ray enters the box at or infinity if it misses it within maxDistance
+static float IntersectRay(const BBox& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+{
+	const glm::vec3 t1 = (box.minXYZ - origin) * inverseDirection;
+	const glm::vec3 t2 = (box.maxXYZ - origin) * inverseDirection;
+	const glm::vec3 tNear = glm::min(t1, t2);
+	const glm::vec3 tFar = glm::max(t1, t2);
+	const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+}
+
+BBox TransformBox(const BBox& box, const glm::mat4x3& transform)
+{
+	const glm::vec3 center = transform * glm::vec4(box.GetCenter(), 1.0f);
+	const glm::vec3 halfSize = (box.maxXYZ - box.minXYZ) * 0.5f;
+	const glm::vec3 extents = glm::abs(transform[0]) * halfSize.x + glm::abs(transform[1]) * halfSize.y + glm::abs(transform[2]) * halfSize.z;
+	return BBox{ .minXYZ = center - extents, .maxXYZ = center + extents };
+}
+
+void BVH::Build(const Scene& scene)
+{
+	const EntityStorage& entities = scene.entities;
+	nodes.clear();
+	parents.clear();
+	itemEntities.clear();
+	itemBoxes.clear();
+	entityItems.assign(entities.Size(), -1);
+
+	std::vector<glm::vec3> centroids;
+	for (int entityIdx = 0; entityIdx < entities.Size(); entityIdx++)
+	{
+		const int meshIdx = entities.meshIndices[entityIdx];
+		if (entities.alive[entityIdx] && meshIdx >= 0)
+		{
+			const BBox box = TransformBox(scene.GetModelBounds(entityIdx), scene.globalTransforms[entityIdx]);
+			itemEntities.push_back(entityIdx);
+			itemBoxes.push_back(box);
+			centroids.push_back(box.GetCenter());
+		}
+	}
+
+	const int numItems = (int)itemEntities.size();
+	itemLeaves.resize(numItems);
+	if (numItems == 0)
+	{
+		return;
+	}
+
+	// A binary tree with single item leaves is the largest there can be
+	nodes.reserve(2 * numItems - 1);
+	parents.reserve(2 * numItems - 1);
+	nodes.push_back(Node{ .bounds = EmptyBox(), .firstItem = 0, .numItems = numItems, .left = -1 });
+	parents.push_back(-1);
+	Subdivide(0, 0, centroids);
+
+	for (int nodeIdx = 0; nodeIdx < (int)nodes.size(); nodeIdx++)
+	{
+		const Node& node = nodes[nodeIdx];
+		if (node.left < 0)
+		{
+			for (int item = node.firstItem; item < node.firstItem + node.numItems; item++)
+			{
+				itemLeaves[item] = nodeIdx;
+				entityItems[itemEntities[item]] = item;
+			}
+		}
+	}
+}
+
+void BVH::Subdivide(int nodeIdx, int depth, std::vector<glm::vec3>& centroids)
+{
+	const int first = nodes[nodeIdx].firstItem;
+	const int count = nodes[nodeIdx].numItems;
+	const int end = first + count;
+
+	BBox bounds = EmptyBox();
+	BBox centroidBounds = EmptyBox();
+	for (int item = first; item < end; item++)
+	{
+		Grow(bounds, itemBoxes[item]);
+		Grow(centroidBounds, BBox{ .minXYZ = centroids[item], .maxXYZ = centroids[item] });
+	}
+	nodes[nodeIdx].bounds = bounds;
+	if (count == 1)
+	{
+		return;
+	}
+
+	// Bin the centroids along each axis and cost every split between bins as the number of items on each side times the
+	// area of their bounds, the expected number of box tests if the node is hit by a query
+	int bestAxis = -1;
+	int bestSplit = 0;
+	float bestCost = FLT_MAX;
+	if (depth < maxSahDepth)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float axisMin = centroidBounds.minXYZ[axis];
+			const float axisExtent = centroidBounds.maxXYZ[axis] - axisMin;
+			if (axisExtent <= 0.0f)
+			{
+				continue;
+			}
+
+			BBox binBounds[numBins];
+			int binCounts[numBins] = {};
+			std::fill(std::begin(binBounds), std::end(binBounds), EmptyBox());
+			const float scale = numBins / axisExtent;
+			for (int item = first; item < end; item++)
+			{
+				const int bin = std::min(numBins - 1, (int)((centroids[item][axis] - axisMin) * scale));
+				Grow(binBounds[bin], itemBoxes[item]);
+				binCounts[bin]++;
+			}
+
+			// Split s puts bins [0, s] on the left
+			float leftCosts[numBins - 1];
+			BBox leftBounds = EmptyBox();
+			int leftCount = 0;
+			for (int s = 0; s < numBins - 1; s++)
+			{
+				Grow(leftBounds, binBounds[s]);
+				leftCount += binCounts[s];
+				leftCosts[s] = leftCount > 0 ? leftCount * SurfaceArea(leftBounds) : 0.0f;
+			}
+			BBox rightBounds = EmptyBox();
+			int rightCount = 0;
+			for (int s = numBins - 2; s >= 0; s--)
+			{
+				Grow(rightBounds, binBounds[s + 1]);
+				rightCount += binCounts[s + 1];
+				const float cost = leftCosts[s] + (rightCount > 0 ? rightCount * SurfaceArea(rightBounds) : 0.0f);
+				if (rightCount > 0 && rightCount < count && cost < bestCost)
+				{
+					bestAxis = axis;
+					bestSplit = s;
+					bestCost = cost;
+				}
+			}
+		}
+	}
+
+	// Relative to testing the node's box once: a leaf tests all its items, a split tests both children's boxes plus the
+	// items of the children a query hits
+	const float area = SurfaceArea(bounds);
+	const float splitCost = area > 0.0f ? 1.0f + bestCost / area : FLT_MAX;
+	if (count <= maxLeafItems && (bestAxis < 0 || splitCost >= (float)count))
+	{
+		return;
+	}
+
+	int mid = first + count / 2;
+	if (bestAxis >= 0)
+	{
+		const float axisMin = centroidBounds.minXYZ[bestAxis];
+		const float scale = numBins / (centroidBounds.maxXYZ[bestAxis] - axisMin);
+		auto isLeft = [&](int item) { return std::min(numBins - 1, (int)((centroids[item][bestAxis] - axisMin) * scale)) <= bestSplit; };
+		int i = first;
+		int j = end - 1;
+		while (i <= j)
+		{
+			if (isLeft(i))
+			{
+				i++;
+			}
+			else
+			{
+				std::swap(itemEntities[i], itemEntities[j]);
+				std::swap(itemBoxes[i], itemBoxes[j]);
+				std::swap(centroids[i], centroids[j]);
+				j--;
+			}
+		}
+		mid = i;
+	}
+	// Otherwise every centroid is in the same place or the tree is too deep, any halving will do
+	assert(mid > first && mid < end);
+
+	const int left = (int)nodes.size();
+	nodes[nodeIdx].left = left;
+	nodes.push_back(Node{ .bounds = EmptyBox(), .firstItem = first, .numItems = mid - first, .left = -1 });
+	nodes.push_back(Node{ .bounds = EmptyBox(), .firstItem = mid, .numItems = end - mid, .left = -1 });
+	parents.push_back(nodeIdx);
+	parents.push_back(nodeIdx);
+	Subdivide(left, depth + 1, centroids);
+	Subdivide(left + 1, depth + 1, centroids);
+}
+
+void BVH::RefitNode(int nodeIdx)
+{
+	Node& node = nodes[nodeIdx];
+	if (node.left < 0)
+	{
+		node.bounds = EmptyBox();
+		for (int item = node.firstItem; item < node.firstItem + node.numItems; item++)
+		{
+			Grow(node.bounds, itemBoxes[item]);
+		}
+	}
+	else
+	{
+		node.bounds = nodes[node.left].bounds;
+		Grow(node.bounds, nodes[node.left + 1].bounds);
+	}
+}
+
+void BVH::Refit(const Scene& scene)
+{
+	for (int item = 0; item < (int)itemEntities.size(); item++)
+	{
+		const int entityIdx = itemEntities[item];
+		itemBoxes[item] = TransformBox(scene.GetModelBounds(entityIdx), scene.globalTransforms[entityIdx]);
+	}
+	for (int nodeIdx = (int)nodes.size() - 1; nodeIdx >= 0; nodeIdx--)
+	{
+		RefitNode(nodeIdx);
+	}
+}
+
+void BVH::Refit(const Scene& scene, std::span<const int> movedEntities)
+{
+	dirtyLeaves.clear();
+	for (int entityIdx : movedEntities)
+	{
+		const int item = entityIdx < (int)entityItems.size() ? entityItems[entityIdx] : -1;
+		if (item >= 0)
+		{
+			itemBoxes[item] = TransformBox(scene.GetModelBounds(entityIdx), scene.globalTransforms[entityIdx]);
+			dirtyLeaves.push_back(itemLeaves[item]);
+		}
+	}
+	std::sort(dirtyLeaves.begin(), dirtyLeaves.end());
+	dirtyLeaves.erase(std::unique(dirtyLeaves.begin(), dirtyLeaves.end()), dirtyLeaves.end());
+
+	// A node's box only depends on its children's, so a walk can stop at the first one that didn't change. Walks from
+	// leaves sharing ancestors recompute those more than once, but each time from children at least as up to date
+	for (int leaf : dirtyLeaves)
+	{
+		for (int nodeIdx = leaf; nodeIdx >= 0; nodeIdx = parents[nodeIdx])
+		{
+			const BBox previous = nodes[nodeIdx].bounds;
+			RefitNode(nodeIdx);
+			if (nodes[nodeIdx].bounds.minXYZ == previous.minXYZ && nodes[nodeIdx].bounds.maxXYZ == previous.maxXYZ)
+			{
+				break;
+			}
+		}
+	}
+}
+
+void BVH::AppendSubtree(int nodeIdx, std::vector<int>& outEntities) const
+{
+	const Node& node = nodes[nodeIdx];
+	outEntities.insert(outEntities.end(), itemEntities.begin() + node.firstItem, itemEntities.begin() + node.firstItem + node.numItems);
+}
+
+void BVH::QueryFrustum(const Frustum& frustum, std::vector<int>& outEntities) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	int stack[maxStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const int nodeIdx = stack[--stackSize];
+		const Node& node = nodes[nodeIdx];
+		const glm::vec3 center = node.bounds.GetCenter();
+		const glm::vec3 extents = (node.bounds.maxXYZ - node.bounds.minXYZ) * 0.5f;
+
+		// Same plane test as Frustum::IntersectsBox, but also noting whether the box is entirely in front of every plane,
+		// in which case so is everything below it
+		bool outside = false;
+		bool inside = true;
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			const float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+			const float radius = glm::dot(glm::abs(glm::vec3(plane)), extents);
+			if (distance < -radius)
+			{
+				outside = true;
+				break;
+			}
+			inside = inside && distance >= radius;
+		}
+		if (outside)
+		{
+			continue;
+		}
+
+		if (inside)
+		{
+			AppendSubtree(nodeIdx, outEntities);
+		}
+		else if (node.left < 0)
+		{
+			for (int item = node.firstItem; item < node.firstItem + node.numItems; item++)
+			{
+				const BBox& box = itemBoxes[item];
+				if (frustum.IntersectsBox(box.GetCenter(), (box.maxXYZ - box.minXYZ) * 0.5f))
+				{
+					outEntities.push_back(itemEntities[item]);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+}
+
+void BVH::QuerySphere(const glm::vec3& center, float radius, std::vector<int>& outEntities) const
+{
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	int stack[maxStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const Node& node = nodes[stack[--stackSize]];
+		if (!IntersectsSphere(node.bounds, center, radius))
+		{
+			continue;
+		}
+
+		if (node.left < 0)
+		{
+			for (int item = node.firstItem; item < node.firstItem + node.numItems; item++)
+			{
+				if (IntersectsSphere(itemBoxes[item], center, radius))
+				{
+					outEntities.push_back(itemEntities[item]);
+				}
+			}
+		}
+		else
+		{
+			stack[stackSize++] = node.left;
+			stack[stackSize++] = node.left + 1;
+		}
+	}
+}
+
+void BVH::QueryLight(const Scene& scene, const Light& light, std::vector<int>& outEntities) const
+{
+	if (light.type == Light::Directional)
+	{
+		if (!nodes.empty())
+		{
+			AppendSubtree(0, outEntities);
+		}
+		return;
+	}
+	// The range sphere bounds a spot light's cone too
+	QuerySphere(scene.globalTransforms[light.entityIdx][3], light.range, outEntities);
+}
+
+RayHit BVH::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+{
+	RayHit hit;
+	hit.distance = maxDistance;
+	if (nodes.empty())
+	{
+		return hit;
+	}
+
+	const glm::vec3 inverseDirection = 1.0f / direction;
+	struct StackEntry
+	{
+		int nodeIdx;
+		float distance; // where the ray enters the node's box
+	};
+	StackEntry stack[maxStackSize];
+	int stackSize = 0;
+	const float rootDistance = IntersectRay(nodes[0].bounds, origin, inverseDirection, hit.distance);
+	if (rootDistance != std::numeric_limits<float>::infinity())
+	{
+		stack[stackSize++] = StackEntry{ 0, rootDistance };
+	}
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		// A closer hit may have been found since the node was pushed
+		if (entry.distance > hit.distance)
+		{
+			continue;
+		}
+
+		const Node& node = nodes[entry.nodeIdx];
+		if (node.left < 0)
+		{
+			for (int item = node.firstItem; item < node.firstItem + node.numItems; item++)
+			{
+				const float distance = IntersectRay(itemBoxes[item], origin, inverseDirection, hit.distance);
+				if (distance != std::numeric_limits<float>::infinity() && (distance < hit.distance || hit.entityIdx < 0))
+				{
+					hit.entityIdx = itemEntities[item];
+					hit.distance = distance;
+				}
+			}
+			continue;
+		}
+
+		// Push the farther child first so the nearer one is visited first and shrinks hit.distance for the other
+		StackEntry children[2] = {
+			{ node.left, IntersectRay(nodes[node.left].bounds, origin, inverseDirection, hit.distance) },
+			{ node.left + 1, IntersectRay(nodes[node.left + 1].bounds, origin, inverseDirection, hit.distance) }
+		};
+		if (children[0].distance < children[1].distance)
+		{
+			std::swap(children[0], children[1]);
+		}
+		for (const StackEntry& child : children)
+		{
+			if (child.distance != std::numeric_limits<float>::infinity())
+			{
+				stack[stackSize++] = child;
+			}
+		}
+	}
+	return hit;
+}
+
+float BVH::ComputeSahCost() const
+{
+	if (nodes.empty())
+	{
+		return 0.0f;
+	}
+
+	float cost = 0.0f;
+	for (const Node& node : nodes)
+	{
+		cost += SurfaceArea(node.bounds) * (node.left < 0 ? (float)node.numItems : 1.0f);
+	}
+	return cost / SurfaceArea(nodes[0].bounds);
+}
\ No newline at end of file
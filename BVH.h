@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Frustum.h"
+#include "Light.h"
+#include "Scene.h"
+#include <cfloat>
+#include <glm/mat4x3.hpp>
+#include <span>
+#include <vector>
+
+// World space box of a model space box under an affine transform (Arvo's method, as in CullBoxes)
+BBox TransformBox(const BBox& box, const glm::mat4x3& transform);
+
+struct RayHit
+{
+	int entityIdx = -1; // -1 if nothing was hit
+	float distance = 0.0f; // along the ray direction, in units of its length
+};
+
+// Bounding volume hierarchy over the world space bounding boxes of every live entity with a mesh, so queries for what is
+// in a frustum, near a light or under the cursor cost about the log of the entity count instead of the count. Build
+// splits with the surface area heuristic over binned centroids, which gives the best tree for the entities' current
+// placement. Moving entities don't change the topology, Refit only recomputes the boxes of their leaves and of those
+// leaves' ancestors, so a level of mostly static entities with a few moving ones stays cheap to maintain. Refit trees get
+// looser as moved entities drift away from where they were built, call Build again after large rearrangements.
+//
+// Nodes are stored parents first with siblings adjacent, so a reverse sweep visits children before parents, and every
+// subtree's entities are one contiguous range of items
+class BVH
+{
+public:
+	static constexpr int maxLeafItems = 4;
+	static constexpr int numBins = 16;
+	// Deeper nodes are split in half by count, which bounds the depth, and with it the traversal stack, by maxSahDepth + 32
+	static constexpr int maxSahDepth = 64;
+
+	// After TransformSystem::Update. Call again when entities change
+	void Build(const Scene& scene);
+	// Recomputes every box
+	void Refit(const Scene& scene);
+	// Recomputes the boxes of movedEntities (see TransformSystem::GetUpdatedEntities) and their ancestors'. Entities that
+	// aren't in the tree are ignored
+	void Refit(const Scene& scene, std::span<const int> movedEntities);
+
+	// Append to outEntities, in no particular order. Same tests as Frustum::IntersectsBox, and as CullBoxes on the same boxes
+	void QueryFrustum(const Frustum& frustum, std::vector<int>& outEntities) const;
+	void QuerySphere(const glm::vec3& center, float radius, std::vector<int>& outEntities) const;
+	// Entities within range of a point or spot light, every entity for directional lights
+	void QueryLight(const Scene& scene, const Light& light, std::vector<int>& outEntities) const;
+	// Closest entity whose bounding box the ray hits at distance [0, maxDistance]. Boxes the origin is inside are hit at 0
+	RayHit Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance = FLT_MAX) const;
+
+	int GetNumEntities() const { return (int)itemEntities.size(); }
+	int GetNumNodes() const { return (int)nodes.size(); }
+	// Expected cost of a query under the surface area heuristic, relative to testing one box. Grows as refits loosen the tree
+	float ComputeSahCost() const;
+
+private:
+	struct Node
+	{
+		BBox bounds;
+		int firstItem; // the subtree's items
+		int numItems;
+		int left; // -1 for leaves, else the right child is left + 1
+	};
+
+	// Computes nodes[nodeIdx]'s bounds and splits it recursively. Nodes of more than maxLeafItems items are always split,
+	// smaller ones only when the surface area heuristic rates the split cheaper than testing their items
+	void Subdivide(int nodeIdx, int depth, std::vector<glm::vec3>& centroids);
+	void RefitNode(int nodeIdx);
+	void AppendSubtree(int nodeIdx, std::vector<int>& outEntities) const;
+
+	static constexpr int maxStackSize = maxSahDepth + 32;
+
+	std::vector<Node> nodes;
+	std::vector<int> parents; // per node, -1 for the root
+	// Per item in tree order
+	std::vector<int> itemEntities;
+	std::vector<BBox> itemBoxes; // in world space
+	std::vector<int> itemLeaves;
+	std::vector<int> entityItems; // per entity, -1 if it isn't in the tree
+	std::vector<int> dirtyLeaves; // scratch
+};
\ No newline at end of file
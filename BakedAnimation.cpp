@@ -0,0 +1,128 @@
+#include "BakedAnimation.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <unordered_map>
+
+std::vector<glm::vec4> BakeAnimationPalettes(const Scene& scene, int skeletonIdx, int animationIdx, float framesPerSecond, int& outNumFrames,
+	float& outActualFramesPerSecond)
+{
+	const Skeleton& skeleton = scene.skeletons[skeletonIdx];
+	const Animation& animation = scene.animations[animationIdx];
+	const int numJoints = (int)skeleton.joints.size();
+
+	// Round to a whole number of frames per loop so the wrap from the last frame to the first has the same spacing as the others
+	const int numFrames = std::max(1, (int)std::lround(animation.durationSeconds * framesPerSecond));
+	outNumFrames = numFrames;
+	outActualFramesPerSecond = animation.durationSeconds > 0.0f ? numFrames / animation.durationSeconds : framesPerSecond;
+
+	std::unordered_map<int, int> entityToJoint;
+	std::vector<Transform> restTransforms(numJoints);
+	for (int i = 0; i < numJoints; i++)
+	{
+		entityToJoint[skeleton.joints[i].entityIndex] = i;
+		restTransforms[i] = scene.entities.localTransforms[skeleton.joints[i].entityIndex];
+	}
+	std::vector<int> entityAnimationJoints(animation.entityAnimations.size(), -1);
+	for (int i = 0; i < animation.entityAnimations.size(); i++)
+	{
+		auto iter = entityToJoint.find(animation.entityAnimations[i].entityIdx);
+		if (iter != entityToJoint.end())
+		{
+			entityAnimationJoints[i] = iter->second;
+		}
+	}
+
+	std::vector<glm::vec4> texels(numFrames * numJoints * BakedAnimation::texelsPerJoint);
+	std::vector<Transform> jointLocalTransforms(numJoints);
+	SkinningPalette palette(numJoints);
+	for (int frame = 0; frame < numFrames; frame++)
+	{
+		const float time = frame / outActualFramesPerSecond;
+		jointLocalTransforms = restTransforms;
+		for (int i = 0; i < animation.entityAnimations.size(); i++)
+		{
+			if (entityAnimationJoints[i] >= 0)
+			{
+				SampleTransformAt(animation.entityAnimations[i], time, jointLocalTransforms[entityAnimationJoints[i]]);
+			}
+		}
+		ComputeSkinningMatrices(skeleton, jointLocalTransforms, palette);
+
+		glm::vec4* row = &texels[frame * numJoints * BakedAnimation::texelsPerJoint];
+		for (int joint = 0; joint < numJoints; joint++)
+		{
+			glm::vec4* jointTexels = row + joint * BakedAnimation::texelsPerJoint;
+			const glm::mat4x3& m = palette.skinningMatrices[joint];
+			const glm::mat3 normalMatrix = ComputeSkinningNormalMatrix(m);
+			for (int r = 0; r < 3; r++)
+			{
+				jointTexels[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+				jointTexels[3 + r] = glm::vec4(normalMatrix[0][r], normalMatrix[1][r], normalMatrix[2][r], 0.0f);
+			}
+		}
+	}
+	return texels;
+}
+
+BakedAnimation CreateBakedAnimation(const Scene& scene, int skeletonIdx, int animationIdx, float framesPerSecond)
+{
+	BakedAnimation baked;
+	baked.numJoints = (int)scene.skeletons[skeletonIdx].joints.size();
+	std::vector<glm::vec4> texels = BakeAnimationPalettes(scene, skeletonIdx, animationIdx, framesPerSecond, baked.numFrames, baked.framesPerSecond);
+
+	GLint maxTextureSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	assert(baked.numJoints * BakedAnimation::texelsPerJoint <= maxTextureSize && baked.numFrames <= maxTextureSize);
+
+	glGenTextures(1, &baked.texture);
+	glBindTexture(GL_TEXTURE_2D, baked.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, baked.numJoints * BakedAnimation::texelsPerJoint, baked.numFrames, 0, GL_RGBA, GL_FLOAT, texels.data());
+	// Only read with texelFetch
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	return baked;
+}
+
+BakedCrowd::BakedCrowd(const BakedAnimation& animation, const std::vector<BakedInstance>& instances)
+	: animation(animation)
+{
+	glGenBuffers(1, &instanceBuffer);
+	SetInstances(instances);
+}
+
+void BakedCrowd::SetInstances(const std::vector<BakedInstance>& instances)
+{
+	numInstances = (int)instances.size();
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(BakedInstance), instances.data(), GL_DYNAMIC_DRAW);
+}
+
+void BakedCrowd::Draw(Shader& shader, const Submesh& submesh, float timeSeconds, int textureUnit) const
+{
+	if (numInstances == 0)
+	{
+		return;
+	}
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, animation.texture);
+	shader.SetInt("bakedPalettes", textureUnit);
+	shader.SetFloat("bakedTimeSeconds", timeSeconds);
+	shader.SetFloat("bakedFramesPerSecond", animation.framesPerSecond);
+	shader.SetInt("bakedNumFrames", animation.numFrames);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+
+	glBindVertexArray(submesh.VAO);
+	if (submesh.hasIndexBuffer)
+	{
+		glDrawElementsInstanced(GL_TRIANGLES, submesh.countVerticesOrIndices, GL_UNSIGNED_INT, 0, numInstances);
+	}
+	else
+	{
+		glDrawArraysInstanced(GL_TRIANGLES, 0, submesh.countVerticesOrIndices, numInstances);
+	}
+}
\ No newline at end of file
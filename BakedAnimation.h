@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include "Mesh.h"
+#include "Scene.h"
+#include "Shader.h"
+#include <vector>
+
+// An animation's skinning palettes for one skeleton layout, sampled at a fixed rate into an RGBA32F texture. One row per
+// frame, 6 texels per joint: the rows of its 3x4 skinning matrix at x = Joint::paletteIdx * 6 + row, then the rows of its
+// normal matrix (see ComputeSkinningNormalMatrix, w unused) at x = Joint::paletteIdx * 6 + 3 + row. Frames cover exactly one
+// loop of the animation, so the last frame blends back into the first
+struct BakedAnimation
+{
+	static constexpr int texelsPerJoint = 6;
+
+	GLuint texture = 0;
+	int numJoints = 0;
+	int numFrames = 0;
+	float framesPerSecond = 0.0f;
+};
+
+// CPU part of the bake, doesn't touch GL. Returns numFrames rows of numJoints * BakedAnimation::texelsPerJoint texels
+std::vector<glm::vec4> BakeAnimationPalettes(const Scene& scene, int skeletonIdx, int animationIdx, float framesPerSecond, int& outNumFrames,
+	float& outActualFramesPerSecond);
+BakedAnimation CreateBakedAnimation(const Scene& scene, int skeletonIdx, int animationIdx, float framesPerSecond = 30.0f);
+
+// Matches BakedInstance in geometryPass.vert (std430)
+struct BakedInstance
+{
+	glm::mat4 world;
+	float timeOffsetSeconds;
+	float padding[3];
+};
+
+// Any number of instances playing one baked animation at their own time offsets. Needs no per-frame CPU work besides moving
+// instances, each submesh is drawn with a single instanced draw call
+class BakedCrowd
+{
+public:
+	BakedCrowd(const BakedAnimation& animation, const std::vector<BakedInstance>& instances);
+
+	void SetInstances(const std::vector<BakedInstance>& instances);
+	// shader must be a geometryPass.vert variant compiled with HAS_JOINTS and BAKED_ANIMATION
+	void Draw(Shader& shader, const Submesh& submesh, float timeSeconds, int textureUnit) const;
+
+private:
+	BakedAnimation animation;
+	GLuint instanceBuffer = 0;
+	int numInstances = 0;
+};
\ No newline at end of file
@@ -0,0 +1,1149 @@
+#include "Benchmark.h"
+
+#include "AnimationCompression.h"
+#include "AnimationSystem.h"
+#include "BakedAnimation.h"
+#include "BVH.h"
+#include "CpuSkinning.h"
+#include "FrustumCulling.h"
+#include "JobSystem.h"
+#include "OcclusionCulling.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "TransformSystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+// Every character gets its own skeleton (a binary tree of joints) and its own looping 2 second clip animating every joint.
+// With sharedClip only the first character gets a clip, the others play it through skeleton animation instances at random
+// time offsets
+static Scene BuildSyntheticCrowd(int numCharacters, int numJointsPerCharacter, bool sharedClip = false)
+{
+	Scene scene;
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> angleDistribution(-0.5f, 0.5f);
+
+	constexpr int numKeyframes = 60;
+	constexpr float clipDurationSeconds = 2.0f;
+	AnimationCompressionSettings compressionSettings;
+	AnimationCompressionStats compressionStats;
+
+	// Shared by all characters, only used for animation LOD
+	Mesh& characterMesh = scene.meshes.emplace_back();
+	characterMesh.boundingBox = BBox{ .minXYZ = glm::vec3(-0.5f, 0.0f, -0.5f), .maxXYZ = glm::vec3(0.5f, 2.0f, 0.5f) };
+
+	std::uniform_real_distribution<float> timeOffsetDistribution(0.0f, clipDurationSeconds);
+	for (int character = 0; character < numCharacters; character++)
+	{
+		const bool instanced = sharedClip && character > 0;
+		const int firstEntityIdx = scene.entities.Size();
+		Skeleton skeleton;
+		Animation animation;
+		animation.name = "Crowd" + std::to_string(character);
+		animation.durationSeconds = clipDurationSeconds;
+
+		for (int joint = 0; joint < numJointsPerCharacter; joint++)
+		{
+			const int entityIdx = scene.entities.Create(animation.name + "_Joint" + std::to_string(joint), Transform{
+				.translation = joint == 0 ? glm::vec3((float)character, 0.0f, 0.0f) : glm::vec3(0.0f, 0.1f, 0.0f),
+				.scale = glm::vec3(1.0f),
+				.rotation = glm::identity<glm::quat>()
+			});
+			if (joint > 0)
+			{
+				scene.entities.AddChild(firstEntityIdx + (joint - 1) / 2, entityIdx);
+			}
+			else
+			{
+				scene.entities.meshIndices[entityIdx] = 0;
+				scene.entities.skeletonIndices[entityIdx] = character;
+			}
+
+			skeleton.joints.push_back(Joint{
+				.localToJoint = glm::mat4x3(1.0f),
+				.entityIndex = firstEntityIdx + joint,
+				.parent = joint == 0 ? -1 : (joint - 1) / 2,
+				.paletteIdx = joint
+			});
+
+			if (instanced)
+			{
+				continue;
+			}
+
+			EntityAnimationSource source;
+			source.entityIdx = firstEntityIdx + joint;
+			source.rotations.method = InterpolationType::LINEAR;
+			glm::vec3 axis = glm::normalize(glm::vec3(angleDistribution(rng), 1.0f, angleDistribution(rng)));
+			float amplitude = angleDistribution(rng);
+			for (int key = 0; key < numKeyframes; key++)
+			{
+				float time = clipDurationSeconds * key / (numKeyframes - 1);
+				source.rotations.times.push_back(time);
+				source.rotations.values.push_back(glm::angleAxis(amplitude * std::sin(time * 3.14159265f), axis));
+			}
+			animation.entityAnimations.push_back(CompressEntityAnimation(source, 0.1f * (numJointsPerCharacter - joint), compressionSettings, compressionStats));
+		}
+
+		skeleton.layoutHash = skeleton.ComputeLayoutHash();
+		scene.skinningPalettes.emplace_back((int)skeleton.joints.size());
+		scene.skeletonPaletteIndices.push_back(character);
+		scene.skeletons.push_back(std::move(skeleton));
+		if (instanced)
+		{
+			scene.skeletonAnimationInstances.push_back(SkeletonAnimationInstance{
+				.skeletonIdx = character,
+				.animationIdx = 0,
+				.timeOffsetSeconds = timeOffsetDistribution(rng)
+			});
+		}
+		else
+		{
+			scene.animations.push_back(std::move(animation));
+		}
+	}
+
+	scene.animationEnabled.resize(scene.animations.size(), true);
+	scene.globalTransforms.resize(scene.entities.Size());
+	scene.transformDirty.resize(scene.entities.Size(), true);
+	scene.dirtyTransforms.resize(scene.entities.Size());
+	std::iota(scene.dirtyTransforms.begin(), scene.dirtyTransforms.end(), 0);
+	return scene;
+}
+
+void RunAnimationUpdateBenchmark(int numCharacters, int numJointsPerCharacter, int numFrames)
+{
+	std::cout << "Animation and hierarchy update: " << numCharacters << " characters, " << numJointsPerCharacter << " joints each, " << numFrames << " frames\n";
+
+	Scene scene = BuildSyntheticCrowd(numCharacters, numJointsPerCharacter);
+	const int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	double singleThreadMs = 0.0;
+
+	for (int numThreads = 1; numThreads <= maxThreads; numThreads++)
+	{
+		JobSystem jobSystem(numThreads);
+		AnimationSystem animationSystem;
+		TransformSystem transformSystem;
+		transformSystem.Build(scene);
+		animationSystem.Update(scene, 0.0f, jobSystem); // warm up, builds the channel list and allocates palettes
+		transformSystem.Update(scene, &jobSystem);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			animationSystem.Update(scene, frame / 60.0f, jobSystem);
+			transformSystem.Update(scene, &jobSystem);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double frameMs = std::chrono::duration<double, std::milli>(end - start).count() / numFrames;
+		if (numThreads == 1)
+		{
+			singleThreadMs = frameMs;
+		}
+		std::cout << "  " << numThreads << " thread(s): " << frameMs << " ms/frame, speedup " << singleThreadMs / frameMs << "x\n";
+	}
+}
+
+
+void RunTransformConversionBenchmark(int numTransforms, int numIterations)
+{
+	std::mt19937 rng(5678);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::vector<Transform> transforms(numTransforms);
+	for (Transform& transform : transforms)
+	{
+		transform.translation = glm::vec3(distribution(rng), distribution(rng), distribution(rng)) * 10.0f;
+		transform.scale = glm::vec3(distribution(rng), distribution(rng), distribution(rng)) + 2.0f;
+		transform.rotation = glm::normalize(glm::quat(distribution(rng), distribution(rng), distribution(rng), distribution(rng)));
+	}
+	std::vector<int> shuffledIndices(numTransforms);
+	std::iota(shuffledIndices.begin(), shuffledIndices.end(), 0);
+	std::shuffle(shuffledIndices.begin(), shuffledIndices.end(), rng);
+
+	std::vector<glm::mat4x3> referenceMatrices(numTransforms);
+	std::vector<glm::mat4x3> matrices(numTransforms);
+	auto time = [numIterations](auto&& convert)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < numIterations; iteration++)
+		{
+			convert();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / numIterations;
+	};
+	auto maxError = [&]()
+	{
+		float error = 0.0f;
+		for (int i = 0; i < numTransforms; i++)
+		{
+			for (int column = 0; column < 4; column++)
+			{
+				error = std::max(error, glm::length(matrices[i][column] - referenceMatrices[i][column]));
+			}
+		}
+		return error;
+	};
+
+	std::cout << "Transform to affine matrix conversion: " << numTransforms << " transforms, " << numIterations << " iterations\n";
+	for (bool gather : { false, true })
+	{
+		std::vector<int> indices = shuffledIndices;
+		if (!gather)
+		{
+			std::iota(indices.begin(), indices.end(), 0);
+		}
+
+		double scalarMs = time([&]() { ComputeAffineMatricesScalar(transforms, indices, referenceMatrices); });
+		double batchedMs = gather ?
+			time([&]() { ComputeAffineMatrices(transforms, indices, matrices); }) :
+			time([&]() { ComputeAffineMatrices(transforms, matrices); });
+		std::cout << "  " << (gather ? "gathered:   " : "contiguous: ") << "scalar " << scalarMs << " ms, batched " << batchedMs
+			<< " ms, speedup " << scalarMs / batchedMs << "x, max error " << maxError() << '\n';
+	}
+}
+
+void RunPoseCacheBenchmark(int numCharacters, int numJointsPerCharacter, int numFrames)
+{
+	std::cout << "Pose cache: " << numCharacters << " characters, " << numJointsPerCharacter << " joints each, " << numFrames << " frames\n";
+
+	JobSystem jobSystem;
+	double unsharedMs = 0.0;
+	for (bool sharedClip : { false, true })
+	{
+		Scene scene = BuildSyntheticCrowd(numCharacters, numJointsPerCharacter, sharedClip);
+		AnimationSystem animationSystem;
+		TransformSystem transformSystem;
+		transformSystem.Build(scene);
+		animationSystem.Update(scene, 0.0f, jobSystem);
+		transformSystem.Update(scene, &jobSystem);
+
+		int posesComputed = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			animationSystem.Update(scene, frame / 60.0f, jobSystem);
+			transformSystem.Update(scene, &jobSystem);
+			posesComputed += animationSystem.GetPoseCache().GetFrameMisses();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double frameMs = std::chrono::duration<double, std::milli>(end - start).count() / numFrames;
+		if (!sharedClip)
+		{
+			unsharedMs = frameMs;
+			std::cout << "  clip per character: " << frameMs << " ms/frame\n";
+		}
+		else
+		{
+			std::cout << "  shared clip, instanced: " << frameMs << " ms/frame, " << (float)posesComputed / numFrames << " poses computed per frame, speedup "
+				<< unsharedMs / frameMs << "x\n";
+
+			// Against poses sampled at each instance's own time, with a quantum so fine that every instance has its own bucket.
+			// Bucket centers keep every instance within half a quantum of its time
+			Scene exactScene = BuildSyntheticCrowd(numCharacters, numJointsPerCharacter, sharedClip);
+			AnimationSystem exactAnimationSystem;
+			exactAnimationSystem.SetPoseTimeQuantum(1e-6f);
+			const float time = numFrames / 60.0f;
+			animationSystem.Update(scene, time, jobSystem);
+			exactAnimationSystem.Update(exactScene, time, jobSystem);
+			float maxError = 0.0f;
+			for (int skeletonIdx = 0; skeletonIdx < scene.skeletons.size(); skeletonIdx++)
+			{
+				const SkinningPalette& palette = scene.skinningPalettes[scene.skeletonPaletteIndices[skeletonIdx]];
+				const SkinningPalette& exactPalette = exactScene.skinningPalettes[exactScene.skeletonPaletteIndices[skeletonIdx]];
+				for (int joint = 0; joint < palette.skinningMatrices.size(); joint++)
+				{
+					for (int column = 0; column < 4; column++)
+					{
+						maxError = std::max(maxError, glm::length(palette.skinningMatrices[joint][column] - exactPalette.skinningMatrices[joint][column]));
+					}
+				}
+			}
+			std::cout << "    max palette error against unquantized time " << maxError << " (" << animationSystem.GetPoseCache().GetNumPoses()
+				<< " poses)\n";
+		}
+	}
+}
+
+void RunAnimationLodBenchmark(int numCharacters, int numJointsPerCharacter, int numFrames)
+{
+	std::cout << "Animation LOD: " << numCharacters << " characters in a row, " << numJointsPerCharacter << " joints each, " << numFrames << " frames\n";
+
+	// Looking down the row of characters with a tenth of them behind the camera
+	Camera camera(glm::vec3(numCharacters * 0.1f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0.0f);
+	JobSystem jobSystem;
+	double fullRateMs = 0.0;
+	for (bool lod : { false, true })
+	{
+		Scene scene = BuildSyntheticCrowd(numCharacters, numJointsPerCharacter);
+		AnimationSystem animationSystem;
+		TransformSystem transformSystem;
+		transformSystem.Build(scene);
+		const Camera* lodCamera = lod ? &camera : nullptr;
+		transformSystem.Update(scene, &jobSystem); // LOD needs the characters' global transforms
+		animationSystem.Update(scene, 0.0f, jobSystem, lodCamera);
+		transformSystem.Update(scene, &jobSystem);
+
+		AnimationLodStats totals;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int frame = 0; frame < numFrames; frame++)
+		{
+			animationSystem.Update(scene, frame / 60.0f, jobSystem, lodCamera);
+			transformSystem.Update(scene, &jobSystem);
+			const AnimationLodStats& stats = animationSystem.GetLodStats();
+			totals.evaluatedSkeletons += stats.evaluatedSkeletons;
+			totals.interpolatedSkeletons += stats.interpolatedSkeletons;
+			totals.sampledEntities += stats.sampledEntities;
+			totals.skippedEntities += stats.skippedEntities;
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double frameMs = std::chrono::duration<double, std::milli>(end - start).count() / numFrames;
+		if (!lod)
+		{
+			fullRateMs = frameMs;
+			std::cout << "  LOD off: " << frameMs << " ms/frame\n";
+		}
+		else
+		{
+			const AnimationLodStats& stats = animationSystem.GetLodStats();
+			std::cout << "  LOD on: " << frameMs << " ms/frame, speedup " << fullRateMs / frameMs << "x\n"
+				<< "    skeletons at full/half/quarter rate/frozen: " << stats.fullRateSkeletons << '/' << stats.halfRateSkeletons << '/'
+				<< stats.quarterRateSkeletons << '/' << stats.frozenSkeletons << '\n'
+				<< "    per frame: " << (float)totals.evaluatedSkeletons / numFrames << " skeletons evaluated, " << (float)totals.interpolatedSkeletons / numFrames
+				<< " interpolated, " << (float)totals.sampledEntities / numFrames << " entities sampled, " << (float)totals.skippedEntities / numFrames << " skipped ("
+				<< 100.0f * totals.skippedEntities / std::max(1, totals.sampledEntities + totals.skippedEntities) << "% of sampling skipped)\n";
+		}
+	}
+}
+
+void RunBakedAnimationBenchmark(int numJoints, float framesPerSecond, int numSamples)
+{
+	Scene scene = BuildSyntheticCrowd(1, numJoints);
+	const float durationSeconds = scene.animations[0].durationSeconds;
+
+	int numFrames;
+	float actualFramesPerSecond;
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<glm::vec4> texels = BakeAnimationPalettes(scene, 0, 0, framesPerSecond, numFrames, actualFramesPerSecond);
+	auto end = std::chrono::high_resolution_clock::now();
+	std::cout << "Baked animation: " << numJoints << " joints, " << durationSeconds << " s clip, " << numFrames << " frames at "
+		<< actualFramesPerSecond << " fps (" << texels.size() * sizeof(glm::vec4) / 1024 << " KiB), baked in "
+		<< std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+
+	// What the shader fetches: the matrix of a joint at a frame, rows in 3 consecutive texels, and its normal matrix in the
+	// next 3
+	auto fetch = [&](int frame, int joint)
+	{
+		const glm::vec4* rows = &texels[(frame * numJoints + joint) * BakedAnimation::texelsPerJoint];
+		glm::mat4x3 m;
+		for (int column = 0; column < 4; column++)
+		{
+			m[column] = glm::vec3(rows[0][column], rows[1][column], rows[2][column]);
+		}
+		return m;
+	};
+	auto fetchNormalMatrix = [&](int frame, int joint)
+	{
+		const glm::vec4* rows = &texels[(frame * numJoints + joint) * BakedAnimation::texelsPerJoint + 3];
+		glm::mat3 m;
+		for (int column = 0; column < 3; column++)
+		{
+			m[column] = glm::vec3(rows[0][column], rows[1][column], rows[2][column]);
+		}
+		return m;
+	};
+
+	JobSystem jobSystem(1);
+	AnimationSystem animationSystem;
+	TransformSystem transformSystem;
+	transformSystem.Build(scene);
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> timeDistribution(0.0f, durationSeconds);
+	for (bool frameAligned : { true, false })
+	{
+		float maxError = 0.0f;
+		float maxNormalMatrixError = 0.0f;
+		for (int sample = 0; sample < numSamples; sample++)
+		{
+			const float time = frameAligned ? (sample % numFrames) / actualFramesPerSecond : timeDistribution(rng);
+			animationSystem.Update(scene, time, jobSystem);
+			transformSystem.Update(scene, &jobSystem);
+			const SkinningPalette& reference = scene.skinningPalettes[scene.skeletonPaletteIndices[0]];
+
+			// Same frame selection and blend as geometryPass.vert
+			const float frame = time * actualFramesPerSecond;
+			const int frame0 = (int)std::fmod(std::floor(frame), (float)numFrames);
+			const int frame1 = (frame0 + 1) % numFrames;
+			const float frameT = frame - std::floor(frame);
+			for (int joint = 0; joint < numJoints; joint++)
+			{
+				const glm::mat4x3 matrix0 = fetch(frame0, joint);
+				const glm::mat4x3 blended = matrix0 + (fetch(frame1, joint) - matrix0) * frameT;
+				for (int column = 0; column < 4; column++)
+				{
+					maxError = std::max(maxError, glm::length(blended[column] - reference.skinningMatrices[joint][column]));
+				}
+
+				const glm::mat3 normalMatrix0 = fetchNormalMatrix(frame0, joint);
+				const glm::mat3 blendedNormalMatrix = normalMatrix0 + (fetchNormalMatrix(frame1, joint) - normalMatrix0) * frameT;
+				const glm::mat3 referenceNormalMatrix = ComputeSkinningNormalMatrix(reference.skinningMatrices[joint]);
+				for (int column = 0; column < 3; column++)
+				{
+					maxNormalMatrixError = std::max(maxNormalMatrixError, glm::length(blendedNormalMatrix[column] - referenceNormalMatrix[column]));
+				}
+			}
+		}
+		std::cout << "  " << (frameAligned ? "at frame times:     " : "between frame times: ") << "max palette error " << maxError
+			<< ", max normal matrix error " << maxNormalMatrixError << '\n';
+	}
+}
+
+void RunCpuSkinningBenchmark(int numVertices, int numJoints, int numIterations)
+{
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::uniform_int_distribution<std::uint32_t> jointDistribution(0, numJoints - 1);
+
+	std::vector<glm::mat4x3> palette(numJoints);
+	for (glm::mat4x3& matrix : palette)
+	{
+		Transform transform;
+		transform.translation = glm::vec3(distribution(rng), distribution(rng), distribution(rng));
+		transform.scale = glm::vec3(distribution(rng), distribution(rng), distribution(rng)) * 0.25f + 1.0f;
+		transform.rotation = glm::normalize(glm::quat(distribution(rng), distribution(rng), distribution(rng), distribution(rng)));
+		matrix = transform.GetAffineMatrix();
+	}
+	std::vector<glm::mat3> normalMatrices(numJoints);
+	std::transform(palette.begin(), palette.end(), normalMatrices.begin(), ComputeSkinningNormalMatrix);
+
+	SkinningSourceVertices source;
+	source.numVertices = numVertices;
+	const int paddedNumVertices = (numVertices + 7) & ~7;
+	auto fill = [&](std::vector<float>* components, int numComponents)
+	{
+		for (int c = 0; c < numComponents; c++)
+		{
+			components[c].resize(paddedNumVertices);
+			std::generate(components[c].begin(), components[c].end(), [&]() { return distribution(rng); });
+		}
+	};
+	fill(source.positions, 3);
+	fill(source.normals, 3);
+	fill(source.tangents, 4);
+	fill(source.weights, 4);
+	fill(source.morphPositions, 6);
+	fill(source.morphNormals, 6);
+	fill(source.morphTangents, 6);
+	const glm::vec2 morphWeights(0.6f, 0.3f);
+	for (std::vector<std::uint32_t>& joints : source.joints)
+	{
+		joints.resize(paddedNumVertices);
+		std::generate(joints.begin(), joints.end(), [&]() { return jointDistribution(rng); });
+	}
+	for (int v = 0; v < paddedNumVertices; v++)
+	{
+		source.tangents[3][v] = source.tangents[3][v] < 0.0f ? -1.0f : 1.0f;
+		float weightSum = 0.0f;
+		for (int k = 0; k < 4; k++)
+		{
+			source.weights[k][v] = std::abs(source.weights[k][v]) + 0.01f;
+			weightSum += source.weights[k][v];
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			source.weights[k][v] /= weightSum;
+		}
+	}
+
+	const int stride = 10;
+	std::vector<float> referenceVertices(numVertices * stride);
+	std::vector<float> vertices(numVertices * stride);
+	auto time = [numIterations](auto&& skin)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < numIterations; iteration++)
+		{
+			skin();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / numIterations;
+	};
+	// Relative, normals and tangents aren't normalized so their length varies with the palette's scale
+	auto maxError = [&]()
+	{
+		float error = 0.0f;
+		for (int i = 0; i < numVertices * stride; i++)
+		{
+			error = std::max(error, std::abs(vertices[i] - referenceVertices[i]) / std::max(1.0f, std::abs(referenceVertices[i])));
+		}
+		return error;
+	};
+
+	std::cout << "CPU skinning: " << numVertices << " vertices, " << numJoints << " joints, " << numIterations << " iterations, "
+		<< (IsSkinVerticesVectorized() ? "AVX2" : "no AVX2, kernel is the reference") << '\n';
+	double referenceMs = time([&]() { SkinVerticesReference(source, palette, normalMatrices, morphWeights, 0, numVertices, referenceVertices.data()); });
+	double vectorizedMs = time([&]() { SkinVertices(source, palette, normalMatrices, morphWeights, 0, numVertices, vertices.data()); });
+	std::cout << "  reference " << referenceMs << " ms, kernel " << vectorizedMs << " ms, speedup " << referenceMs / vectorizedMs
+		<< "x, max relative error " << maxError() << '\n';
+
+	std::fill(vertices.begin(), vertices.end(), 0.0f);
+	JobSystem jobSystem;
+	double parallelMs = time([&]()
+	{
+		jobSystem.ParallelFor(numVertices, 4096, [&](int begin, int end)
+		{
+			SkinVertices(source, palette, normalMatrices, morphWeights, begin, end, vertices.data());
+		});
+	});
+	std::cout << "  kernel on " << jobSystem.GetNumThreads() << " threads " << parallelMs << " ms, speedup over reference "
+		<< referenceMs / parallelMs << "x, max relative error " << maxError() << '\n';
+
+	// skinning.comp morphs in bind space and then skins, so the same vertices with the targets already added in must skin
+	// to the same result
+	SkinningSourceVertices morphedSource = source;
+	for (int c = 0; c < 3; c++)
+	{
+		for (int v = 0; v < paddedNumVertices; v++)
+		{
+			morphedSource.positions[c][v] += morphWeights.x * source.morphPositions[c][v] + morphWeights.y * source.morphPositions[c + 3][v];
+			morphedSource.normals[c][v] += morphWeights.x * source.morphNormals[c][v] + morphWeights.y * source.morphNormals[c + 3][v];
+			morphedSource.tangents[c][v] += morphWeights.x * source.morphTangents[c][v] + morphWeights.y * source.morphTangents[c + 3][v];
+		}
+		morphedSource.morphPositions[c].clear();
+		morphedSource.morphPositions[c + 3].clear();
+		morphedSource.morphNormals[c].clear();
+		morphedSource.morphNormals[c + 3].clear();
+		morphedSource.morphTangents[c].clear();
+		morphedSource.morphTangents[c + 3].clear();
+	}
+	SkinVertices(morphedSource, palette, normalMatrices, morphWeights, 0, numVertices, vertices.data());
+	std::cout << "  max relative error against morphing before skinning " << maxError() << '\n';
+}
+
+void RunDualQuaternionSkinningBenchmark(int numVertices, int numJoints)
+{
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	std::uniform_int_distribution<std::uint32_t> jointDistribution(0, numJoints - 1);
+
+	std::vector<glm::mat4x3> palette(numJoints);
+	for (glm::mat4x3& matrix : palette)
+	{
+		Transform transform;
+		transform.translation = glm::vec3(distribution(rng), distribution(rng), distribution(rng));
+		transform.scale = glm::vec3(1.0f);
+		transform.rotation = glm::normalize(glm::quat(distribution(rng), distribution(rng), distribution(rng), distribution(rng)));
+		matrix = transform.GetAffineMatrix();
+	}
+	std::vector<glm::mat3> normalMatrices(numJoints);
+	std::transform(palette.begin(), palette.end(), normalMatrices.begin(), ComputeSkinningNormalMatrix);
+	std::vector<DualQuaternion> dualQuaternions(numJoints);
+	ComputeSkinningDualQuaternions(palette, dualQuaternions);
+
+	// Unit normals and tangents, so the skinned lengths show how far each blend is from a rotation
+	SkinningSourceVertices source;
+	source.numVertices = numVertices;
+	const int paddedNumVertices = (numVertices + 7) & ~7;
+	for (int c = 0; c < 3; c++)
+	{
+		source.positions[c].resize(paddedNumVertices);
+		source.normals[c].resize(paddedNumVertices);
+		source.tangents[c].resize(paddedNumVertices);
+	}
+	source.tangents[3].assign(paddedNumVertices, 1.0f);
+	for (int k = 0; k < 4; k++)
+	{
+		source.weights[k].resize(paddedNumVertices);
+		source.joints[k].resize(paddedNumVertices);
+		std::generate(source.joints[k].begin(), source.joints[k].end(), [&]() { return jointDistribution(rng); });
+	}
+	for (int v = 0; v < paddedNumVertices; v++)
+	{
+		const glm::vec3 normal = glm::normalize(glm::vec3(distribution(rng), distribution(rng), distribution(rng)) + glm::vec3(0.0f, 0.0f, 2.0f));
+		const glm::vec3 tangent = glm::normalize(glm::cross(normal, glm::vec3(1.0f, 0.0f, 0.0f)));
+		for (int c = 0; c < 3; c++)
+		{
+			source.positions[c][v] = distribution(rng);
+			source.normals[c][v] = normal[c];
+			source.tangents[c][v] = tangent[c];
+		}
+	}
+
+	const int stride = 10;
+	std::vector<float> linearVertices(numVertices * stride);
+	std::vector<float> dualQuaternionVertices(numVertices * stride);
+	auto skin = [&]()
+	{
+		SkinVerticesReference(source, palette, normalMatrices, glm::vec2(0.0f), 0, numVertices, linearVertices.data());
+		SkinVerticesDualQuaternionReference(source, dualQuaternions, glm::vec2(0.0f), 0, numVertices, dualQuaternionVertices.data());
+	};
+	auto maxDifference = [&]()
+	{
+		float difference = 0.0f;
+		for (int i = 0; i < numVertices * stride; i++)
+		{
+			difference = std::max(difference, std::abs(dualQuaternionVertices[i] - linearVertices[i]));
+		}
+		return difference;
+	};
+	auto minNormalLength = [&](const std::vector<float>& vertices)
+	{
+		float length = 1.0f;
+		for (int v = 0; v < numVertices; v++)
+		{
+			length = std::min(length, glm::length(glm::vec3(vertices[v * stride + 3], vertices[v * stride + 4], vertices[v * stride + 5])));
+		}
+		return length;
+	};
+
+	std::cout << "Dual quaternion skinning: " << numVertices << " vertices, " << numJoints << " rigid joints\n";
+
+	// The whole weight on the first joint, the other joints still take part in the hemisphere test with a zero weight
+	for (int v = 0; v < paddedNumVertices; v++)
+	{
+		source.weights[0][v] = 1.0f;
+		source.weights[1][v] = source.weights[2][v] = source.weights[3][v] = 0.0f;
+	}
+	skin();
+	std::cout << "  single joint vertices: max difference from linear blending " << maxDifference() << '\n';
+
+	for (int v = 0; v < paddedNumVertices; v++)
+	{
+		float weightSum = 0.0f;
+		for (int k = 0; k < 4; k++)
+		{
+			source.weights[k][v] = std::abs(distribution(rng)) + 0.01f;
+			weightSum += source.weights[k][v];
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			source.weights[k][v] /= weightSum;
+		}
+	}
+	skin();
+	std::cout << "  blended vertices: max difference from linear blending " << maxDifference() << ", shortest unit normal after linear blending "
+		<< minNormalLength(linearVertices) << ", after dual quaternion blending " << minNormalLength(dualQuaternionVertices) << '\n';
+}
+
+void RunDrawSortBenchmark(int numDraws, int numIterations)
+{
+	std::mt19937 rng(5678);
+	std::uniform_int_distribution<int> shaderDistribution(0, 7);
+	std::uniform_int_distribution<int> layoutDistribution(0, 63);
+	std::uniform_int_distribution<int> materialDistribution(0, 499);
+	std::uniform_int_distribution<std::uint32_t> depthDistribution(0, (1u << RenderQueue::depthBits) - 1);
+
+	std::vector<DrawSortItem> unsortedItems(numDraws);
+	for (int i = 0; i < numDraws; i++)
+	{
+		unsortedItems[i].key = RenderQueue::MakeSortKey(RenderPass::Geometry, shaderDistribution(rng), layoutDistribution(rng),
+			materialDistribution(rng), depthDistribution(rng));
+		unsortedItems[i].packetIdx = i;
+	}
+
+	std::vector<DrawSortItem> radixItems;
+	std::vector<DrawSortItem> scratch;
+	std::vector<DrawSortItem> referenceItems;
+	auto time = [numIterations, &unsortedItems](std::vector<DrawSortItem>& items, auto&& sort)
+	{
+		double totalMs = 0.0;
+		for (int iteration = 0; iteration < numIterations; iteration++)
+		{
+			items = unsortedItems;
+			auto start = std::chrono::high_resolution_clock::now();
+			sort();
+			auto end = std::chrono::high_resolution_clock::now();
+			totalMs += std::chrono::duration<double, std::milli>(end - start).count();
+		}
+		return totalMs / numIterations;
+	};
+
+	double stdSortMs = time(referenceItems, [&]()
+	{
+		std::stable_sort(referenceItems.begin(), referenceItems.end(), [](const DrawSortItem& a, const DrawSortItem& b) { return a.key < b.key; });
+	});
+	double radixSortMs = time(radixItems, [&]() { RadixSortDrawItems(radixItems, scratch); });
+	const bool sameOrder = std::equal(radixItems.begin(), radixItems.end(), referenceItems.begin(),
+		[](const DrawSortItem& a, const DrawSortItem& b) { return a.key == b.key && a.packetIdx == b.packetIdx; });
+
+	std::cout << "Draw sort: " << numDraws << " draws, " << numIterations << " iterations\n";
+	std::cout << "  std::stable_sort " << stdSortMs << " ms, radix sort " << radixSortMs << " ms, speedup " << stdSortMs / radixSortMs
+		<< "x, " << (sameOrder ? "same order" : "ORDER MISMATCH") << '\n';
+}
+
+void RunFrustumCullingBenchmark(int numBoxes, int numIterations)
+{
+	std::mt19937 rng(8765);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+	// Every box is its own entity, spread over a square 1 km wide around the camera
+	CullingBoxes boxes;
+	std::vector<glm::mat4x3> globalTransforms(numBoxes);
+	for (int i = 0; i < numBoxes; i++)
+	{
+		Transform transform;
+		transform.translation = glm::vec3(distribution(rng) * 500.0f, distribution(rng) * 10.0f, distribution(rng) * 500.0f);
+		transform.scale = glm::vec3(distribution(rng) * 0.5f + 1.0f);
+		transform.rotation = glm::normalize(glm::quat(distribution(rng), distribution(rng), distribution(rng), distribution(rng)));
+		globalTransforms[i] = transform.GetAffineMatrix();
+
+		const glm::vec3 center(distribution(rng), distribution(rng), distribution(rng));
+		const glm::vec3 extents = glm::vec3(distribution(rng), distribution(rng), distribution(rng)) * 0.75f + 1.25f;
+		boxes.Add(i, BBox{ .minXYZ = center - extents, .maxXYZ = center + extents });
+	}
+	const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const Frustum frustum = Frustum::FromMatrix(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f) * view);
+
+	std::vector<int> referenceVisible(numBoxes);
+	std::vector<int> visible(numBoxes);
+	auto time = [numIterations](auto&& cull)
+	{
+		int numVisible = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < numIterations; iteration++)
+		{
+			numVisible = cull();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::make_pair(std::chrono::duration<double, std::milli>(end - start).count() / numIterations, numVisible);
+	};
+
+	auto [referenceMs, numReferenceVisible] = time([&]() { return CullBoxesReference(boxes, globalTransforms, frustum, 0, numBoxes, referenceVisible.data()); });
+	auto [vectorizedMs, numVisible] = time([&]() { return CullBoxes(boxes, globalTransforms, frustum, 0, numBoxes, visible.data()); });
+	const bool sameResult = numVisible == numReferenceVisible && std::equal(visible.begin(), visible.begin() + numVisible, referenceVisible.begin());
+
+	std::cout << "Frustum culling: " << numBoxes << " boxes, " << numIterations << " iterations, " << (IsCullBoxesVectorized() ? "SSE" : "no SSE, kernel is the reference") << '\n';
+	std::cout << "  " << numReferenceVisible << " visible, " << numBoxes - numReferenceVisible << " culled, "
+		<< (sameResult ? "kernel agrees with reference" : "KERNEL DISAGREES WITH REFERENCE") << '\n';
+	std::cout << "  reference " << referenceMs << " ms, kernel " << vectorizedMs << " ms, speedup " << referenceMs / vectorizedMs << "x\n";
+
+	// Same chunking as FrustumCulling::Update
+	constexpr int boxesPerChunk = 1024;
+	const int numChunks = (numBoxes + boxesPerChunk - 1) / boxesPerChunk;
+	std::vector<int> chunkNumVisible(numChunks);
+	JobSystem jobSystem;
+	auto [parallelMs, unused] = time([&]()
+	{
+		jobSystem.ParallelFor(numChunks, 1, [&](int begin, int end)
+		{
+			for (int chunk = begin; chunk < end; chunk++)
+			{
+				const int first = chunk * boxesPerChunk;
+				chunkNumVisible[chunk] = CullBoxes(boxes, globalTransforms, frustum, first, std::min(first + boxesPerChunk, numBoxes), &visible[first]);
+			}
+		});
+		return 0;
+	});
+	const int numParallelVisible = std::accumulate(chunkNumVisible.begin(), chunkNumVisible.end(), 0);
+	std::cout << "  kernel on " << jobSystem.GetNumThreads() << " threads " << parallelMs << " ms, speedup over reference " << referenceMs / parallelMs
+		<< "x, " << numParallelVisible << " visible\n";
+}
+
+void RunBvhBenchmark(int numEntities, float movingFraction, int numIterations)
+{
+	std::mt19937 rng(4321);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+	// A few meshes of different sizes shared by root entities spread like RunFrustumCullingBenchmark's boxes
+	Scene scene;
+	for (int meshIdx = 0; meshIdx < 8; meshIdx++)
+	{
+		const glm::vec3 halfSize = glm::vec3(distribution(rng), distribution(rng), distribution(rng)) * 0.75f + 1.25f;
+		scene.meshes.emplace_back().boundingBox = BBox{ .minXYZ = -halfSize, .maxXYZ = halfSize };
+	}
+	scene.entities.Reserve(numEntities);
+	for (int i = 0; i < numEntities; i++)
+	{
+		Transform transform;
+		transform.translation = glm::vec3(distribution(rng) * 500.0f, distribution(rng) * 10.0f, distribution(rng) * 500.0f);
+		transform.scale = glm::vec3(distribution(rng) * 0.5f + 1.0f);
+		transform.rotation = glm::normalize(glm::quat(distribution(rng), distribution(rng), distribution(rng), distribution(rng)));
+		const int entityIdx = scene.entities.Create("Entity" + std::to_string(i), transform);
+		scene.entities.meshIndices[entityIdx] = i % (int)scene.meshes.size();
+	}
+	scene.globalTransforms.resize(numEntities);
+	scene.transformDirty.resize(numEntities, true);
+	for (int entityIdx = 0; entityIdx < numEntities; entityIdx++)
+	{
+		scene.dirtyTransforms.push_back(entityIdx);
+	}
+	TransformSystem transformSystem;
+	transformSystem.Build(scene);
+	transformSystem.Update(scene);
+
+	auto milliseconds = [](auto start, auto end) { return std::chrono::duration<double, std::milli>(end - start).count(); };
+
+	BVH bvh;
+	auto buildStart = std::chrono::high_resolution_clock::now();
+	bvh.Build(scene);
+	auto buildEnd = std::chrono::high_resolution_clock::now();
+	const float builtSahCost = bvh.ComputeSahCost();
+
+	auto fullRefitStart = std::chrono::high_resolution_clock::now();
+	for (int iteration = 0; iteration < numIterations; iteration++)
+	{
+		bvh.Refit(scene);
+	}
+	auto fullRefitEnd = std::chrono::high_resolution_clock::now();
+
+	// The same entities drift every frame, the rest of the level stays put
+	const int numMoving = (int)(numEntities * movingFraction);
+	std::vector<int> movingEntities(numEntities);
+	std::iota(movingEntities.begin(), movingEntities.end(), 0);
+	std::shuffle(movingEntities.begin(), movingEntities.end(), rng);
+	movingEntities.resize(numMoving);
+	std::vector<glm::vec3> velocities(numMoving);
+	for (glm::vec3& velocity : velocities)
+	{
+		velocity = glm::vec3(distribution(rng), 0.0f, distribution(rng)) * 0.1f;
+	}
+	std::vector<int> updatedEntities;
+	double incrementalRefitMs = 0.0;
+	for (int iteration = 0; iteration < numIterations; iteration++)
+	{
+		for (int i = 0; i < numMoving; i++)
+		{
+			scene.entities.localTransforms[movingEntities[i]].translation += velocities[i];
+			MarkTransformDirty(scene, movingEntities[i]);
+		}
+		transformSystem.Update(scene);
+		updatedEntities.clear();
+		transformSystem.GetUpdatedEntities(updatedEntities);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		bvh.Refit(scene, updatedEntities);
+		auto end = std::chrono::high_resolution_clock::now();
+		incrementalRefitMs += milliseconds(start, end);
+	}
+
+	std::cout << "BVH: " << numEntities << " entities, " << bvh.GetNumNodes() << " nodes, " << numMoving << " moving\n";
+	std::cout << "  build " << milliseconds(buildStart, buildEnd) << " ms, full refit " << milliseconds(fullRefitStart, fullRefitEnd) / numIterations
+		<< " ms, incremental refit " << incrementalRefitMs / numIterations << " ms\n";
+	std::cout << "  SAH cost " << builtSahCost << " after build, " << bvh.ComputeSahCost() << " after " << numIterations << " frames of movement\n";
+
+	// Linear scans over the same world boxes the tree holds
+	std::vector<BBox> worldBoxes(numEntities);
+	auto updateWorldBoxes = [&]()
+	{
+		for (int entityIdx = 0; entityIdx < numEntities; entityIdx++)
+		{
+			worldBoxes[entityIdx] = TransformBox(scene.meshes[scene.entities.meshIndices[entityIdx]].boundingBox, scene.globalTransforms[entityIdx]);
+		}
+	};
+	updateWorldBoxes();
+	auto time = [](int numQueries, auto&& query)
+	{
+		int numResults = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < numQueries; i++)
+		{
+			numResults += query(i);
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::make_pair(std::chrono::duration<double, std::milli>(end - start).count() / numQueries, numResults);
+	};
+	auto sameEntities = [](std::vector<int> a, std::vector<int> b)
+	{
+		std::sort(a.begin(), a.end());
+		std::sort(b.begin(), b.end());
+		return a == b;
+	};
+	auto report = [](const char* name, double linearMs, double bvhMs, bool agree)
+	{
+		std::cout << "  " << name << ": linear " << linearMs << " ms, BVH " << bvhMs << " ms (" << 1000.0 / bvhMs << " queries/s), speedup "
+			<< linearMs / bvhMs << "x, " << (agree ? "agrees with linear scan" : "DISAGREES WITH LINEAR SCAN") << '\n';
+	};
+
+	// Camera turning around in the middle of the level
+	constexpr int numFrusta = 64;
+	std::vector<Frustum> frusta;
+	for (int i = 0; i < numFrusta; i++)
+	{
+		const float angle = 6.2831853f * i / numFrusta;
+		const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(std::sin(angle), 2.0f, -std::cos(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+		frusta.push_back(Frustum::FromMatrix(glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f) * view));
+	}
+	std::vector<int> linearResult;
+	std::vector<int> bvhResult;
+	bool frustumAgrees = true;
+	for (const Frustum& frustum : frusta)
+	{
+		linearResult.clear();
+		bvhResult.clear();
+		for (int entityIdx = 0; entityIdx < numEntities; entityIdx++)
+		{
+			const BBox& box = worldBoxes[entityIdx];
+			if (frustum.IntersectsBox(box.GetCenter(), (box.maxXYZ - box.minXYZ) * 0.5f))
+			{
+				linearResult.push_back(entityIdx);
+			}
+		}
+		bvh.QueryFrustum(frustum, bvhResult);
+		frustumAgrees = frustumAgrees && sameEntities(linearResult, bvhResult);
+	}
+	// The linear frustum baseline is the SIMD kernel FrustumCulling uses
+	FrustumCulling frustumCulling;
+	frustumCulling.Build(scene);
+	auto [linearFrustumMs, numLinearVisible] = time(numFrusta, [&](int i)
+	{
+		frustumCulling.Update(scene, frusta[i]);
+		return frustumCulling.GetNumVisible();
+	});
+	auto [bvhFrustumMs, numBvhVisible] = time(numFrusta, [&](int i)
+	{
+		bvhResult.clear();
+		bvh.QueryFrustum(frusta[i], bvhResult);
+		return (int)bvhResult.size();
+	});
+	std::cout << "  " << numBvhVisible / numFrusta << " entities visible per frustum on average\n";
+	report("frustum (SIMD linear)", linearFrustumMs, bvhFrustumMs, frustumAgrees);
+
+	// Light ranges around random points
+	constexpr int numSpheres = 1000;
+	std::vector<glm::vec4> spheres(numSpheres);
+	for (glm::vec4& sphere : spheres)
+	{
+		sphere = glm::vec4(distribution(rng) * 500.0f, distribution(rng) * 10.0f, distribution(rng) * 500.0f, 10.0f + 20.0f * std::abs(distribution(rng)));
+	}
+	auto linearSphere = [&](const glm::vec4& sphere, std::vector<int>& out)
+	{
+		for (int entityIdx = 0; entityIdx < numEntities; entityIdx++)
+		{
+			const BBox& box = worldBoxes[entityIdx];
+			const glm::vec3 offset = glm::vec3(sphere) - glm::clamp(glm::vec3(sphere), box.minXYZ, box.maxXYZ);
+			if (glm::dot(offset, offset) <= sphere.w * sphere.w)
+			{
+				out.push_back(entityIdx);
+			}
+		}
+	};
+	bool spheresAgree = true;
+	for (const glm::vec4& sphere : spheres)
+	{
+		linearResult.clear();
+		bvhResult.clear();
+		linearSphere(sphere, linearResult);
+		bvh.QuerySphere(glm::vec3(sphere), sphere.w, bvhResult);
+		spheresAgree = spheresAgree && sameEntities(linearResult, bvhResult);
+	}
+	auto [linearSphereMs, unusedLinear] = time(numSpheres, [&](int i)
+	{
+		linearResult.clear();
+		linearSphere(spheres[i], linearResult);
+		return (int)linearResult.size();
+	});
+	auto [bvhSphereMs, unusedBvh] = time(numSpheres, [&](int i)
+	{
+		bvhResult.clear();
+		bvh.QuerySphere(glm::vec3(spheres[i]), spheres[i].w, bvhResult);
+		return (int)bvhResult.size();
+	});
+	report("sphere", linearSphereMs, bvhSphereMs, spheresAgree);
+
+	// Picking rays from eye height in random directions
+	constexpr int numRays = 1000;
+	std::vector<glm::vec3> rayDirections(numRays);
+	for (glm::vec3& direction : rayDirections)
+	{
+		direction = glm::normalize(glm::vec3(distribution(rng), distribution(rng) * 0.1f, distribution(rng)));
+	}
+	const glm::vec3 rayOrigin(0.0f, 2.0f, 0.0f);
+	auto linearRaycast = [&](const glm::vec3& direction)
+	{
+		// Same slab test as the BVH's
+		const glm::vec3 inverseDirection = 1.0f / direction;
+		RayHit hit;
+		hit.distance = FLT_MAX;
+		for (int entityIdx = 0; entityIdx < numEntities; entityIdx++)
+		{
+			const glm::vec3 t1 = (worldBoxes[entityIdx].minXYZ - rayOrigin) * inverseDirection;
+			const glm::vec3 t2 = (worldBoxes[entityIdx].maxXYZ - rayOrigin) * inverseDirection;
+			const glm::vec3 tNear = glm::min(t1, t2);
+			const glm::vec3 tFar = glm::max(t1, t2);
+			const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			const float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+			if (enter <= exit && enter < hit.distance)
+			{
+				hit = RayHit{ entityIdx, enter };
+			}
+		}
+		return hit;
+	};
+	bool raysAgree = true;
+	for (const glm::vec3& direction : rayDirections)
+	{
+		const RayHit linearHit = linearRaycast(direction);
+		const RayHit bvhHit = bvh.Raycast(rayOrigin, direction);
+		raysAgree = raysAgree && linearHit.entityIdx == bvhHit.entityIdx && (linearHit.entityIdx < 0 || linearHit.distance == bvhHit.distance);
+	}
+	auto [linearRayMs, numLinearHits] = time(numRays, [&](int i) { return linearRaycast(rayDirections[i]).entityIdx >= 0 ? 1 : 0; });
+	auto [bvhRayMs, numBvhHits] = time(numRays, [&](int i) { return bvh.Raycast(rayOrigin, rayDirections[i]).entityIdx >= 0 ? 1 : 0; });
+	report("ray", linearRayMs, bvhRayMs, raysAgree && numLinearHits == numBvhHits);
+}
+
+void RunOcclusionCullingBenchmark(int numProps, int numIterations)
+{
+	std::mt19937 rng(2468);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+
+	// Unit cube buildings that occlude with their own 12 triangles, and props too small to
+	Scene scene;
+	Mesh& buildingMesh = scene.meshes.emplace_back();
+	buildingMesh.boundingBox = BBox{ .minXYZ = glm::vec3(-0.5f, 0.0f, -0.5f), .maxXYZ = glm::vec3(0.5f, 1.0f, 0.5f) };
+	for (const glm::vec3& corner : buildingMesh.boundingBox.GetVertices())
+	{
+		buildingMesh.occluderPositions.push_back(corner);
+	}
+	// Faces as quads of BBox::GetVertices corners, both windings are rasterized
+	buildingMesh.occluderIndices = {
+		0, 1, 3, 0, 3, 2, // bottom
+		4, 5, 7, 4, 7, 6, // top
+		0, 1, 6, 0, 6, 7, // -z
+		2, 3, 4, 2, 4, 5, // +z
+		0, 2, 5, 0, 5, 7, // -x
+		1, 3, 4, 1, 4, 6  // +x
+	};
+	scene.meshes.emplace_back().boundingBox = BBox{ .minXYZ = glm::vec3(-0.5f, 0.0f, -0.5f), .maxXYZ = glm::vec3(0.5f, 1.0f, 0.5f) };
+
+	// 20x20 blocks 30 m wide with 10 m streets between them
+	constexpr int numBlocksPerSide = 20;
+	constexpr float blockSize = 30.0f;
+	constexpr float streetWidth = 10.0f;
+	constexpr float citySize = numBlocksPerSide * (blockSize + streetWidth);
+	std::vector<BBox> buildingBoxes;
+	for (int blockZ = 0; blockZ < numBlocksPerSide; blockZ++)
+	{
+		for (int blockX = 0; blockX < numBlocksPerSide; blockX++)
+		{
+			Transform transform;
+			transform.translation = glm::vec3(blockX, 0.0f, blockZ) * (blockSize + streetWidth) + glm::vec3(streetWidth + blockSize * 0.5f, 0.0f, streetWidth + blockSize * 0.5f);
+			transform.scale = glm::vec3(blockSize, 10.0f + 30.0f * distribution(rng), blockSize);
+			transform.rotation = glm::identity<glm::quat>();
+			const int entityIdx = scene.entities.Create("Building", transform);
+			scene.entities.meshIndices[entityIdx] = 0;
+			buildingBoxes.push_back(BBox{ .minXYZ = transform.translation - glm::vec3(blockSize * 0.5f, 0.0f, blockSize * 0.5f),
+				.maxXYZ = transform.translation + glm::vec3(blockSize * 0.5f, transform.scale.y, blockSize * 0.5f) });
+		}
+	}
+	// Props in the streets
+	for (int i = 0; i < numProps; i++)
+	{
+		Transform transform;
+		const float along = distribution(rng) * citySize;
+		const float across = (std::floor(distribution(rng) * numBlocksPerSide) * (blockSize + streetWidth)) + distribution(rng) * streetWidth * 0.8f + streetWidth * 0.1f;
+		transform.translation = i % 2 == 0 ? glm::vec3(along, 0.0f, across) : glm::vec3(across, 0.0f, along);
+		transform.scale = glm::vec3(0.5f + distribution(rng));
+		transform.rotation = glm::identity<glm::quat>();
+		const int entityIdx = scene.entities.Create("Prop", transform);
+		scene.entities.meshIndices[entityIdx] = 1;
+	}
+	const int numEntities = scene.entities.Size();
+	scene.globalTransforms.resize(numEntities);
+	scene.transformDirty.resize(numEntities, true);
+	for (int entityIdx = 0; entityIdx < numEntities; entityIdx++)
+	{
+		scene.dirtyTransforms.push_back(entityIdx);
+	}
+	TransformSystem transformSystem;
+	transformSystem.Build(scene);
+	transformSystem.Update(scene);
+
+	// Standing at a crossing looking down a street and slightly across the blocks
+	const glm::vec3 eye(streetWidth * 0.5f + 4.0f * (blockSize + streetWidth), 1.7f, streetWidth * 0.5f + 10.0f * (blockSize + streetWidth));
+	const glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.3f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f) * view;
+
+	BVH bvh;
+	bvh.Build(scene);
+	std::vector<int> candidates;
+	bvh.QueryFrustum(Frustum::FromMatrix(viewProjection), candidates);
+
+	OcclusionCulling occlusionCulling;
+	auto time = [numIterations](auto&& update)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int iteration = 0; iteration < numIterations; iteration++)
+		{
+			update();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / numIterations;
+	};
+	const double singleThreadedMs = time([&]() { occlusionCulling.Update(scene, viewProjection, candidates); });
+	JobSystem jobSystem;
+	const double parallelMs = time([&]() { occlusionCulling.Update(scene, viewProjection, candidates, &jobSystem); });
+
+	// A culled prop must have every corner and its center hidden behind some building. Silhouettes are sampled at pixel
+	// centers, so props peeking out by less than a pixel may be culled too, those are told apart by retrying with the
+	// buildings grown by a pixel's width at the prop's distance
+	std::vector<std::uint8_t> visible(numEntities, false);
+	for (int entityIdx : occlusionCulling.GetVisibleEntities())
+	{
+		visible[entityIdx] = true;
+	}
+	const float pixelSizePerDistance = 2.0f * std::tan(glm::radians(30.0f)) / OcclusionCulling::height;
+	auto isHidden = [&](const glm::vec3& point, bool pixelTolerance)
+	{
+		const glm::vec3 direction = point - eye;
+		const glm::vec3 inverseDirection = 1.0f / direction;
+		const glm::vec3 tolerance(pixelTolerance ? glm::length(direction) * pixelSizePerDistance : 0.0f);
+		for (const BBox& building : buildingBoxes)
+		{
+			const glm::vec3 t1 = (building.minXYZ - tolerance - eye) * inverseDirection;
+			const glm::vec3 t2 = (building.maxXYZ + tolerance - eye) * inverseDirection;
+			const glm::vec3 tNear = glm::min(t1, t2);
+			const glm::vec3 tFar = glm::max(t1, t2);
+			const float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, 1.0f));
+			if (enter <= exit && enter < 1.0f)
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+	int numCulledProps = 0;
+	int numCulledBySubpixelMargin = 0;
+	int numWronglyCulled = 0;
+	for (int entityIdx : candidates)
+	{
+		if (scene.entities.meshIndices[entityIdx] != 1 || visible[entityIdx])
+		{
+			continue;
+		}
+		numCulledProps++;
+		const BBox box = TransformBox(scene.meshes[1].boundingBox, scene.globalTransforms[entityIdx]);
+		bool hidden = isHidden(box.GetCenter(), false);
+		bool hiddenWithinPixel = isHidden(box.GetCenter(), true);
+		for (const glm::vec3& corner : box.GetVertices())
+		{
+			hidden = hidden && isHidden(corner, false);
+			hiddenWithinPixel = hiddenWithinPixel && isHidden(corner, true);
+		}
+		numCulledBySubpixelMargin += !hidden && hiddenWithinPixel ? 1 : 0;
+		numWronglyCulled += hiddenWithinPixel ? 0 : 1;
+	}
+
+	std::cout << "Occlusion culling: " << OcclusionCulling::width << "x" << OcclusionCulling::height << " depth buffer, " << numEntities << " entities, "
+		<< candidates.size() << " in the frustum, " << numIterations << " iterations\n";
+	std::cout << "  " << occlusionCulling.GetNumOccluders() << " occluders, " << occlusionCulling.GetNumOccluderTriangles() << " triangles rasterized, "
+		<< occlusionCulling.GetNumOccluded() << " occluded, " << occlusionCulling.GetVisibleEntities().size() << " left to draw\n";
+	if (numWronglyCulled == 0)
+	{
+		std::cout << "  every culled prop is hidden behind a building, " << numCulledBySubpixelMargin << " of " << numCulledProps
+			<< " by less than a pixel\n";
+	}
+	else
+	{
+		std::cout << "  PROPS CULLED WHILE VISIBLE: " << numWronglyCulled << " of " << numCulledProps << '\n';
+	}
+	std::cout << "  single threaded " << singleThreadedMs << " ms, on " << jobSystem.GetNumThreads() << " threads " << parallelMs << " ms\n";
+}
\ No newline at end of file
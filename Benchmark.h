@@ -0,0 +1,38 @@
+#pragma once
+
+// Headless CPU benchmarks, run with the --benchmark command line argument. None of them need an OpenGL context.
+
+// Times AnimationSystem::Update followed by TransformSystem::Update on a synthetic crowd with 1 to hardware_concurrency threads
+void RunAnimationUpdateBenchmark(int numCharacters = 500, int numJointsPerCharacter = 64, int numFrames = 200);
+
+// Times scalar versus batched SIMD conversion of Transforms to affine matrices, contiguous and gathered through an index list
+void RunTransformConversionBenchmark(int numTransforms = 100000, int numIterations = 100);
+// Compares a crowd where every character has its own clip with one where all characters play one clip through skeleton
+// animation instances, which the pose cache collapses to one pose per time bucket
+void RunPoseCacheBenchmark(int numCharacters = 2000, int numJointsPerCharacter = 64, int numFrames = 200);
+// Compares full rate animation of a row of characters with update rate LOD seen from a camera looking down the row
+void RunAnimationLodBenchmark(int numCharacters = 500, int numJointsPerCharacter = 64, int numFrames = 200);
+// Bakes a synthetic character's clip into palette rows like CreateBakedAnimation, then checks the palettes geometryPass.vert's
+// BAKED_ANIMATION variant would blend from them against AnimationSystem's palettes at frame times and between frames
+void RunBakedAnimationBenchmark(int numJoints = 64, float framesPerSecond = 30.0f, int numSamples = 1000);
+// Checks the vectorized CPU skinning kernel against the reference that mirrors the shader math on random vertices and
+// palettes, then times the reference, the vectorized kernel and the vectorized kernel across the job system
+void RunCpuSkinningBenchmark(int numVertices = 200000, int numJoints = 300, int numIterations = 50);
+// Skins random vertices with linear blending and with dual quaternions on a rigid rig (rotations and translations, no scale).
+// Checks both agree on vertices bound to a single joint, where dual quaternion skinning must reduce to the joint's matrix, then
+// reports how far they part on blended vertices and how much linear blending shrinks their normals
+void RunDualQuaternionSkinningBenchmark(int numVertices = 100000, int numJoints = 300);
+// Sorts draw items with keys shaped like RenderQueue's (few shaders and layouts, many materials, random depths) with the
+// radix sort and with std::stable_sort, checks both give the same order and times them
+void RunDrawSortBenchmark(int numDraws = 50000, int numIterations = 100);
+// Culls random boxes scattered around a camera with the reference and the SIMD test, checks they agree and times them,
+// single threaded and across the job system
+void RunFrustumCullingBenchmark(int numBoxes = 200000, int numIterations = 100);
+// Builds a BVH over random entities spread over a square 1 km wide and times its SAH build, a full refit and an
+// incremental refit after a fraction of them moved. Then checks frustum, sphere and ray queries against linear scans and
+// times both
+void RunBvhBenchmark(int numEntities = 100000, float movingFraction = 0.1f, int numIterations = 100);
+// Rasterizes the buildings of a synthetic city block grid as occluders seen from street level and occlusion culls the
+// props scattered between them, checking every culled prop is hidden behind a building by casting rays to its corners,
+// and times the rasterization and the tests single threaded and across the job system
+void RunOcclusionCullingBenchmark(int numProps = 50000, int numIterations = 100);
\ No newline at end of file
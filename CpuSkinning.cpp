@@ -0,0 +1,507 @@
+#include "CpuSkinning.h"
+#include "GLTFMeshParser.h"
+#include "SkinningPrePass.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// The AVX2 kernel is compiled into every x64 build and picked at runtime if the CPU has AVX2, so the build doesn't need
+// /arch:AVX2 (which would let the compiler use AVX2 anywhere in the file) and still runs on CPUs without it
+#if defined(_M_X64) || defined(__x86_64__)
+#define CPU_SKINNING_USE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+static_assert(sizeof(glm::mat4x3) == 12 * sizeof(float) && sizeof(glm::mat3) == 9 * sizeof(float), "Palettes are gathered from as arrays of floats");
+
+SkinningSourceVertices SkinningSourceVertices::FromInterleaved(std::span<const std::uint8_t> vertexBuffer, VertexAttribute flags, int numVertices)
+{
+	assert(HasFlag(flags, VertexAttribute::JOINTS));
+
+	SkinningSourceVertices source;
+	source.numVertices = numVertices;
+	const int paddedNumVertices = (numVertices + 7) & ~7;
+	const int stride = GLTFMeshParser::GetVertexSizeBytes(flags);
+
+	auto deinterleave = [&](VertexAttribute attribute, int numComponents, std::vector<float>* outComponents)
+	{
+		const int offset = GLTFMeshParser::GetAttributeByteOffset(flags, attribute);
+		for (int c = 0; c < numComponents; c++)
+		{
+			outComponents[c].assign(paddedNumVertices, 0.0f);
+			for (int v = 0; v < numVertices; v++)
+			{
+				std::memcpy(&outComponents[c][v], vertexBuffer.data() + v * stride + offset + c * sizeof(float), sizeof(float));
+			}
+		}
+	};
+
+	deinterleave(VertexAttribute::POSITION, 3, source.positions);
+	deinterleave(VertexAttribute::WEIGHTS, 4, source.weights);
+	if (HasFlag(flags, VertexAttribute::NORMAL))
+	{
+		deinterleave(VertexAttribute::NORMAL, 3, source.normals);
+	}
+	if (HasFlag(flags, VertexAttribute::TANGENT))
+	{
+		deinterleave(VertexAttribute::TANGENT, 4, source.tangents);
+	}
+	// Target 1 directly follows target 0 in the vertex, so both are read as 6 components
+	if (HasFlag(flags, VertexAttribute::MORPH_TARGET0_POSITION))
+	{
+		deinterleave(VertexAttribute::MORPH_TARGET0_POSITION, 6, source.morphPositions);
+		if (HasFlag(flags, VertexAttribute::NORMAL) && HasFlag(flags, VertexAttribute::MORPH_TARGET0_NORMAL))
+		{
+			deinterleave(VertexAttribute::MORPH_TARGET0_NORMAL, 6, source.morphNormals);
+		}
+		if (HasFlag(flags, VertexAttribute::TANGENT) && HasFlag(flags, VertexAttribute::MORPH_TARGET0_TANGENT))
+		{
+			deinterleave(VertexAttribute::MORPH_TARGET0_TANGENT, 6, source.morphTangents);
+		}
+	}
+
+	const int jointsOffset = GLTFMeshParser::GetAttributeByteOffset(flags, VertexAttribute::JOINTS);
+	for (int k = 0; k < 4; k++)
+	{
+		source.joints[k].assign(paddedNumVertices, 0);
+		for (int v = 0; v < numVertices; v++)
+		{
+			std::uint16_t joint;
+			std::memcpy(&joint, vertexBuffer.data() + v * stride + jointsOffset + k * sizeof(std::uint16_t), sizeof(joint));
+			source.joints[k][v] = joint;
+		}
+	}
+
+	return source;
+}
+
+// Component c of vertex v, plus the weighted deltas of both morph targets if there are any
+static glm::vec3 LoadMorphed(const std::vector<float>* components, const std::vector<float>* morphDeltas, glm::vec2 morphWeights, int v)
+{
+	glm::vec3 value(components[0][v], components[1][v], components[2][v]);
+	if (!morphDeltas[0].empty())
+	{
+		value += morphWeights.x * glm::vec3(morphDeltas[0][v], morphDeltas[1][v], morphDeltas[2][v]) +
+			morphWeights.y * glm::vec3(morphDeltas[3][v], morphDeltas[4][v], morphDeltas[5][v]);
+	}
+	return value;
+}
+
+// Morphs vertex v of source and transforms it into vertex, which has the layout of GetSkinnedVertexStrideFloats
+static void WriteSkinnedVertex(const SkinningSourceVertices& source, glm::vec2 morphWeights, int v, const glm::mat4x3& skinningMatrix,
+	const glm::mat3& normalMatrix, float* vertex)
+{
+	const glm::vec3 position = skinningMatrix * glm::vec4(LoadMorphed(source.positions, source.morphPositions, morphWeights, v), 1.0f);
+	vertex[0] = position.x;
+	vertex[1] = position.y;
+	vertex[2] = position.z;
+
+	int tangentOffset = 3;
+	if (source.HasNormals())
+	{
+		const glm::vec3 normal = normalMatrix * LoadMorphed(source.normals, source.morphNormals, morphWeights, v);
+		vertex[3] = normal.x;
+		vertex[4] = normal.y;
+		vertex[5] = normal.z;
+		tangentOffset = 6;
+	}
+	if (source.HasTangents())
+	{
+		const glm::vec3 tangent = normalMatrix * LoadMorphed(source.tangents, source.morphTangents, morphWeights, v);
+		vertex[tangentOffset] = tangent.x;
+		vertex[tangentOffset + 1] = tangent.y;
+		vertex[tangentOffset + 2] = tangent.z;
+		vertex[tangentOffset + 3] = source.tangents[3][v];
+	}
+}
+
+void SkinVerticesReference(const SkinningSourceVertices& source, std::span<const glm::mat4x3> palette, std::span<const glm::mat3> normalMatrices,
+	glm::vec2 morphWeights, int begin, int end, float* out)
+{
+	const int stride = 3 + (source.HasNormals() ? 3 : 0) + (source.HasTangents() ? 4 : 0);
+
+	for (int v = begin; v < end; v++)
+	{
+		const glm::mat4x3 skinningMatrix = source.weights[0][v] * palette[source.joints[0][v]] +
+			source.weights[1][v] * palette[source.joints[1][v]] +
+			source.weights[2][v] * palette[source.joints[2][v]] +
+			source.weights[3][v] * palette[source.joints[3][v]];
+		glm::mat3 normalMatrix(1.0f);
+		if (source.HasNormals() || source.HasTangents())
+		{
+			normalMatrix = source.weights[0][v] * normalMatrices[source.joints[0][v]] +
+				source.weights[1][v] * normalMatrices[source.joints[1][v]] +
+				source.weights[2][v] * normalMatrices[source.joints[2][v]] +
+				source.weights[3][v] * normalMatrices[source.joints[3][v]];
+		}
+		WriteSkinnedVertex(source, morphWeights, v, skinningMatrix, normalMatrix, out + v * stride);
+	}
+}
+
+void SkinVerticesDualQuaternionReference(const SkinningSourceVertices& source, std::span<const DualQuaternion> dualQuaternions,
+	glm::vec2 morphWeights, int begin, int end, float* out)
+{
+	const int stride = 3 + (source.HasNormals() ? 3 : 0) + (source.HasTangents() ? 4 : 0);
+
+	for (int v = begin; v < end; v++)
+	{
+		// Normalized weighted sum, each joint's dual quaternion flipped into the first one's hemisphere
+		const DualQuaternion& dq0 = dualQuaternions[source.joints[0][v]];
+		glm::quat real = source.weights[0][v] * dq0.real;
+		glm::quat dual = source.weights[0][v] * dq0.dual;
+		for (int k = 1; k < 4; k++)
+		{
+			const DualQuaternion& dq = dualQuaternions[source.joints[k][v]];
+			const float weight = glm::dot(dq0.real, dq.real) < 0.0f ? -source.weights[k][v] : source.weights[k][v];
+			real += weight * dq.real;
+			dual += weight * dq.dual;
+		}
+		const float invLength = 1.0f / glm::length(real);
+		const glm::quat r = real * invLength;
+		const glm::quat d = dual * invLength;
+
+		const glm::vec3 rXyz(r.x, r.y, r.z);
+		const glm::vec3 dXyz(d.x, d.y, d.z);
+		const glm::vec3 translation = 2.0f * (r.w * dXyz - d.w * rXyz + glm::cross(rXyz, dXyz));
+		// Rigid, so the rotation is its own normal matrix
+		const glm::mat3 rotation = glm::mat3_cast(r);
+		WriteSkinnedVertex(source, morphWeights, v, glm::mat4x3(rotation[0], rotation[1], rotation[2], translation), rotation, out + v * stride);
+	}
+}
+
+#ifdef CPU_SKINNING_USE_AVX2
+// 8 vec3s, one per lane
+struct Vec3x8
+{
+	__m256 x, y, z;
+};
+
+// a * s.x + b * s.y + c * s.z
+AVX2_TARGET static inline Vec3x8 Combine(const Vec3x8& a, const Vec3x8& b, const Vec3x8& c, const Vec3x8& s)
+{
+	return {
+		_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, s.x), _mm256_mul_ps(b.x, s.y)), _mm256_mul_ps(c.x, s.z)),
+		_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.y, s.x), _mm256_mul_ps(b.y, s.y)), _mm256_mul_ps(c.y, s.z)),
+		_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.z, s.x), _mm256_mul_ps(b.z, s.y)), _mm256_mul_ps(c.z, s.z))
+	};
+}
+
+AVX2_TARGET static inline Vec3x8 Load(const std::vector<float>* components, int v)
+{
+	return { _mm256_loadu_ps(components[0].data() + v), _mm256_loadu_ps(components[1].data() + v), _mm256_loadu_ps(components[2].data() + v) };
+}
+
+// Like LoadMorphed, 8 vertices at once
+AVX2_TARGET static inline Vec3x8 LoadMorphed(const std::vector<float>* components, const std::vector<float>* morphDeltas, __m256 morph1Weight,
+	__m256 morph2Weight, int v)
+{
+	Vec3x8 value = Load(components, v);
+	if (!morphDeltas[0].empty())
+	{
+		const Vec3x8 delta1 = Load(morphDeltas, v);
+		const Vec3x8 delta2 = Load(morphDeltas + 3, v);
+		value.x = _mm256_add_ps(value.x, _mm256_add_ps(_mm256_mul_ps(morph1Weight, delta1.x), _mm256_mul_ps(morph2Weight, delta2.x)));
+		value.y = _mm256_add_ps(value.y, _mm256_add_ps(_mm256_mul_ps(morph1Weight, delta1.y), _mm256_mul_ps(morph2Weight, delta2.y)));
+		value.z = _mm256_add_ps(value.z, _mm256_add_ps(_mm256_mul_ps(morph1Weight, delta1.z), _mm256_mul_ps(morph2Weight, delta2.z)));
+	}
+	return value;
+}
+
+// Each lane is one vertex. Lanes gather their 4 joints' skinning and normal matrices and blend them, then do the same math
+// as the reference. Vertices past end are computed from the padding but not written
+AVX2_TARGET static void SkinVerticesAvx2(const SkinningSourceVertices& source, std::span<const glm::mat4x3> palette, std::span<const glm::mat3> normalMatrices,
+	glm::vec2 morphWeights, int begin, int end, float* out)
+{
+	const bool hasNormals = source.HasNormals();
+	const bool hasTangents = source.HasTangents();
+	const int tangentLane = hasNormals ? 6 : 3;
+	const int stride = tangentLane + (hasTangents ? 4 : 0);
+
+	const float* paletteFloats = &palette[0][0][0];
+	const float* normalMatrixFloats = &normalMatrices[0][0][0];
+	const __m256i matrixFloats = _mm256_set1_epi32(12);
+	const __m256i normalMatrixFloatCount = _mm256_set1_epi32(9);
+	const __m256 morph1Weight = _mm256_set1_ps(morphWeights.x);
+	const __m256 morph2Weight = _mm256_set1_ps(morphWeights.y);
+	alignas(32) float lanes[10][8];
+
+	for (int v = begin; v < end; v += 8)
+	{
+		__m256 m[12];
+		for (int e = 0; e < 12; e++)
+		{
+			m[e] = _mm256_setzero_ps();
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			const __m256i joints = _mm256_loadu_si256((const __m256i*)(source.joints[k].data() + v));
+			const __m256i jointOffsets = _mm256_mullo_epi32(joints, matrixFloats);
+			const __m256 weight = _mm256_loadu_ps(source.weights[k].data() + v);
+			for (int e = 0; e < 12; e++)
+			{
+				m[e] = _mm256_add_ps(m[e], _mm256_mul_ps(weight, _mm256_i32gather_ps(paletteFloats + e, jointOffsets, 4)));
+			}
+		}
+
+		// Columns of the blended matrix
+		const Vec3x8 a{ m[0], m[1], m[2] };
+		const Vec3x8 b{ m[3], m[4], m[5] };
+		const Vec3x8 c{ m[6], m[7], m[8] };
+
+		const Vec3x8 position = Combine(a, b, c, LoadMorphed(source.positions, source.morphPositions, morph1Weight, morph2Weight, v));
+		_mm256_store_ps(lanes[0], _mm256_add_ps(position.x, m[9]));
+		_mm256_store_ps(lanes[1], _mm256_add_ps(position.y, m[10]));
+		_mm256_store_ps(lanes[2], _mm256_add_ps(position.z, m[11]));
+
+		if (hasNormals || hasTangents)
+		{
+			__m256 n[9];
+			for (int e = 0; e < 9; e++)
+			{
+				n[e] = _mm256_setzero_ps();
+			}
+			for (int k = 0; k < 4; k++)
+			{
+				const __m256i joints = _mm256_loadu_si256((const __m256i*)(source.joints[k].data() + v));
+				const __m256i jointOffsets = _mm256_mullo_epi32(joints, normalMatrixFloatCount);
+				const __m256 weight = _mm256_loadu_ps(source.weights[k].data() + v);
+				for (int e = 0; e < 9; e++)
+				{
+					n[e] = _mm256_add_ps(n[e], _mm256_mul_ps(weight, _mm256_i32gather_ps(normalMatrixFloats + e, jointOffsets, 4)));
+				}
+			}
+			const Vec3x8 na{ n[0], n[1], n[2] };
+			const Vec3x8 nb{ n[3], n[4], n[5] };
+			const Vec3x8 nc{ n[6], n[7], n[8] };
+
+			if (hasNormals)
+			{
+				const Vec3x8 normal = Combine(na, nb, nc, LoadMorphed(source.normals, source.morphNormals, morph1Weight, morph2Weight, v));
+				_mm256_store_ps(lanes[3], normal.x);
+				_mm256_store_ps(lanes[4], normal.y);
+				_mm256_store_ps(lanes[5], normal.z);
+			}
+			if (hasTangents)
+			{
+				const Vec3x8 tangent = Combine(na, nb, nc, LoadMorphed(source.tangents, source.morphTangents, morph1Weight, morph2Weight, v));
+				_mm256_store_ps(lanes[tangentLane], tangent.x);
+				_mm256_store_ps(lanes[tangentLane + 1], tangent.y);
+				_mm256_store_ps(lanes[tangentLane + 2], tangent.z);
+				_mm256_store_ps(lanes[tangentLane + 3], _mm256_loadu_ps(source.tangents[3].data() + v));
+			}
+		}
+
+		const int numLanes = std::min(8, end - v);
+		for (int lane = 0; lane < numLanes; lane++)
+		{
+			float* vertex = out + (v + lane) * stride;
+			for (int component = 0; component < stride; component++)
+			{
+				vertex[component] = lanes[component][lane];
+			}
+		}
+	}
+}
+
+static bool CpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	// The OS must save the upper halves of the ymm registers (OSXSAVE, and XCR0's SSE and AVX state bits)
+	__cpuid(info, 1);
+	const bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return avx && (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // CPU_SKINNING_USE_AVX2
+
+void SkinVertices(const SkinningSourceVertices& source, std::span<const glm::mat4x3> palette, std::span<const glm::mat3> normalMatrices,
+	glm::vec2 morphWeights, int begin, int end, float* out)
+{
+#ifdef CPU_SKINNING_USE_AVX2
+	if (IsSkinVerticesVectorized())
+	{
+		SkinVerticesAvx2(source, palette, normalMatrices, morphWeights, begin, end, out);
+		return;
+	}
+#endif
+	SkinVerticesReference(source, palette, normalMatrices, morphWeights, begin, end, out);
+}
+
+bool IsSkinVerticesVectorized()
+{
+#ifdef CPU_SKINNING_USE_AVX2
+	static const bool hasAvx2 = CpuHasAvx2();
+	return hasAvx2;
+#else
+	return false;
+#endif
+}
+
+CpuSkinning::~CpuSkinning()
+{
+	Clear();
+}
+
+void CpuSkinning::Clear()
+{
+	for (Output& output : outputs)
+	{
+		glDeleteVertexArrays(1, &output.submesh.VAO);
+		glDeleteBuffers(1, &output.buffer);
+	}
+	outputs.clear();
+	sources.clear();
+	entityFirstOutputs.clear();
+	chunks.clear();
+}
+
+void CpuSkinning::Build(const Scene& scene)
+{
+	Clear();
+
+	const EntityStorage& entities = scene.entities;
+	entityFirstOutputs.assign(entities.Size(), -1);
+	std::vector<std::vector<int>> submeshSources(scene.meshes.size()); // per mesh and submesh, -1 until read back
+
+	for (int entityIdx = 0; entityIdx < entities.Size(); entityIdx++)
+	{
+		const int meshIdx = entities.meshIndices[entityIdx];
+		const int skeletonIdx = entities.skeletonIndices[entityIdx];
+		if (!entities.alive[entityIdx] || meshIdx < 0 || skeletonIdx < 0)
+		{
+			continue;
+		}
+
+		const Mesh& mesh = scene.meshes[meshIdx];
+		submeshSources[meshIdx].resize(mesh.submeshes.size(), -1);
+		for (int submeshIdx = 0; submeshIdx < mesh.submeshes.size(); submeshIdx++)
+		{
+			const Submesh& submesh = mesh.submeshes[submeshIdx];
+			if (!HasFlag(submesh.flags, VertexAttribute::JOINTS))
+			{
+				continue;
+			}
+
+			int& sourceIdx = submeshSources[meshIdx][submeshIdx];
+			if (sourceIdx < 0)
+			{
+				std::vector<std::uint8_t> vertexBuffer(submesh.numVertices * GLTFMeshParser::GetVertexSizeBytes(submesh.flags));
+				glBindBuffer(GL_ARRAY_BUFFER, submesh.VBO);
+				glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertexBuffer.size(), vertexBuffer.data());
+				sourceIdx = (int)sources.size();
+				sources.push_back(SkinningSourceVertices::FromInterleaved(vertexBuffer, submesh.flags, submesh.numVertices));
+			}
+
+			Output output;
+			output.entityIdx = entityIdx;
+			output.submeshIdx = submeshIdx;
+			output.skeletonIdx = skeletonIdx;
+			output.sourceIdx = sourceIdx;
+			output.sizeBytes = submesh.numVertices * GetSkinnedVertexStrideFloats(submesh.flags) * sizeof(float);
+			output.mapped = nullptr;
+			glGenBuffers(1, &output.buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, output.buffer);
+			glBufferData(GL_ARRAY_BUFFER, output.sizeBytes, nullptr, GL_STREAM_DRAW);
+			output.submesh = CreateSkinnedOutputSubmesh(submesh, output.buffer);
+
+			for (int begin = 0; begin < submesh.numVertices; begin += verticesPerChunk)
+			{
+				chunks.push_back({ (int)outputs.size(), begin, std::min(begin + verticesPerChunk, submesh.numVertices) });
+			}
+
+			if (entityFirstOutputs[entityIdx] < 0)
+			{
+				entityFirstOutputs[entityIdx] = (int)outputs.size();
+			}
+			outputs.push_back(output);
+		}
+	}
+}
+
+void CpuSkinning::Update(const Scene& scene, JobSystem& jobSystem)
+{
+	if (outputs.empty())
+	{
+		return;
+	}
+
+	// GL 4.3 has no persistent mapping (glBufferStorage is 4.4), so every buffer is mapped for the duration of the frame's
+	// skinning instead, invalidated to orphan it like SkinningPaletteBuffer::Update does
+	for (Output& output : outputs)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, output.buffer);
+		output.mapped = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, output.sizeBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	}
+
+	// Per skeleton, like the palette buffer the shaders read
+	skeletonNormalMatrices.resize(scene.skeletons.size());
+	for (const Output& output : outputs)
+	{
+		const SkinningPalette& palette = scene.skinningPalettes[scene.skeletonPaletteIndices[output.skeletonIdx]];
+		std::vector<glm::mat3>& normalMatrices = skeletonNormalMatrices[output.skeletonIdx];
+		normalMatrices.resize(palette.skinningMatrices.size());
+		std::transform(palette.skinningMatrices.begin(), palette.skinningMatrices.end(), normalMatrices.begin(), ComputeSkinningNormalMatrix);
+	}
+
+	jobSystem.ParallelFor((int)chunks.size(), 1, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const Chunk& chunk = chunks[i];
+			const Output& output = outputs[chunk.outputIdx];
+			if (output.mapped == nullptr)
+			{
+				continue;
+			}
+			const SkinningPalette& palette = scene.skinningPalettes[scene.skeletonPaletteIndices[output.skeletonIdx]];
+			// Same weights as SkinningPrePass::Dispatch
+			std::span<const float> weights = scene.entities.GetMorphTargetWeights(output.entityIdx);
+			const glm::vec2 morphWeights(weights.size() > 0 ? weights[0] : 0.0f, weights.size() > 1 ? weights[1] : 0.0f);
+			SkinVertices(sources[output.sourceIdx], palette.skinningMatrices, skeletonNormalMatrices[output.skeletonIdx], morphWeights, chunk.begin,
+				chunk.end, output.mapped);
+		}
+	});
+
+	for (Output& output : outputs)
+	{
+		if (output.mapped != nullptr)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, output.buffer);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			output.mapped = nullptr;
+		}
+	}
+}
+
+int CpuSkinning::GetOutputIndex(int entityIdx, int submeshIdx) const
+{
+	if (entityIdx >= entityFirstOutputs.size() || entityFirstOutputs[entityIdx] < 0)
+	{
+		return -1;
+	}
+
+	for (int i = entityFirstOutputs[entityIdx]; i < outputs.size() && outputs[i].entityIdx == entityIdx; i++)
+	{
+		if (outputs[i].submeshIdx == submeshIdx)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x3.hpp>
+#include <glm/vec2.hpp>
+#include "JobSystem.h"
+#include "Mesh.h"
+#include "Scene.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// A skinned submesh's source vertices, one array per component so the kernels can load 8 consecutive vertices at once.
+// Arrays are padded to a multiple of 8 vertices with zero weighted vertices. Normals and tangents are empty if the
+// submesh has none. The morph arrays hold the xyz deltas of morph target 0 followed by those of target 1, and are empty
+// unless the targets have the attribute and so does the submesh, like the HAS_MORPH_* variants of skinning.comp
+struct SkinningSourceVertices
+{
+	int numVertices = 0;
+	std::vector<float> positions[3];
+	std::vector<float> normals[3];
+	std::vector<float> tangents[4];
+	std::vector<float> weights[4];
+	std::vector<std::uint32_t> joints[4]; // palette indices, widened from the 16 bit JOINTS attribute for the gathers
+	std::vector<float> morphPositions[6];
+	std::vector<float> morphNormals[6];
+	std::vector<float> morphTangents[6];
+
+	bool HasNormals() const { return !normals[0].empty(); }
+	bool HasTangents() const { return !tangents[0].empty(); }
+	bool HasMorphTargets() const { return !morphPositions[0].empty(); }
+	// Deinterleaves a vertex buffer in GLTFMeshParser's layout. flags must include JOINTS
+	static SkinningSourceVertices FromInterleaved(std::span<const std::uint8_t> vertexBuffer, VertexAttribute flags, int numVertices);
+};
+
+// Skin vertices [begin, end) of source with palette and its per-joint normal matrices (both indexed by Joint::paletteIdx, see
+// ComputeSkinningNormalMatrix) into out, which holds every vertex of the submesh in the layout of GetSkinnedVertexStrideFloats.
+// morphWeights are the weights of morph targets 0 and 1, applied before skinning and ignored if source has no morph targets.
+// The reference does exactly what geometryPass.vert and skinning.comp do; SkinVertices runs 8 vertices per iteration with
+// AVX2 on x64 CPUs that have it (see IsSkinVerticesVectorized), otherwise it's the reference
+void SkinVerticesReference(const SkinningSourceVertices& source, std::span<const glm::mat4x3> palette, std::span<const glm::mat3> normalMatrices,
+	glm::vec2 morphWeights, int begin, int end, float* out);
+void SkinVertices(const SkinningSourceVertices& source, std::span<const glm::mat4x3> palette, std::span<const glm::mat3> normalMatrices,
+	glm::vec2 morphWeights, int begin, int end, float* out);
+bool IsSkinVerticesVectorized();
+// Like SkinVerticesReference but blends the palette's dual quaternions (see ComputeSkinningDualQuaternions) exactly like the
+// DUAL_QUATERNION_SKINNING variants of geometryPass.vert and skinning.comp. Vertices must have a nonzero weight
+void SkinVerticesDualQuaternionReference(const SkinningSourceVertices& source, std::span<const DualQuaternion> dualQuaternions,
+	glm::vec2 morphWeights, int begin, int end, float* out);
+
+// Skins every skinned submesh of the scene on the CPU across the job system, as an alternative to the shader paths for when
+// the GPU is the bottleneck or results have to be reproducible without one. Source vertices are read back from the GPU
+// once in Build. Outputs are drawn like SkinningPrePass outputs, with the static-mesh geometryPass.vert variant. Morph targets
+// of skinned submeshes are applied before skinning, like the pre-pass does. Always blends linearly, Skeleton::skinningMode only
+// applies to the shader paths
+class CpuSkinning
+{
+public:
+	CpuSkinning() = default;
+	CpuSkinning(const CpuSkinning&) = delete;
+	CpuSkinning& operator=(const CpuSkinning&) = delete;
+	~CpuSkinning();
+
+	// Needs the GL context. Call again when entities change
+	void Build(const Scene& scene);
+	// After AnimationSystem::Update
+	void Update(const Scene& scene, JobSystem& jobSystem);
+
+	// -1 if the submesh isn't skinned
+	int GetOutputIndex(int entityIdx, int submeshIdx) const;
+	const Submesh& GetOutputSubmesh(int outputIdx) const { return outputs[outputIdx].submesh; }
+
+private:
+	struct Output
+	{
+		int entityIdx;
+		int submeshIdx;
+		int skeletonIdx;
+		int sourceIdx; // into sources, shared by every entity using the submesh
+		GLuint buffer;
+		int sizeBytes;
+		Submesh submesh;
+		float* mapped; // during Update
+	};
+
+	struct Chunk
+	{
+		int outputIdx;
+		int begin, end;
+	};
+
+	static constexpr int verticesPerChunk = 4096; // multiple of 8 so only the last chunk of an output is partial
+
+	void Clear();
+
+	std::vector<SkinningSourceVertices> sources;
+	std::vector<Output> outputs;
+	std::vector<int> entityFirstOutputs; // per entity, -1 if none
+	std::vector<Chunk> chunks;
+	std::vector<std::vector<glm::mat3>> skeletonNormalMatrices; // scratch, per skeleton
+};
\ No newline at end of file
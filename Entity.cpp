@@ -0,0 +1,170 @@
+#include "Entity.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+int NameTable::Intern(std::string_view name)
+{
+	auto iter = nameIds.find(name);
+	if (iter != nameIds.end())
+	{
+		return iter->second;
+	}
+
+	if (chunks.empty() || chunkUsedBytes + name.size() > chunkSizeBytes)
+	{
+		chunks.emplace_back(std::make_unique<char[]>(std::max(chunkSizeBytes, name.size())));
+		chunkUsedBytes = 0;
+	}
+	char* storage = chunks.back().get() + chunkUsedBytes;
+	std::memcpy(storage, name.data(), name.size());
+	chunkUsedBytes += name.size();
+
+	const int nameId = (int)names.size();
+	std::string_view storedName(storage, name.size());
+	names.push_back(storedName);
+	nameIds.emplace(storedName, nameId);
+	return nameId;
+}
+
+int NameTable::Find(std::string_view name) const
+{
+	auto iter = nameIds.find(name);
+	return iter != nameIds.end() ? iter->second : -1;
+}
+
+void EntityStorage::Reserve(int numEntities)
+{
+	localTransforms.reserve(numEntities);
+	parents.reserve(numEntities);
+	firstChildren.reserve(numEntities);
+	nextSiblings.reserve(numEntities);
+	meshIndices.reserve(numEntities);
+	skeletonIndices.reserve(numEntities);
+	cameraIndices.reserve(numEntities);
+	lightIndices.reserve(numEntities);
+	meshInstanceSetIndices.reserve(numEntities);
+	nameIds.reserve(numEntities);
+	morphTargetWeightsOffsets.reserve(numEntities);
+	morphTargetWeightsCounts.reserve(numEntities);
+	generations.reserve(numEntities);
+	alive.reserve(numEntities);
+}
+
+int EntityStorage::Create(std::string_view name, const Transform& localTransform)
+{
+	int entityIdx;
+	if (!freeIndices.empty())
+	{
+		entityIdx = freeIndices.back();
+		freeIndices.pop_back();
+	}
+	else
+	{
+		entityIdx = Size();
+		localTransforms.emplace_back();
+		parents.emplace_back();
+		firstChildren.emplace_back();
+		nextSiblings.emplace_back();
+		meshIndices.emplace_back();
+		skeletonIndices.emplace_back();
+		cameraIndices.emplace_back();
+		lightIndices.emplace_back();
+		meshInstanceSetIndices.emplace_back();
+		nameIds.emplace_back();
+		morphTargetWeightsOffsets.emplace_back();
+		morphTargetWeightsCounts.emplace_back();
+		generations.emplace_back(0);
+		alive.emplace_back();
+	}
+
+	localTransforms[entityIdx] = localTransform;
+	parents[entityIdx] = -1;
+	firstChildren[entityIdx] = -1;
+	nextSiblings[entityIdx] = -1;
+	meshIndices[entityIdx] = -1;
+	skeletonIndices[entityIdx] = -1;
+	cameraIndices[entityIdx] = -1;
+	lightIndices[entityIdx] = -1;
+	meshInstanceSetIndices[entityIdx] = -1;
+	nameIds[entityIdx] = names.Intern(name);
+	morphTargetWeightsOffsets[entityIdx] = 0;
+	morphTargetWeightsCounts[entityIdx] = 0;
+	alive[entityIdx] = true;
+	hierarchyVersion++;
+	return entityIdx;
+}
+
+void EntityStorage::Destroy(EntityHandle handle)
+{
+	const int entityIdx = Resolve(handle);
+	if (entityIdx < 0)
+	{
+		return;
+	}
+
+	// Unlink from the parent's children
+	const int parentIdx = parents[entityIdx];
+	if (parentIdx >= 0)
+	{
+		int* link = &firstChildren[parentIdx];
+		while (*link != entityIdx)
+		{
+			link = &nextSiblings[*link];
+		}
+		*link = nextSiblings[entityIdx];
+	}
+
+	std::vector<int> subtree{ entityIdx };
+	while (!subtree.empty())
+	{
+		int idx = subtree.back();
+		subtree.pop_back();
+		for (int childIdx = firstChildren[idx]; childIdx >= 0; childIdx = nextSiblings[childIdx])
+		{
+			subtree.push_back(childIdx);
+		}
+
+		// The pool slice is leaked until the pool is rebuilt, destroying entities is rare. Component indices are cleared so
+		// systems iterating every slot skip the dead one like an entity without them
+		parents[idx] = -1;
+		firstChildren[idx] = -1;
+		nextSiblings[idx] = -1;
+		meshIndices[idx] = -1;
+		skeletonIndices[idx] = -1;
+		cameraIndices[idx] = -1;
+		lightIndices[idx] = -1;
+		meshInstanceSetIndices[idx] = -1;
+		morphTargetWeightsCounts[idx] = 0;
+		alive[idx] = false;
+		generations[idx]++;
+		freeIndices.push_back(idx);
+	}
+	hierarchyVersion++;
+}
+
+int EntityStorage::Resolve(EntityHandle handle) const
+{
+	if (handle.index >= (std::uint32_t)Size() || generations[handle.index] != handle.generation || !alive[handle.index])
+	{
+		return -1;
+	}
+	return (int)handle.index;
+}
+
+void EntityStorage::AddChild(int parentIdx, int childIdx)
+{
+	assert(parents[childIdx] < 0);
+	parents[childIdx] = parentIdx;
+	nextSiblings[childIdx] = firstChildren[parentIdx];
+	firstChildren[parentIdx] = childIdx;
+	hierarchyVersion++;
+}
+
+void EntityStorage::AllocateMorphTargetWeights(int entityIdx, int count)
+{
+	morphTargetWeightsOffsets[entityIdx] = (int)morphTargetWeightsPool.size();
+	morphTargetWeightsCounts[entityIdx] = count;
+	morphTargetWeightsPool.resize(morphTargetWeightsPool.size() + count, 0.0f);
+}
\ No newline at end of file
@@ -1,20 +1,83 @@
 #pragma once
 
-#include "Mesh.h"
-#include "Skeleton.h"
-#include <string>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
 #include "Transform.h"
+#include <unordered_map>
 #include <vector>
 
-struct Entity
+// Stays valid while its entity is alive even if other entities are created or destroyed. Resolving it after the entity is
+// destroyed fails instead of silently returning whichever entity reused the slot
+struct EntityHandle
 {
-	std::string name;
-	std::vector<int> children;
-	std::vector<float> morphTargetWeights;
-	Transform localTransform;
-	int parent = -1;
-	int meshIdx = -1;
-	int skeletonIdx = -1;
-	int cameraIdx = -1;
-	int lightIdx = -1;
+	std::uint32_t index;
+	std::uint32_t generation;
+};
+
+// Every distinct name is stored once, in large shared chunks, so entities only hold a small id
+class NameTable
+{
+public:
+	int Intern(std::string_view name);
+	int Find(std::string_view name) const; // -1 if the name was never interned
+	std::string_view Get(int nameId) const { return names[nameId]; }
+
+private:
+	static constexpr std::size_t chunkSizeBytes = 64 * 1024;
+	std::vector<std::unique_ptr<char[]>> chunks;
+	std::size_t chunkUsedBytes = chunkSizeBytes;
+	std::vector<std::string_view> names;
+	std::unordered_map<std::string_view, int> nameIds;
+};
+
+// Scene entities stored as one array per component, all indexed by entity index, so systems only pull the components they
+// touch through the cache. The hierarchy is stored as first child/next sibling links, and morph target weights of all
+// entities share one pool. Entity indices never move, destroyed slots are reused by later Create calls.
+struct EntityStorage
+{
+	std::vector<Transform> localTransforms;
+	std::vector<int> parents;
+	std::vector<int> firstChildren;
+	std::vector<int> nextSiblings;
+	std::vector<int> meshIndices;
+	std::vector<int> skeletonIndices;
+	std::vector<int> cameraIndices;
+	std::vector<int> lightIndices;
+	std::vector<int> meshInstanceSetIndices; // into Scene::meshInstanceSets, -1 if the mesh is drawn once
+	std::vector<int> nameIds;
+	std::vector<int> morphTargetWeightsOffsets;
+	std::vector<int> morphTargetWeightsCounts;
+	std::vector<float> morphTargetWeightsPool;
+	std::vector<std::uint32_t> generations;
+	std::vector<std::uint8_t> alive;
+	std::vector<int> freeIndices;
+	NameTable names;
+	std::uint32_t hierarchyVersion = 0; // changes with every Create, Destroy and AddChild, see TransformSystem::Build
+
+	int Size() const { return (int)localTransforms.size(); }
+	void Reserve(int numEntities);
+
+	int Create(std::string_view name, const Transform& localTransform);
+	// Destroys the entity and its whole subtree
+	void Destroy(EntityHandle handle);
+
+	EntityHandle GetHandle(int entityIdx) const { return EntityHandle{ (std::uint32_t)entityIdx, generations[entityIdx] }; }
+	// -1 if the entity was destroyed
+	int Resolve(EntityHandle handle) const;
+
+	// Prepends child to parent's children. Link children in reverse to keep their original order
+	void AddChild(int parentIdx, int childIdx);
+	void AllocateMorphTargetWeights(int entityIdx, int count);
+
+	std::string_view GetName(int entityIdx) const { return names.Get(nameIds[entityIdx]); }
+	std::span<float> GetMorphTargetWeights(int entityIdx)
+	{
+		return std::span<float>(morphTargetWeightsPool.data() + morphTargetWeightsOffsets[entityIdx], morphTargetWeightsCounts[entityIdx]);
+	}
+	std::span<const float> GetMorphTargetWeights(int entityIdx) const
+	{
+		return std::span<const float>(morphTargetWeightsPool.data() + morphTargetWeightsOffsets[entityIdx], morphTargetWeightsCounts[entityIdx]);
+	}
 };
\ No newline at end of file
@@ -29,10 +29,12 @@ Framebuffer::Framebuffer(int width, int height, const std::vector<ColorAttachmen
 
 	glDrawBuffers(attachments.size(), &attachments[0]);
 
-	glGenRenderbuffers(1, &depthStencilRBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthStencilRBO);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencilRBO);
+	glGenTextures(1, &depthStencilTexture);
+	glBindTexture(GL_TEXTURE_2D, depthStencilTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, depthStencilInternalFormat, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture, 0);
 
 	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
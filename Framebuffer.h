@@ -17,7 +17,7 @@ struct Framebuffer
 {
 	std::vector<GLuint> colorTextures;
 	GLuint id;
-	GLuint depthStencilRBO;
+	GLuint depthStencilTexture; // sampled as depth, e.g. by GpuCulling's Hi-Z build
 	int width, height;
 
 	Framebuffer(int width, int height, const std::vector<ColorAttachmentInfo>& colorAttachmentsInfo, GLint depthStencilInternalFormat);
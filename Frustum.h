@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <glm/glm.hpp>
+
+// View frustum as 6 inward facing planes (xyz = normal, w = distance), extracted from a view projection matrix
+struct Frustum
+{
+	std::array<glm::vec4, 6> planes;
+
+	// Gribb/Hartmann: each plane is the sum or difference of the matrix's last row and one of the others
+	static Frustum FromMatrix(const glm::mat4& viewProjection)
+	{
+		const glm::mat4 m = glm::transpose(viewProjection); // rows of viewProjection become columns
+		Frustum frustum;
+		frustum.planes = {
+			m[3] + m[0], // left
+			m[3] - m[0], // right
+			m[3] + m[1], // bottom
+			m[3] - m[1], // top
+			m[3] + m[2], // near
+			m[3] - m[2]  // far
+		};
+		for (glm::vec4& plane : frustum.planes)
+		{
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return frustum;
+	}
+
+	bool IntersectsSphere(const glm::vec3& center, float radius) const
+	{
+		for (const glm::vec4& plane : planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Axis aligned box given by its center and half extents. Like the sphere test it only rejects boxes entirely behind one
+	// plane, so a box near a corner of the frustum can pass while outside it
+	bool IntersectsBox(const glm::vec3& center, const glm::vec3& extents) const
+	{
+		for (const glm::vec4& plane : planes)
+		{
+			// The box's extent along the plane normal
+			const float radius = glm::dot(glm::abs(glm::vec3(plane)), extents);
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "FrustumCulling.h"
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULLING_USE_SSE
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(glm::mat4x3) == 12 * sizeof(float), "Global transforms are loaded as 3 groups of 4 floats");
+
+void CullingBoxes::Add(int entityIdx, const BBox& box)
+{
+	const glm::vec3 center = box.GetCenter();
+	const glm::vec3 halfSize = (box.maxXYZ - box.minXYZ) * 0.5f;
+	entityIndices.push_back(entityIdx);
+	for (int c = 0; c < 3; c++)
+	{
+		centers[c].push_back(center[c]);
+		extents[c].push_back(halfSize[c]);
+	}
+}
+
+int CullBoxesReference(const CullingBoxes& boxes, std::span<const glm::mat4x3> globalTransforms, const Frustum& frustum,
+	int begin, int end, int* outVisibleEntities)
+{
+	int numVisible = 0;
+	for (int i = begin; i < end; i++)
+	{
+		const int entityIdx = boxes.entityIndices[i];
+		const glm::mat4x3& m = globalTransforms[entityIdx];
+		const glm::vec3 center = m * glm::vec4(boxes.centers[0][i], boxes.centers[1][i], boxes.centers[2][i], 1.0f);
+		const glm::vec3 extents = glm::abs(m[0]) * boxes.extents[0][i] + glm::abs(m[1]) * boxes.extents[1][i] + glm::abs(m[2]) * boxes.extents[2][i];
+		if (frustum.IntersectsBox(center, extents))
+		{
+			outVisibleEntities[numVisible++] = entityIdx;
+		}
+	}
+	return numVisible;
+}
+
+int CullBoxes(const CullingBoxes& boxes, std::span<const glm::mat4x3> globalTransforms, const Frustum& frustum,
+	int begin, int end, int* outVisibleEntities)
+{
+	int numVisible = 0;
+	int i = begin;
+#ifdef FRUSTUM_CULLING_USE_SSE
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	auto abs = [signMask](__m128 x) { return _mm_andnot_ps(signMask, x); };
+	auto madd = [](__m128 a, __m128 b, __m128 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); };
+
+	__m128 planes[6][4];
+	__m128 absNormals[6][3];
+	for (int p = 0; p < 6; p++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			absNormals[p][c] = abs(planes[p][c]);
+		}
+	}
+
+	for (; i + 4 <= end; i += 4)
+	{
+		// m[column * 3 + row] holds that element of all 4 boxes' matrices
+		__m128 m[12];
+		for (int group = 0; group < 3; group++)
+		{
+			__m128 r0 = _mm_loadu_ps((const float*)&globalTransforms[boxes.entityIndices[i]] + group * 4);
+			__m128 r1 = _mm_loadu_ps((const float*)&globalTransforms[boxes.entityIndices[i + 1]] + group * 4);
+			__m128 r2 = _mm_loadu_ps((const float*)&globalTransforms[boxes.entityIndices[i + 2]] + group * 4);
+			__m128 r3 = _mm_loadu_ps((const float*)&globalTransforms[boxes.entityIndices[i + 3]] + group * 4);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			m[group * 4] = r0;
+			m[group * 4 + 1] = r1;
+			m[group * 4 + 2] = r2;
+			m[group * 4 + 3] = r3;
+		}
+
+		const __m128 cx = _mm_loadu_ps(&boxes.centers[0][i]), cy = _mm_loadu_ps(&boxes.centers[1][i]), cz = _mm_loadu_ps(&boxes.centers[2][i]);
+		const __m128 ex = _mm_loadu_ps(&boxes.extents[0][i]), ey = _mm_loadu_ps(&boxes.extents[1][i]), ez = _mm_loadu_ps(&boxes.extents[2][i]);
+		const __m128 worldCenter[3] = {
+			madd(m[0], cx, madd(m[3], cy, madd(m[6], cz, m[9]))),
+			madd(m[1], cx, madd(m[4], cy, madd(m[7], cz, m[10]))),
+			madd(m[2], cx, madd(m[5], cy, madd(m[8], cz, m[11])))
+		};
+		const __m128 worldExtents[3] = {
+			madd(abs(m[0]), ex, madd(abs(m[3]), ey, _mm_mul_ps(abs(m[6]), ez))),
+			madd(abs(m[1]), ex, madd(abs(m[4]), ey, _mm_mul_ps(abs(m[7]), ez))),
+			madd(abs(m[2]), ex, madd(abs(m[5]), ey, _mm_mul_ps(abs(m[8]), ez)))
+		};
+
+		// Same test as Frustum::IntersectsBox, a lane is out once it's entirely behind any plane
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++)
+		{
+			const __m128 distance = madd(planes[p][0], worldCenter[0], madd(planes[p][1], worldCenter[1], madd(planes[p][2], worldCenter[2], planes[p][3])));
+			const __m128 radius = madd(absNormals[p][0], worldExtents[0], madd(absNormals[p][1], worldExtents[1], _mm_mul_ps(absNormals[p][2], worldExtents[2])));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_sub_ps(_mm_setzero_ps(), radius)));
+		}
+
+		// Branchless compaction, every lane is written and only visible ones advance
+		const int visibleMask = ~_mm_movemask_ps(outside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			outVisibleEntities[numVisible] = boxes.entityIndices[i + lane];
+			numVisible += (visibleMask >> lane) & 1;
+		}
+	}
+#endif
+	return numVisible + CullBoxesReference(boxes, globalTransforms, frustum, i, end, outVisibleEntities + numVisible);
+}
+
+bool IsCullBoxesVectorized()
+{
+#ifdef FRUSTUM_CULLING_USE_SSE
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FrustumCulling::Build(const Scene& scene)
+{
+	boxes = CullingBoxes();
+	const EntityStorage& entities = scene.entities;
+	for (int entityIdx = 0; entityIdx < entities.Size(); entityIdx++)
+	{
+		const int meshIdx = entities.meshIndices[entityIdx];
+		if (entities.alive[entityIdx] && meshIdx >= 0)
+		{
+			boxes.Add(entityIdx, scene.GetModelBounds(entityIdx));
+		}
+	}
+	chunkVisibleEntities.resize(boxes.Size());
+	chunkNumVisible.resize((boxes.Size() + boxesPerChunk - 1) / boxesPerChunk);
+	visibleEntities.reserve(boxes.Size());
+}
+
+void FrustumCulling::Update(const Scene& scene, const Frustum& frustum, JobSystem* jobSystem)
+{
+	auto cullChunks = [&](int begin, int end)
+	{
+		for (int chunk = begin; chunk < end; chunk++)
+		{
+			const int first = chunk * boxesPerChunk;
+			chunkNumVisible[chunk] = CullBoxes(boxes, scene.globalTransforms, frustum, first, std::min(first + boxesPerChunk, boxes.Size()),
+				&chunkVisibleEntities[first]);
+		}
+	};
+	const int numChunks = (int)chunkNumVisible.size();
+	if (jobSystem != nullptr && numChunks > 1)
+	{
+		jobSystem->ParallelFor(numChunks, 1, cullChunks);
+	}
+	else
+	{
+		cullChunks(0, numChunks);
+	}
+
+	visibleEntities.clear();
+	for (int chunk = 0; chunk < numChunks; chunk++)
+	{
+		const int first = chunk * boxesPerChunk;
+		visibleEntities.insert(visibleEntities.end(), chunkVisibleEntities.begin() + first, chunkVisibleEntities.begin() + first + chunkNumVisible[chunk]);
+	}
+}
\ No newline at end of file
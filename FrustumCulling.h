@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "Scene.h"
+#include <glm/mat4x3.hpp>
+#include <span>
+#include <vector>
+
+// Model space bounding boxes of the entities to cull, one array per component so the SIMD test can load 4 boxes at once
+struct CullingBoxes
+{
+	std::vector<int> entityIndices;
+	std::vector<float> centers[3];
+	std::vector<float> extents[3]; // half sizes
+
+	int Size() const { return (int)entityIndices.size(); }
+	void Add(int entityIdx, const BBox& box);
+};
+
+// Transforms boxes [begin, end) by their entities' global transforms (Arvo's method: the world box's extents are the
+// local extents through the absolute value of the matrix) and writes the entity index of every box intersecting frustum
+// to outVisibleEntities, in order. Returns how many. The reference tests one box at a time; CullBoxes tests 4 at a time
+// with SSE when compiled for it, otherwise it's the reference
+int CullBoxesReference(const CullingBoxes& boxes, std::span<const glm::mat4x3> globalTransforms, const Frustum& frustum,
+	int begin, int end, int* outVisibleEntities);
+int CullBoxes(const CullingBoxes& boxes, std::span<const glm::mat4x3> globalTransforms, const Frustum& frustum,
+	int begin, int end, int* outVisibleEntities);
+bool IsCullBoxesVectorized();
+
+// Frustum culls every live entity with a mesh by its mesh's bounding box, in chunks across the job system, into a compact
+// list of visible entities for RenderQueue::Sort
+class FrustumCulling
+{
+public:
+	// Call again when entities change
+	void Build(const Scene& scene);
+	// After TransformSystem::Update
+	void Update(const Scene& scene, const Frustum& frustum, JobSystem* jobSystem = nullptr);
+
+	// In entity order
+	std::span<const int> GetVisibleEntities() const { return visibleEntities; }
+	int GetNumVisible() const { return (int)visibleEntities.size(); }
+	int GetNumCulled() const { return boxes.Size() - (int)visibleEntities.size(); }
+
+private:
+	static constexpr int boxesPerChunk = 1024; // multiple of 4 so only the last chunk has a scalar tail
+
+	CullingBoxes boxes;
+	std::vector<int> chunkVisibleEntities; // scratch, every chunk writes at its first box's index
+	std::vector<int> chunkNumVisible; // scratch
+	std::vector<int> visibleEntities;
+};
\ No newline at end of file
@@ -11,6 +11,7 @@ Mesh GLTFMeshParser::Parse(const tinygltf::Mesh& gltfMesh, const tinygltf::Model
 	assert(gltfMesh.primitives.size() > 0);
 
 	Mesh mesh;
+	bool canOcclude = true;
 	for (const tinygltf::Primitive& primitive : gltfMesh.primitives)
 	{
 		assert(primitive.mode == GL_TRIANGLES);
@@ -59,6 +60,7 @@ Mesh GLTFMeshParser::Parse(const tinygltf::Mesh& gltfMesh, const tinygltf::Model
 		{
 			submesh.countVerticesOrIndices = submeshVertexBuffer.size() / submeshVertexSizeBytes;
 		}
+		submesh.numVertices = submeshVertexBuffer.size() / submeshVertexSizeBytes;
 
 		if (generateTangents)
 		{
@@ -70,107 +72,135 @@ Mesh GLTFMeshParser::Parse(const tinygltf::Mesh& gltfMesh, const tinygltf::Model
 		mesh.boundingBox.minXYZ = glm::min(submeshBoundingBox.minXYZ, mesh.boundingBox.minXYZ);
 		mesh.boundingBox.maxXYZ = glm::max(submeshBoundingBox.maxXYZ, mesh.boundingBox.maxXYZ);
 
+		// Deforming meshes would need their animated vertices, see-through surfaces don't hide what's behind them
+		canOcclude = canOcclude && !hasJoints && !hasMorphTargets &&
+			mesh.occluderIndices.size() + submesh.countVerticesOrIndices <= 3 * maxOccluderTriangles;
+		const bool opaque = !hasMaterial || model.materials[primitive.material].alphaMode == "OPAQUE";
+		if (canOcclude && opaque)
+		{
+			const std::uint32_t firstVertex = (std::uint32_t)mesh.occluderPositions.size();
+			for (int vertex = 0; vertex < submesh.numVertices; vertex++)
+			{
+				// Position is the first attribute
+				mesh.occluderPositions.push_back(*(const glm::vec3*)&submeshVertexBuffer[vertex * submeshVertexSizeBytes]);
+			}
+			for (int i = 0; i < submesh.countVerticesOrIndices; i++)
+			{
+				mesh.occluderIndices.push_back(firstVertex + (submesh.hasIndexBuffer ? primitiveIndexBuffer[i] : (std::uint32_t)i));
+			}
+		}
+
 		glGenVertexArrays(1, &submesh.VAO);
 		glBindVertexArray(submesh.VAO);
 
-		GLuint VBO;
-		glGenBuffers(1, &VBO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glGenBuffers(1, &submesh.VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, submesh.VBO);
 		glBufferData(GL_ARRAY_BUFFER, submeshVertexBuffer.size(), submeshVertexBuffer.data(), GL_STATIC_DRAW);
 
-		// Don't change attribute indices, shaders rely on them being in this order
-
-		// Position
-		int offset = 0;
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-		offset += attributeByteSizes.find(VertexAttribute::POSITION)->second;
+		SetupVertexAttributes(submesh.flags);
 
-		if (HasFlag(submesh.flags, VertexAttribute::TEXCOORD))
+		if (submesh.hasIndexBuffer)
 		{
-			glEnableVertexAttribArray(1);
-			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::TEXCOORD)->second;
+			glGenBuffers(1, &submesh.IBO);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, submesh.IBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, primitiveIndexBuffer.size() * sizeof(primitiveIndexBuffer[0]), primitiveIndexBuffer.data(), GL_STATIC_DRAW);
 		}
+	}
 
-		if (HasFlag(submesh.flags, VertexAttribute::NORMAL))
-		{
-			glEnableVertexAttribArray(2);
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::NORMAL)->second;
-		}
+	if (!canOcclude)
+	{
+		mesh.occluderPositions = {};
+		mesh.occluderIndices = {};
+	}
 
-		if (HasFlag(submesh.flags, VertexAttribute::WEIGHTS))
-		{
-			glEnableVertexAttribArray(3);
-			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::WEIGHTS)->second;
+	return mesh;
+}
 
-			glEnableVertexAttribArray(4);
-			glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::JOINTS)->second;
-		}
+void GLTFMeshParser::SetupVertexAttributes(VertexAttribute attributes)
+{
+	// Don't change attribute indices, shaders rely on them being in this order
+	const int vertexSizeBytes = GetVertexSizeBytes(attributes);
 
-		if (HasFlag(submesh.flags, VertexAttribute::MORPH_TARGET0_POSITION))
-		{
-			assert(HasFlag(submesh.flags, VertexAttribute::MORPH_TARGET1_POSITION));
-			glEnableVertexAttribArray(5);
-			glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET0_POSITION)->second;
-
-			glEnableVertexAttribArray(6);
-			glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET1_POSITION)->second;
-		}
+	// Position
+	int offset = 0;
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+	offset += attributeByteSizes.find(VertexAttribute::POSITION)->second;
 
-		if (HasFlag(submesh.flags, VertexAttribute::MORPH_TARGET0_NORMAL))
-		{
-			assert(HasFlag(submesh.flags, VertexAttribute::MORPH_TARGET1_NORMAL));
-			glEnableVertexAttribArray(7);
-			glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET0_NORMAL)->second;
-
-			glEnableVertexAttribArray(8);
-			glVertexAttribPointer(8, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET1_NORMAL)->second;
-		}
+	if (HasFlag(attributes, VertexAttribute::TEXCOORD))
+	{
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::TEXCOORD)->second;
+	}
 
-		if (HasFlag(submesh.flags, VertexAttribute::TANGENT))
-		{
-			glEnableVertexAttribArray(9);
-			glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::TANGENT)->second;
-		}
+	if (HasFlag(attributes, VertexAttribute::NORMAL))
+	{
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::NORMAL)->second;
+	}
 
-		if (HasFlag(submesh.flags, VertexAttribute::MORPH_TARGET0_TANGENT))
-		{
-			assert(HasFlag(submesh.flags, VertexAttribute::MORPH_TARGET1_TANGENT));
-			glEnableVertexAttribArray(10);
-			glVertexAttribPointer(10, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET0_TANGENT)->second;
-
-			glEnableVertexAttribArray(11);
-			glVertexAttribPointer(11, 3, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET1_TANGENT)->second;
-		}
+	if (HasFlag(attributes, VertexAttribute::WEIGHTS))
+	{
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::WEIGHTS)->second;
 
-		if (HasFlag(submesh.flags, VertexAttribute::COLOR))
-		{
-			glEnableVertexAttribArray(12);
-			glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, submeshVertexSizeBytes, (const void*)offset);
-			offset += attributeByteSizes.find(VertexAttribute::COLOR)->second;
-		}
+		glEnableVertexAttribArray(4);
+		glVertexAttribIPointer(4, 4, GL_UNSIGNED_SHORT, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::JOINTS)->second;
+	}
 
-		if (submesh.hasIndexBuffer)
-		{
-			GLuint IBO;
-			glGenBuffers(1, &IBO);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, primitiveIndexBuffer.size() * sizeof(primitiveIndexBuffer[0]), primitiveIndexBuffer.data(), GL_STATIC_DRAW);
-		}
+	if (HasFlag(attributes, VertexAttribute::MORPH_TARGET0_POSITION))
+	{
+		assert(HasFlag(attributes, VertexAttribute::MORPH_TARGET1_POSITION));
+		glEnableVertexAttribArray(5);
+		glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET0_POSITION)->second;
+
+		glEnableVertexAttribArray(6);
+		glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET1_POSITION)->second;
 	}
 
-	return mesh;
+	if (HasFlag(attributes, VertexAttribute::MORPH_TARGET0_NORMAL))
+	{
+		assert(HasFlag(attributes, VertexAttribute::MORPH_TARGET1_NORMAL));
+		glEnableVertexAttribArray(7);
+		glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET0_NORMAL)->second;
+
+		glEnableVertexAttribArray(8);
+		glVertexAttribPointer(8, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET1_NORMAL)->second;
+	}
+
+	if (HasFlag(attributes, VertexAttribute::TANGENT))
+	{
+		glEnableVertexAttribArray(9);
+		glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::TANGENT)->second;
+	}
+
+	if (HasFlag(attributes, VertexAttribute::MORPH_TARGET0_TANGENT))
+	{
+		assert(HasFlag(attributes, VertexAttribute::MORPH_TARGET1_TANGENT));
+		glEnableVertexAttribArray(10);
+		glVertexAttribPointer(10, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET0_TANGENT)->second;
+
+		glEnableVertexAttribArray(11);
+		glVertexAttribPointer(11, 3, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::MORPH_TARGET1_TANGENT)->second;
+	}
+
+	if (HasFlag(attributes, VertexAttribute::COLOR))
+	{
+		glEnableVertexAttribArray(12);
+		glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, vertexSizeBytes, (const void*)offset);
+		offset += attributeByteSizes.find(VertexAttribute::COLOR)->second;
+	}
 }
 
 int GLTFMeshParser::GetAttributeByteOffset(VertexAttribute attributes, VertexAttribute attribute)
@@ -279,26 +309,22 @@ void GLTFMeshParser::FillInterleavedBufferWithAttribute(std::vector<std::uint8_t
 		FillInterleavedBufferWithAttribute(interleavedBuffer, GetAccessorBytes(accessor, model), attributeByteSizes.find(attribute)->second, GetAttributeByteOffset(attributes, attribute), vertexSizeBytes, accessor.count);
 		break;
 	case VertexAttribute::JOINTS:
-		if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+		if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
 		{
 			FillInterleavedBufferWithAttribute(interleavedBuffer, GetAccessorBytes(accessor, model), attributeByteSizes.find(attribute)->second, GetAttributeByteOffset(attributes, attribute), vertexSizeBytes, accessor.count);
 		}
 		else
 		{
-			assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT);
+			assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE);
 
-			// Convert from unsigned short to unsigned byte
+			// Convert from unsigned byte to unsigned short
 			auto jointBytes = GetAccessorBytes(accessor, model);
-			std::span<glm::u16vec4> joints((glm::u16vec4*)jointBytes.data(), accessor.count);
-			std::vector<glm::u8vec4> jointsAsUnsignedBytes(accessor.count);
-			std::transform(joints.begin(), joints.end(), jointsAsUnsignedBytes.begin(),
-				[](glm::u16vec4 indices)
-				{
-					assert(indices.x < 255 && indices.y < 255 && indices.z < 255 && indices.w < 255);
-					return glm::u8vec4(indices);
-				});
-
-			std::span<const std::uint8_t> attrBytes((std::uint8_t*)jointsAsUnsignedBytes.data(), sizeof(glm::u8vec4) * jointsAsUnsignedBytes.size());
+			std::span<glm::u8vec4> joints((glm::u8vec4*)jointBytes.data(), accessor.count);
+			std::vector<glm::u16vec4> jointsAsUnsignedShorts(accessor.count);
+			std::transform(joints.begin(), joints.end(), jointsAsUnsignedShorts.begin(),
+				[](glm::u8vec4 indices) { return glm::u16vec4(indices); });
+
+			std::span<const std::uint8_t> attrBytes((std::uint8_t*)jointsAsUnsignedShorts.data(), sizeof(glm::u16vec4) * jointsAsUnsignedShorts.size());
 
 			FillInterleavedBufferWithAttribute(interleavedBuffer, attrBytes, attributeByteSizes.find(attribute)->second, GetAttributeByteOffset(attributes, attribute), vertexSizeBytes, accessor.count);
 		}
@@ -13,10 +13,16 @@ class GLTFMeshParser
 {
 public:
 	static Mesh Parse(const tinygltf::Mesh& mesh, const tinygltf::Model& model);
-private:
+	// Layout of Submesh::VBO
 	static int GetAttributeByteOffset(VertexAttribute attributes, VertexAttribute attribute);
-	static VertexAttribute GetPrimitiveVertexLayout(const tinygltf::Primitive& primitive);
 	static int GetVertexSizeBytes(VertexAttribute attributes);
+	// Enables the vertex attributes of the bound VAO and points them at the bound GL_ARRAY_BUFFER, holding vertices in this layout
+	static void SetupVertexAttributes(VertexAttribute attributes);
+
+	// Meshes with more triangles don't get Mesh::occluderPositions
+	static constexpr int maxOccluderTriangles = 2048;
+private:
+	static VertexAttribute GetPrimitiveVertexLayout(const tinygltf::Primitive& primitive);
 	static void FillInterleavedBufferWithAttribute(std::vector<std::uint8_t>& interleavedBuffer, std::span<const std::uint8_t> attrData,
 		int attrSizeBytes, int attrOffset, int vertexSizeBytes, int numVertices);
 	static void FillInterleavedBufferWithAttribute(std::vector<std::uint8_t>& interleavedBuffer, const tinygltf::Accessor& accessor, int vertexSizeBytes, 
@@ -59,7 +65,7 @@ private:
 		{VertexAttribute::TEXCOORD, 8},
 		{VertexAttribute::NORMAL, 12},
 		{VertexAttribute::WEIGHTS, 16},
-		{VertexAttribute::JOINTS, 4},
+		{VertexAttribute::JOINTS, 8}, // always converted to 16 bit indices
 		{VertexAttribute::MORPH_TARGET0_POSITION, 12},
 		{VertexAttribute::MORPH_TARGET1_POSITION, 12},
 		{VertexAttribute::MORPH_TARGET0_NORMAL, 12},
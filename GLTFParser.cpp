@@ -1,6 +1,12 @@
 #include "GLTFParser.h"
+#include "BVH.h"
 #include "GLTFMeshParser.h"
+#include <charconv>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <numeric>
+#include <unordered_map>
 
 // TODO: separate scene parsing from renderer data logic (creating vertex arrays, vertex buffers, textures, etc.)
 static bool IsLinearSpaceTexture(int textureIdx, const std::vector<tinygltf::Material>& materials)
@@ -20,7 +26,7 @@ static bool IsLinearSpaceTexture(int textureIdx, const std::vector<tinygltf::Mat
 	return false;
 }
 
-Scene GLTFParser::Parse(const tinygltf::Scene& gltfScene, const tinygltf::Model& model)
+Scene GLTFParser::Parse(const tinygltf::Scene& gltfScene, const tinygltf::Model& model, const AnimationCompressionSettings& compressionSettings)
 {
 	Scene scene;
 
@@ -45,33 +51,40 @@ Scene GLTFParser::Parse(const tinygltf::Scene& gltfScene, const tinygltf::Model&
 
 	std::vector<int> lightToEntityMap(model.lights.size());
 	int namelessEntitySuffix = 0;
+	// Entity indices match node indices, skins, animations and lights reference nodes by index
+	scene.entities.Reserve((int)model.nodes.size());
 	for (const auto& node : model.nodes)
 	{
-		scene.entities.emplace_back(ParseNode(node, model, namelessEntitySuffix, lightToEntityMap, scene.meshes, scene.entities.size() - 1));
+		ParseNode(node, model, namelessEntitySuffix, lightToEntityMap, scene.meshes, scene.meshInstanceSets, scene.entities);
 	}
 
-	scene.globalTransforms.resize(scene.entities.size());
+	const int numEntities = scene.entities.Size();
+	scene.globalTransforms.resize(numEntities);
+	scene.transformDirty.resize(numEntities, true);
+	scene.dirtyTransforms.resize(numEntities);
+	std::iota(scene.dirtyTransforms.begin(), scene.dirtyTransforms.end(), 0);
 
-	// Set entity parents
-	for (int i = 0; i < scene.entities.size(); i++)
+	// Link children in reverse, AddChild prepends
+	for (int i = 0; i < numEntities; i++)
 	{
-		const auto& entity = scene.entities[i];
-		for (int j = 0; j < entity.children.size(); j++)
+		const std::vector<int>& children = model.nodes[i].children;
+		for (auto childIter = children.rbegin(); childIter != children.rend(); ++childIter)
 		{
-			auto& child = scene.entities[entity.children[j]];
-			child.parent = i;
+			scene.entities.AddChild(i, *childIter);
 		}
 	}
 
 	for (const auto& skin : model.skins)
 	{
 		scene.skeletons.emplace_back(ParseSkin(skin, model, scene.entities));
+		scene.skinningPalettes.emplace_back((int)scene.skeletons.back().joints.size());
+		scene.skeletonPaletteIndices.push_back((int)scene.skeletons.size() - 1);
 	}
 
 	int namelessAnimSuffix = 0;
 	for (const auto& animation : model.animations)
 	{
-		scene.animations.emplace_back(ParseAnimation(animation, model, namelessAnimSuffix, scene.entities));
+		scene.animations.emplace_back(ParseAnimation(animation, model, namelessAnimSuffix, scene.entities, compressionSettings));
 	}
 	scene.animationEnabled.resize(scene.animations.size(), true);
 
@@ -142,44 +155,127 @@ Texture GLTFParser::ParseTexture(int textureIdx, const tinygltf::Model& model)
 	return texture;
 }
 
-Entity GLTFParser::ParseNode(const tinygltf::Node& node, const tinygltf::Model& model, int& namelessEntitySuffix, std::vector<int>& lightToEntityMap, const std::vector<Mesh>& meshes, int entityIdx)
+int GLTFParser::ParseNode(const tinygltf::Node& node, const tinygltf::Model& model, int& namelessEntitySuffix, std::vector<int>& lightToEntityMap, const std::vector<Mesh>& meshes,
+	std::vector<MeshInstanceSet>& meshInstanceSets, EntityStorage& entities)
 {
-	Entity entity;
-	entity.name = node.name;
-	if (entity.name.empty())
+	std::string_view name = node.name;
+	char namelessName[32];
+	if (name.empty())
 	{
-		entity.name = "Entity" + std::to_string(namelessEntitySuffix++);
+		constexpr std::string_view prefix = "Entity";
+		std::memcpy(namelessName, prefix.data(), prefix.size());
+		char* end = std::to_chars(namelessName + prefix.size(), namelessName + sizeof(namelessName), namelessEntitySuffix++).ptr;
+		name = std::string_view(namelessName, end - namelessName);
 	}
-	entity.localTransform = GetNodeTransform(node);
-	entity.children = node.children;
-	entity.meshIdx = node.mesh;
+	const int entityIdx = entities.Create(name, GetNodeTransform(node));
+	entities.meshIndices[entityIdx] = node.mesh;
 
 	if (node.mesh >= 0)
 	{
-		const Mesh& entityMesh = meshes[entity.meshIdx];
+		const Mesh& entityMesh = meshes[node.mesh];
 		// TODO: add support for more than 2 morph targets
 		bool hasMorphTargets = entityMesh.HasMorphTargets();
 		if (hasMorphTargets)
 		{
-			entity.morphTargetWeights.resize(2);
+			entities.AllocateMorphTargetWeights(entityIdx, 2);
+		}
+
+		auto instancingExtension = node.extensions.find("EXT_mesh_gpu_instancing");
+		if (instancingExtension != node.extensions.end())
+		{
+			entities.meshInstanceSetIndices[entityIdx] = (int)meshInstanceSets.size();
+			meshInstanceSets.emplace_back(ParseMeshInstances(instancingExtension->second, model, entityMesh));
 		}
 	}
 
-	entity.cameraIdx = node.camera;
-	entity.skeletonIdx = node.skin;
+	entities.cameraIndices[entityIdx] = node.camera;
+	entities.skeletonIndices[entityIdx] = node.skin;
 
 	auto lightsExtension = node.extensions.find("KHR_lights_punctual");
 	if (lightsExtension != node.extensions.end())
 	{
 		int lightIdx = lightsExtension->second.Get("light").GetNumberAsInt();
-		entity.lightIdx = lightIdx;
+		entities.lightIndices[entityIdx] = lightIdx;
 		lightToEntityMap[lightIdx] = entityIdx;
 	}
 
-	return entity;
+	return entityIdx;
 }
 
-Skeleton GLTFParser::ParseSkin(const tinygltf::Skin& skin, const tinygltf::Model& model, const std::vector<Entity>& entities)
+MeshInstanceSet GLTFParser::ParseMeshInstances(const tinygltf::Value& instancingExtension, const tinygltf::Model& model, const Mesh& mesh)
+{
+	// Every attribute is optional and defaults to the identity, but all present ones have one element per instance
+	const tinygltf::Value& attributes = instancingExtension.Get("attributes");
+	auto getAccessor = [&](const char* name) -> const tinygltf::Accessor*
+	{
+		if (!attributes.Has(name))
+		{
+			return nullptr;
+		}
+		const tinygltf::Accessor& accessor = model.accessors[attributes.Get(name).GetNumberAsInt()];
+		if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)
+		{
+			std::cout << "Warning: EXT_mesh_gpu_instancing " << name << " accessor isn't float, ignoring it\n";
+			return nullptr;
+		}
+		return &accessor;
+	};
+	const tinygltf::Accessor* translationAccessor = getAccessor("TRANSLATION");
+	const tinygltf::Accessor* rotationAccessor = getAccessor("ROTATION");
+	const tinygltf::Accessor* scaleAccessor = getAccessor("SCALE");
+	int numInstances = 0;
+	for (const tinygltf::Accessor* accessor : { translationAccessor, rotationAccessor, scaleAccessor })
+	{
+		if (accessor != nullptr)
+		{
+			numInstances = std::max(numInstances, (int)accessor->count);
+		}
+	}
+
+	std::vector<Transform> transforms(numInstances, Transform{ .translation = glm::vec3(0.0f), .scale = glm::vec3(1.0f), .rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f) });
+	if (translationAccessor != nullptr)
+	{
+		std::vector<std::uint8_t> bytes = GetAccessorBytes(*translationAccessor, model);
+		std::span<const glm::vec3> translations((const glm::vec3*)bytes.data(), translationAccessor->count);
+		for (int i = 0; i < translations.size(); i++)
+		{
+			transforms[i].translation = translations[i];
+		}
+	}
+	if (rotationAccessor != nullptr)
+	{
+		// xyzw like glm::quat's storage
+		std::vector<std::uint8_t> bytes = GetAccessorBytes(*rotationAccessor, model);
+		std::span<const glm::quat> rotations((const glm::quat*)bytes.data(), rotationAccessor->count);
+		for (int i = 0; i < rotations.size(); i++)
+		{
+			transforms[i].rotation = rotations[i];
+		}
+	}
+	if (scaleAccessor != nullptr)
+	{
+		std::vector<std::uint8_t> bytes = GetAccessorBytes(*scaleAccessor, model);
+		std::span<const glm::vec3> scales((const glm::vec3*)bytes.data(), scaleAccessor->count);
+		for (int i = 0; i < scales.size(); i++)
+		{
+			transforms[i].scale = scales[i];
+		}
+	}
+
+	MeshInstanceSet instanceSet;
+	instanceSet.localTransforms.resize(numInstances);
+	ComputeAffineMatrices(transforms, instanceSet.localTransforms);
+	instanceSet.modelBounds = BBox{ .minXYZ = glm::vec3(FLT_MAX), .maxXYZ = glm::vec3(-FLT_MAX) };
+	for (const glm::mat4x3& localTransform : instanceSet.localTransforms)
+	{
+		const BBox box = TransformBox(mesh.boundingBox, localTransform);
+		instanceSet.modelBounds.minXYZ = glm::min(instanceSet.modelBounds.minXYZ, box.minXYZ);
+		instanceSet.modelBounds.maxXYZ = glm::max(instanceSet.modelBounds.maxXYZ, box.maxXYZ);
+	}
+	return instanceSet;
+}
+
+Skeleton GLTFParser::ParseSkin(const tinygltf::Skin& skin, const tinygltf::Model& model, const EntityStorage& entities)
 {
 	Skeleton skeleton;
 	int numJoints = skin.joints.size();
@@ -188,33 +284,71 @@ Skeleton GLTFParser::ParseSkin(const tinygltf::Skin& skin, const tinygltf::Model
 	assert(localToJointMatricesBytes.size() == sizeof(glm::mat4) * numJoints);
 	std::span<glm::mat4> localToJointMatrices((glm::mat4*)(localToJointMatricesBytes.data()), numJoints);
 
+	std::unordered_map<int, int> entityToSkinJoint;
 	for (int i = 0; i < numJoints; i++)
 	{
-		skeleton.joints.emplace_back();
-		auto& joint = skeleton.joints.back();
-		joint.localToJoint = glm::mat4x3(localToJointMatrices[i]);
-		joint.entityIndex = skin.joints[i];
-		int parentEntityIndex = entities[joint.entityIndex].parent;
-		if (parentEntityIndex < 0)
-		{
-			joint.parent = -1;
-		}
-		else
+		entityToSkinJoint[skin.joints[i]] = i;
+	}
+
+	// Parent of each joint in skin order, -1 if the joint's entity parent isn't part of this skin
+	std::vector<int> skinJointParents(numJoints);
+	for (int i = 0; i < numJoints; i++)
+	{
+		auto parentIter = entityToSkinJoint.find(entities.parents[skin.joints[i]]);
+		skinJointParents[i] = parentIter != entityToSkinJoint.end() ? parentIter->second : -1;
+	}
+
+	// Sort by depth so parents always come before their children
+	std::vector<int> depths(numJoints, -1);
+	std::function<int(int)> getDepth = [&](int skinJointIdx)
+	{
+		if (depths[skinJointIdx] < 0)
 		{
-			joint.parent = 0;
-			while (joint.parent < skeleton.joints.size() && skeleton.joints[joint.parent].entityIndex != parentEntityIndex)
-			{
-				joint.parent++;
-			}
-			if (joint.parent >= skeleton.joints.size()) joint.parent = -1;
+			int parent = skinJointParents[skinJointIdx];
+			depths[skinJointIdx] = parent < 0 ? 0 : getDepth(parent) + 1;
 		}
+		return depths[skinJointIdx];
+	};
+	std::vector<int> skinJointOrder(numJoints);
+	for (int i = 0; i < numJoints; i++)
+	{
+		skinJointOrder[i] = i;
+		getDepth(i);
+	}
+	std::stable_sort(skinJointOrder.begin(), skinJointOrder.end(), [&depths](int a, int b) { return depths[a] < depths[b]; });
+
+	std::vector<int> skinJointToJoint(numJoints);
+	for (int i = 0; i < numJoints; i++)
+	{
+		skinJointToJoint[skinJointOrder[i]] = i;
+	}
+
+	skeleton.joints.resize(numJoints);
+	for (int i = 0; i < numJoints; i++)
+	{
+		const int skinJointIdx = skinJointOrder[i];
+		auto& joint = skeleton.joints[i];
+		joint.localToJoint = glm::mat4x3(localToJointMatrices[skinJointIdx]);
+		joint.entityIndex = skin.joints[skinJointIdx];
+		joint.parent = skinJointParents[skinJointIdx] >= 0 ? skinJointToJoint[skinJointParents[skinJointIdx]] : -1;
+		joint.paletteIdx = skinJointIdx;
+	}
+	skeleton.layoutHash = skeleton.ComputeLayoutHash();
+
+	// Opt in per skin with "extras": { "skinningMode": "dualQuaternion" }
+	if (skin.extras.Has("skinningMode") && skin.extras.Get("skinningMode").IsString() &&
+		skin.extras.Get("skinningMode").Get<std::string>() == "dualQuaternion")
+	{
+		skeleton.skinningMode = SkinningMode::DualQuaternion;
 	}
 	return skeleton;
 }
 
-Animation GLTFParser::ParseAnimation(const tinygltf::Animation& gltfAnimation, const tinygltf::Model& model, int& namelessAnimSuffix, const std::vector<Entity>& entities)
+Animation GLTFParser::ParseAnimation(const tinygltf::Animation& gltfAnimation, const tinygltf::Model& model, int& namelessAnimSuffix, const EntityStorage& entities,
+	const AnimationCompressionSettings& compressionSettings)
 {
 	Animation animation;
+	std::vector<EntityAnimationSource> entityAnimationSources;
 
 	double animationDurationSeconds = GetAnimationDurationSeconds(gltfAnimation, model);
 	animation.durationSeconds = (float)animationDurationSeconds;
@@ -230,23 +364,21 @@ Animation GLTFParser::ParseAnimation(const tinygltf::Animation& gltfAnimation, c
 
 	for (const auto& channel : gltfAnimation.channels)
 	{
-		const Entity* sceneEntity = &entities[channel.target_node];
-
 		// Entity might already have another animated channel in this animation, check if so
-		auto entityAnimationIter = std::find_if(animation.entityAnimations.begin(), animation.entityAnimations.end(),
-			[&channel](const EntityAnimation& entityAnimation)
+		auto entityAnimationIter = std::find_if(entityAnimationSources.begin(), entityAnimationSources.end(),
+			[&channel](const EntityAnimationSource& entityAnimation)
 			{
 				return entityAnimation.entityIdx == channel.target_node;
 			});
-		EntityAnimation* entityAnimation;
-		if (entityAnimationIter != animation.entityAnimations.end())
+		EntityAnimationSource* entityAnimation;
+		if (entityAnimationIter != entityAnimationSources.end())
 		{
 			entityAnimation = &(*entityAnimationIter);
 		}
 		else
 		{
-			animation.entityAnimations.emplace_back();
-			entityAnimation = &animation.entityAnimations.back();
+			entityAnimationSources.emplace_back();
+			entityAnimation = &entityAnimationSources.back();
 		}
 
 		entityAnimation->entityIdx = channel.target_node;
@@ -255,7 +387,6 @@ Animation GLTFParser::ParseAnimation(const tinygltf::Animation& gltfAnimation, c
 		InterpolationType method = InterpolationType::LINEAR;
 		if (sampler.interpolation == "STEP") method = InterpolationType::STEP;
 		else if (sampler.interpolation == "CUBICSPLINE") method = InterpolationType::CUBICSPLINE;
-		assert(channel.target_path != "weights" || method == InterpolationType::LINEAR && "Non-linear interpolation not supported for weights currently");
 		const auto& keyframeTimesAccessor = model.accessors[sampler.input];
 		const auto& keyframeValuesAccessor = model.accessors[sampler.output];
 		if (channel.target_path == "translation")
@@ -308,6 +439,13 @@ Animation GLTFParser::ParseAnimation(const tinygltf::Animation& gltfAnimation, c
 		}
 	}
 
+	AnimationCompressionStats compressionStats;
+	for (const EntityAnimationSource& source : entityAnimationSources)
+	{
+		float jointReach = ComputeJointReach(source.entityIdx, entities);
+		animation.entityAnimations.emplace_back(CompressEntityAnimation(source, jointReach, compressionSettings, compressionStats));
+	}
+
 	return animation;
 }
 
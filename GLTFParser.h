@@ -1,17 +1,21 @@
 #pragma once
 
+#include "AnimationCompression.h"
 #include "Scene.h"
 #include <tiny_gltf.h>
 
 class GLTFParser
 {
 public:
-	static Scene Parse(const tinygltf::Scene& scene, const tinygltf::Model& model);
+	static Scene Parse(const tinygltf::Scene& scene, const tinygltf::Model& model, const AnimationCompressionSettings& compressionSettings = {});
 private:
 	static Texture ParseTexture(int textureIdx, const tinygltf::Model& model);
-	static Entity ParseNode(const tinygltf::Node& node, const tinygltf::Model& model, int& namelessEntitySuffix, std::vector<int>& lightOwningEntityIdx, const std::vector<Mesh>& meshes, int entityIdx);
-	static Skeleton ParseSkin(const tinygltf::Skin& skin, const tinygltf::Model& model, const std::vector<Entity>& entities);
-	static Animation ParseAnimation(const tinygltf::Animation& animation, const tinygltf::Model& model, int& namelessAnimSuffix, const std::vector<Entity>& entities);
+	static int ParseNode(const tinygltf::Node& node, const tinygltf::Model& model, int& namelessEntitySuffix, std::vector<int>& lightOwningEntityIdx, const std::vector<Mesh>& meshes,
+		std::vector<MeshInstanceSet>& meshInstanceSets, EntityStorage& entities);
+	static MeshInstanceSet ParseMeshInstances(const tinygltf::Value& instancingExtension, const tinygltf::Model& model, const Mesh& mesh);
+	static Skeleton ParseSkin(const tinygltf::Skin& skin, const tinygltf::Model& model, const EntityStorage& entities);
+	static Animation ParseAnimation(const tinygltf::Animation& animation, const tinygltf::Model& model, int& namelessAnimSuffix, const EntityStorage& entities,
+		const AnimationCompressionSettings& compressionSettings);
 	static Camera ParseCamera(const tinygltf::Camera& camera, const tinygltf::Model& model, int& namelessCameraSuffix);
 	static Light ParseLight(const tinygltf::Light& light, const tinygltf::Model& model, const std::vector<int>& lightToEntityMap, int lightIdx);
 	static PBRMaterial ParseMaterial(const tinygltf::Material& gltfMaterial, const tinygltf::Model& model);
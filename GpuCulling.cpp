@@ -0,0 +1,173 @@
+#include "GpuCulling.h"
+
+#include "Frustum.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static constexpr int hiZGroupSize = 8; // hizBuild.comp's local size in x and y
+static constexpr int cullGroupSize = 64; // cull.comp's local size
+
+GpuCulling::GpuCulling(ShaderLibrary& shaderLibrary, GLuint depthTexture, int width, int height)
+	:depthTexture(depthTexture), width(width), height(height),
+	hiZCopyShader(shaderLibrary.GetCompute("Shaders/hizBuild.comp", { "COPY_DEPTH" })),
+	hiZReduceShader(shaderLibrary.GetCompute("Shaders/hizBuild.comp")),
+	lastFrameVisibleCullShader(shaderLibrary.GetCompute("Shaders/cull.comp", { "LAST_FRAME_VISIBLE_PHASE" })),
+	disoccludedCullShader(shaderLibrary.GetCompute("Shaders/cull.comp", { "DISOCCLUDED_PHASE" }))
+{
+	// Down to 1x1
+	numHiZLevels = 1;
+	while ((std::max(width, height) >> numHiZLevels) > 0)
+	{
+		numHiZLevels++;
+	}
+	glGenTextures(1, &hiZTexture);
+	glBindTexture(GL_TEXTURE_2D, hiZTexture);
+	glTexStorage2D(GL_TEXTURE_2D, numHiZLevels, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+GpuCulling::~GpuCulling()
+{
+	DeleteBuffers();
+	glDeleteTextures(1, &hiZTexture);
+}
+
+void GpuCulling::DeleteBuffers()
+{
+	if (cullInputBuffer != 0)
+	{
+		const GLuint buffers[] = { cullInputBuffer, commandBuffer, runCountBuffer, visibilityBuffer, runFirstCommandBuffer };
+		glDeleteBuffers(5, buffers);
+		cullInputBuffer = 0;
+	}
+	numCommands = 0;
+	numRuns = 0;
+}
+
+void GpuCulling::Build(std::span<const DrawElementsIndirectCommand> commands, std::span<const BBox> modelBounds, std::span<const int> commandRuns)
+{
+	DeleteBuffers();
+	numCommands = (int)commands.size();
+	if (numCommands == 0)
+	{
+		return;
+	}
+
+	std::vector<CullInput> cullInputs(numCommands);
+	std::vector<GLuint> runFirstCommands;
+	for (int i = 0; i < numCommands; i++)
+	{
+		const DrawElementsIndirectCommand& command = commands[i];
+		cullInputs[i] = CullInput{
+			.center = modelBounds[i].GetCenter(),
+			.runIdx = (GLuint)commandRuns[i],
+			.extents = (modelBounds[i].maxXYZ - modelBounds[i].minXYZ) * 0.5f,
+			.indexCount = command.count,
+			.firstIndex = command.firstIndex,
+			.baseVertex = command.baseVertex,
+			.drawIdx = command.baseInstance,
+			.pad = 0
+		};
+		if (i == 0 || commandRuns[i] != commandRuns[i - 1])
+		{
+			runFirstCommands.push_back(i);
+		}
+	}
+	numRuns = (int)runFirstCommands.size();
+
+	GLuint buffers[5];
+	glGenBuffers(5, buffers);
+	cullInputBuffer = buffers[0];
+	commandBuffer = buffers[1];
+	runCountBuffer = buffers[2];
+	visibilityBuffer = buffers[3];
+	runFirstCommandBuffer = buffers[4];
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullInputBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, cullInputs.size() * sizeof(CullInput), cullInputs.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, runFirstCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, runFirstCommands.size() * sizeof(GLuint), runFirstCommands.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numCommands * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, runCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numRuns * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibilityBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, numCommands * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+void GpuCulling::Cull(Phase phase, const glm::mat4& viewProjection)
+{
+	if (numCommands == 0)
+	{
+		return;
+	}
+
+	// Every slot an empty command and every run empty until survivors are appended
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, runCountBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	Shader& shader = phase == Phase::LastFrameVisible ? lastFrameVisibleCullShader : disoccludedCullShader;
+	shader.Use();
+	shader.SetUint("numCommands", numCommands);
+	shader.SetMat4("viewProjection", viewProjection);
+	const Frustum frustum = Frustum::FromMatrix(viewProjection);
+	for (int i = 0; i < 6; i++)
+	{
+		shader.SetVec4(("frustumPlanes[" + std::to_string(i) + "]").c_str(), frustum.planes[i]);
+	}
+	if (phase == Phase::Disoccluded)
+	{
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, hiZTexture);
+		shader.SetInt("hiZ", 0);
+		shader.SetVec2("hiZSize", (float)width, (float)height);
+		shader.SetInt("hiZMaxLevel", numHiZLevels - 1);
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, cullInputsBinding, cullInputBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, commandsBinding, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, runCountsBinding, runCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, visibilityBinding, visibilityBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, runFirstCommandsBinding, runFirstCommandBuffer);
+	glDispatchCompute((numCommands + cullGroupSize - 1) / cullGroupSize, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuCulling::BuildHiZ()
+{
+	// Level 0 is a copy of the depth, each further level the farthest of the 2x2 texels below it
+	hiZCopyShader.Use();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	hiZCopyShader.SetInt("depthTexture", 0);
+	hiZCopyShader.SetInt("destinationWidth", width);
+	hiZCopyShader.SetInt("destinationHeight", height);
+	glBindImageTexture(0, hiZTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((width + hiZGroupSize - 1) / hiZGroupSize, (height + hiZGroupSize - 1) / hiZGroupSize, 1);
+
+	hiZReduceShader.Use();
+	for (int level = 1; level < numHiZLevels; level++)
+	{
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		const int sourceWidth = std::max(1, width >> (level - 1));
+		const int sourceHeight = std::max(1, height >> (level - 1));
+		const int levelWidth = std::max(1, width >> level);
+		const int levelHeight = std::max(1, height >> level);
+		hiZReduceShader.SetInt("sourceWidth", sourceWidth);
+		hiZReduceShader.SetInt("sourceHeight", sourceHeight);
+		hiZReduceShader.SetInt("destinationWidth", levelWidth);
+		hiZReduceShader.SetInt("destinationHeight", levelHeight);
+		glBindImageTexture(1, hiZTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(0, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((levelWidth + hiZGroupSize - 1) / hiZGroupSize, (levelHeight + hiZGroupSize - 1) / hiZGroupSize, 1);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
\ No newline at end of file
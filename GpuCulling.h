@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "RenderQueue.h"
+#include "Shader.h"
+#include "ShaderLibrary.h"
+#include <span>
+
+// GPU-driven culling of RenderQueue's multi-draw packets. Every packet has a fixed indirect command slot, and the slots are
+// grouped in runs that RenderQueue draws with one glMultiDrawElementsIndirect each. cull.comp transforms each packet's model
+// space bounds by its world matrix from RenderQueue's draw data, tests them against the frustum and a hierarchical-Z
+// pyramid of the depth buffer, and compacts the survivors of each run to the front of the run's slots. The remaining slots
+// are left as empty commands, since GL 4.3 can't take the draw count from a buffer. The CPU never sees the results, so its
+// cost doesn't depend on how many packets pass.
+//
+// Culling is two-phase so that newly disoccluded packets appear the frame they become visible: the first phase draws the
+// packets visible last frame that are still in the frustum, hizBuild.comp then reduces the depth they leave into the
+// pyramid (farthest depth of each 2x2 texels per level), and the second phase draws the packets that pass against it and
+// weren't drawn in the first, recording which packets were visible for the next frame
+class GpuCulling
+{
+public:
+	enum class Phase
+	{
+		LastFrameVisible,
+		Disoccluded
+	};
+
+	// Shader storage bindings of cull.comp, RenderQueue::drawDataBinding holds the world matrices
+	static constexpr GLuint cullInputsBinding = 4;
+	static constexpr GLuint commandsBinding = 5;
+	static constexpr GLuint runCountsBinding = 6;
+	static constexpr GLuint visibilityBinding = 7;
+	static constexpr GLuint runFirstCommandsBinding = 8;
+
+	// Of a depth texture with the size of the viewport it's rendered with. shaderLibrary must outlive the culling
+	GpuCulling(ShaderLibrary& shaderLibrary, GLuint depthTexture, int width, int height);
+	GpuCulling(const GpuCulling&) = delete;
+	GpuCulling& operator=(const GpuCulling&) = delete;
+	~GpuCulling();
+
+	// commands are the packets' commands with instanceCount 1, grouped by run, and commandRuns their run indices.
+	// Every packet starts out invisible, so the first frame draws everything in the second phase
+	void Build(std::span<const DrawElementsIndirectCommand> commands, std::span<const BBox> modelBounds, std::span<const int> commandRuns);
+	// Rewrites GetCommandBuffer(). The draw data of every command must be bound at RenderQueue::drawDataBinding
+	void Cull(Phase phase, const glm::mat4& viewProjection);
+	// From the depth texture's current contents, between the phases
+	void BuildHiZ();
+
+	GLuint GetCommandBuffer() const { return commandBuffer; }
+	GLuint GetHiZTexture() const { return hiZTexture; }
+
+private:
+	// Mirrors cull.comp
+	struct CullInput
+	{
+		glm::vec3 center; // model space bounds
+		GLuint runIdx;
+		glm::vec3 extents;
+		GLuint indexCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint drawIdx; // into the draw data, and the command's baseInstance
+		GLuint pad;
+	};
+
+	void DeleteBuffers();
+
+	GLuint depthTexture;
+	int width, height;
+	int numHiZLevels;
+	GLuint hiZTexture = 0;
+	Shader& hiZCopyShader;
+	Shader& hiZReduceShader;
+	Shader& lastFrameVisibleCullShader;
+	Shader& disoccludedCullShader;
+
+	int numCommands = 0;
+	int numRuns = 0;
+	GLuint cullInputBuffer = 0;
+	GLuint commandBuffer = 0;
+	GLuint runCountBuffer = 0;
+	GLuint visibilityBuffer = 0;
+	GLuint runFirstCommandBuffer = 0;
+};
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Queue index of the pool thread running on this OS thread. Threads outside the pool share queue 0 with whoever
+// created the pool
+static thread_local const JobSystem* currentJobSystem = nullptr;
+static thread_local int currentQueueIdx = 0;
+
+JobSystem::JobSystem(int numThreads)
+{
+	numThreads = std::max(1, numThreads);
+	for (int i = 0; i < numThreads; i++)
+	{
+		queues.emplace_back(std::make_unique<JobQueue>());
+	}
+	for (int i = 1; i < numThreads; i++)
+	{
+		workers.emplace_back([this, i]() { WorkerLoop(i); });
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void JobSystem::ParallelFor(int count, int grainSize, const std::function<void(int begin, int end)>& func)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	grainSize = std::max(1, grainSize);
+	const int numJobs = (count + grainSize - 1) / grainSize;
+	if (numJobs == 1 || queues.size() == 1)
+	{
+		func(0, count);
+		return;
+	}
+
+	std::atomic<int> remainingJobs = numJobs;
+	const int queueIdx = GetCurrentQueueIdx();
+
+	// Deal the chunks out round robin so the other threads find work in their own queues before having to steal
+	for (int i = 0; i < numJobs; i++)
+	{
+		JobQueue& queue = *queues[(queueIdx + i) % queues.size()];
+		Job job{ &func, i * grainSize, std::min(count, (i + 1) * grainSize), &remainingJobs };
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		pendingJobs += numJobs;
+	}
+	wakeCondition.notify_all();
+
+	while (remainingJobs.load(std::memory_order_acquire) > 0)
+	{
+		if (!RunOneJob(queueIdx))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void JobSystem::WorkerLoop(int queueIdx)
+{
+	currentJobSystem = this;
+	currentQueueIdx = queueIdx;
+
+	while (true)
+	{
+		if (RunOneJob(queueIdx))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		wakeCondition.wait(lock, [this]() { return stopping || pendingJobs.load() > 0; });
+		if (stopping)
+		{
+			return;
+		}
+	}
+}
+
+bool JobSystem::RunOneJob(int queueIdx)
+{
+	Job job;
+	bool foundJob = false;
+
+	{
+		JobQueue& ownQueue = *queues[queueIdx];
+		std::lock_guard<std::mutex> lock(ownQueue.mutex);
+		if (!ownQueue.jobs.empty())
+		{
+			job = ownQueue.jobs.back();
+			ownQueue.jobs.pop_back();
+			foundJob = true;
+		}
+	}
+
+	for (int i = 1; i < queues.size() && !foundJob; i++)
+	{
+		JobQueue& victimQueue = *queues[(queueIdx + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victimQueue.mutex);
+		if (!victimQueue.jobs.empty())
+		{
+			job = victimQueue.jobs.front();
+			victimQueue.jobs.pop_front();
+			foundJob = true;
+		}
+	}
+
+	if (!foundJob)
+	{
+		return false;
+	}
+
+	pendingJobs--;
+	(*job.func)(job.begin, job.end);
+	job.remainingJobs->fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+int JobSystem::GetCurrentQueueIdx() const
+{
+	return currentJobSystem == this ? currentQueueIdx : 0;
+}
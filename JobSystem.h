@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every thread owns a queue, pops work from the back of its own queue and steals from the front of
+// the others' when it runs dry. The thread calling ParallelFor takes part in the work, so nested ParallelFor calls from inside
+// a job are fine.
+class JobSystem
+{
+public:
+	// numThreads includes the calling thread, so JobSystem(1) runs everything inline
+	explicit JobSystem(int numThreads = (int)std::thread::hardware_concurrency());
+	~JobSystem();
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	int GetNumThreads() const { return (int)queues.size(); }
+
+	// Splits [0, count) into chunks of at most grainSize and calls func(begin, end) for each across the pool.
+	// Returns once every chunk has run
+	void ParallelFor(int count, int grainSize, const std::function<void(int begin, int end)>& func);
+
+private:
+	struct Job
+	{
+		const std::function<void(int, int)>* func;
+		int begin, end;
+		std::atomic<int>* remainingJobs;
+	};
+
+	struct JobQueue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void WorkerLoop(int queueIdx);
+	bool RunOneJob(int queueIdx);
+	int GetCurrentQueueIdx() const;
+
+	std::vector<std::unique_ptr<JobQueue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<int> pendingJobs = 0;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCondition;
+	bool stopping = false;
+};
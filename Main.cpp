@@ -3,14 +3,31 @@
 #include <GLFW/glfw3.h>
 
 #include <tiny_gltf.h>
+#include "AnimationSystem.h"
+#include "BakedAnimation.h"
+#include "Benchmark.h"
+#include "BVH.h"
 #include "Camera.h"
+#include "CpuSkinning.h"
 #include "Framebuffer.h"
+#include "Frustum.h"
 #include "GLTFParser.h"
+#include "GpuCulling.h"
 #include "Input.h"
+#include "JobSystem.h"
 #include "Light.h"
 #include "Mesh.h"
+#include "OcclusionCulling.h"
+#include "RenderQueue.h"
 #include "Shader.h"
+#include "ShaderLibrary.h"
+#include "SkinningPaletteBuffer.h"
+#include "SkinningPrePass.h"
 #include "Texture.h"
+#include "TransformSystem.h"
+
+#include <iostream>
+#include <optional>
 
 const int windowWidth = 640;
 const int windowHeight = 480;
@@ -49,44 +66,78 @@ static void ProcessInput(GLFWwindow* window, Input& outInput)
     outInput.dPressed = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
 }
 
-static std::vector<std::string> GetShaderDefines(VertexAttribute flags, bool flatShading)
+// Largest difference between the CPU skinned vertices and the pre-pass's, over every submesh both skin. CPU skinning always
+// blends linearly, so dual quaternion skeletons are left out
+static float CompareCpuSkinningWithPrePass(const Scene& scene, const CpuSkinning& cpuSkinning, const SkinningPrePass& skinningPrePass)
 {
-    std::vector<std::string> defines;
-
-    if (HasFlag(flags, VertexAttribute::TEXCOORD))
-    {
-        defines.emplace_back("HAS_TEXCOORD");
-    }
-    if (HasFlag(flags, VertexAttribute::NORMAL))
-    {
-        defines.emplace_back("HAS_NORMALS");
-    }
-    if (HasFlag(flags, VertexAttribute::JOINTS))
-    {
-        defines.emplace_back("HAS_JOINTS");
-    }
-    if (HasFlag(flags, VertexAttribute::MORPH_TARGET0_POSITION))
-    {
-        defines.emplace_back("HAS_MORPH_TARGETS");
-    }
-    if (flatShading)
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    float maxError = 0.0f;
+    std::vector<float> cpuVertices, gpuVertices;
+    for (int entityIdx = 0; entityIdx < scene.entities.Size(); entityIdx++)
     {
-        defines.emplace_back("FLAT_SHADING");
-    }
-    if (HasFlag(flags, VertexAttribute::TANGENT))
-    {
-        defines.emplace_back("HAS_TANGENTS");
+        const int meshIdx = scene.entities.meshIndices[entityIdx];
+        const int skeletonIdx = scene.entities.skeletonIndices[entityIdx];
+        if (meshIdx < 0 || skeletonIdx < 0 || scene.skeletons[skeletonIdx].skinningMode != SkinningMode::LinearBlend)
+        {
+            continue;
+        }
+        for (int submeshIdx = 0; submeshIdx < scene.meshes[meshIdx].submeshes.size(); submeshIdx++)
+        {
+            const int cpuOutputIdx = cpuSkinning.GetOutputIndex(entityIdx, submeshIdx);
+            const int gpuOutputIdx = skinningPrePass.GetOutputIndex(entityIdx, submeshIdx);
+            if (cpuOutputIdx < 0 || gpuOutputIdx < 0)
+            {
+                continue;
+            }
+
+            const Submesh& source = scene.meshes[meshIdx].submeshes[submeshIdx];
+            const int numFloats = source.numVertices * GetSkinnedVertexStrideFloats(source.flags);
+            cpuVertices.resize(numFloats);
+            gpuVertices.resize(numFloats);
+            glBindBuffer(GL_ARRAY_BUFFER, cpuSkinning.GetOutputSubmesh(cpuOutputIdx).VBO);
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0, numFloats * sizeof(float), cpuVertices.data());
+            glBindBuffer(GL_ARRAY_BUFFER, skinningPrePass.GetOutputSubmesh(gpuOutputIdx).VBO);
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0, numFloats * sizeof(float), gpuVertices.data());
+            for (int i = 0; i < numFloats; i++)
+            {
+                maxError = std::max(maxError, std::abs(cpuVertices[i] - gpuVertices[i]));
+            }
+        }
     }
-    if (HasFlag(flags, VertexAttribute::COLOR))
+    return maxError;
+}
+
+// Mode flags can be given in any order and combined
+static bool HasFlag(int argc, char** argv, const char* flag)
+{
+    for (int i = 1; i < argc; i++)
     {
-        defines.emplace_back("HAS_VERTEX_COLORS");
+        if (std::string(argv[i]) == flag)
+        {
+            return true;
+        }
     }
-
-    return defines;
+    return false;
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
+    if (HasFlag(argc, argv, "--benchmark"))
+    {
+        RunTransformConversionBenchmark();
+        RunAnimationUpdateBenchmark();
+        RunPoseCacheBenchmark();
+        RunAnimationLodBenchmark();
+        RunBakedAnimationBenchmark();
+        RunCpuSkinningBenchmark();
+        RunDualQuaternionSkinningBenchmark();
+        RunDrawSortBenchmark();
+        RunFrustumCullingBenchmark();
+        RunBvhBenchmark();
+        RunOcclusionCullingBenchmark();
+        return 0;
+    }
+
     GLFWwindow* window;
 
     if (!glfwInit())
@@ -110,6 +161,12 @@ int main(void)
         return -1;
     }
 
+    // Every program comes from the library, which loads the ones a previous run linked from ShaderCache. With
+    // --async-shaders the geometry pass variants compile in the background while fallbacks draw in their place
+    const double startupStartTime = glfwGetTime();
+    const bool useAsyncShaders = HasFlag(argc, argv, "--async-shaders");
+    ShaderLibrary shaderLibrary;
+
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
     std::string err;
@@ -132,8 +189,30 @@ int main(void)
     }
 
     Scene scene = GLTFParser::Parse(model.scenes[model.defaultScene], model);
-    Mesh& duckMesh = scene.meshes[0];
-    Shader geometryPassShader = Shader("Shaders/geometryPass.vert", "Shaders/geometryPass.frag", nullptr, GetShaderDefines(duckMesh.submeshes[0].flags, duckMesh.submeshes[0].flatShading));
+    // Skins pick their skinning mode in their glTF extras, --dual-quaternion-skinning switches every skeleton to it
+    if (HasFlag(argc, argv, "--dual-quaternion-skinning"))
+    {
+        for (Skeleton& skeleton : scene.skeletons)
+        {
+            skeleton.skinningMode = SkinningMode::DualQuaternion;
+        }
+    }
+
+    // Animated submeshes are skinned and morphed once per frame by the pre-pass (or on the CPU with --cpu-skinning), then
+    // drawn like static ones. --check-cpu-skinning also runs the pre-pass on the first frame and prints how far apart they are
+    const bool useCpuSkinning = HasFlag(argc, argv, "--cpu-skinning");
+    bool checkCpuSkinning = useCpuSkinning && HasFlag(argc, argv, "--check-cpu-skinning");
+    SkinningPaletteBuffer skinningPalettes;
+    SkinningPrePass skinningPrePass(shaderLibrary);
+    CpuSkinning cpuSkinning;
+    if (useCpuSkinning)
+    {
+        cpuSkinning.Build(scene);
+    }
+    if (!useCpuSkinning || checkCpuSkinning)
+    {
+        skinningPrePass.Build(scene);
+    }
 
     // All color attachments are used for the geometry pass except for the last attachment which is an HDR texture used in the lighting pass.
     // This makes it easy to use the depth buffer from the geometry pass in the lighting pass. 
@@ -167,16 +246,93 @@ int main(void)
         },
         GL_DEPTH24_STENCIL8
     };
+
+    // Static submeshes are frustum and occlusion culled on the GPU with --gpu-culling, instead of by the BVH and
+    // OcclusionCulling
+    const bool useGpuCulling = HasFlag(argc, argv, "--gpu-culling");
+    std::optional<GpuCulling> gpuCulling;
+    RenderQueue renderQueue(shaderLibrary);
+    if (useGpuCulling)
+    {
+        gpuCulling.emplace(shaderLibrary, framebuffer.depthStencilTexture, windowWidth, windowHeight);
+        renderQueue.SetGpuCulling(&*gpuCulling);
+    }
+    renderQueue.SetAsyncShaderCompilation(useAsyncShaders);
+    renderQueue.Build(scene, [&](int entityIdx, int submeshIdx) -> const Submesh*
+    {
+        if (useCpuSkinning)
+        {
+            int outputIdx = cpuSkinning.GetOutputIndex(entityIdx, submeshIdx);
+            return outputIdx >= 0 ? &cpuSkinning.GetOutputSubmesh(outputIdx) : nullptr;
+        }
+        int outputIdx = skinningPrePass.GetOutputIndex(entityIdx, submeshIdx);
+        return outputIdx >= 0 ? &skinningPrePass.GetOutputSubmesh(outputIdx) : nullptr;
+    });
+
+    // With --baked-crowd a grid of copies of the first skinned mesh plays the first animation from a baked palette texture,
+    // each of its submeshes one instanced draw however many copies there are
+    const bool useBakedCrowd = HasFlag(argc, argv, "--baked-crowd");
+    std::optional<BakedCrowd> bakedCrowd;
+    int bakedCrowdEntityIdx = -1;
+    std::vector<Shader*> bakedCrowdShaders; // per submesh of the mesh, nullptr for unskinned ones
+    if (useBakedCrowd && !scene.animations.empty())
+    {
+        for (int entityIdx = 0; entityIdx < scene.entities.Size() && bakedCrowdEntityIdx < 0; entityIdx++)
+        {
+            if (scene.entities.alive[entityIdx] && scene.entities.meshIndices[entityIdx] >= 0 && scene.entities.skeletonIndices[entityIdx] >= 0)
+            {
+                bakedCrowdEntityIdx = entityIdx;
+            }
+        }
+    }
+    if (bakedCrowdEntityIdx >= 0)
+    {
+        const int skeletonIdx = scene.entities.skeletonIndices[bakedCrowdEntityIdx];
+        const Mesh& mesh = scene.meshes[scene.entities.meshIndices[bakedCrowdEntityIdx]];
+        const BakedAnimation bakedAnimation = CreateBakedAnimation(scene, skeletonIdx, 0);
+
+        constexpr int crowdSide = 32;
+        const glm::vec3 meshSize = mesh.boundingBox.maxXYZ - mesh.boundingBox.minXYZ;
+        const float spacing = 1.5f * std::max(meshSize.x, meshSize.z);
+        const glm::mat4 world(scene.globalTransforms[bakedCrowdEntityIdx]);
+        std::vector<BakedInstance> instances(crowdSide * crowdSide);
+        for (int i = 0; i < instances.size(); i++)
+        {
+            const glm::vec3 offset((i % crowdSide - crowdSide / 2) * spacing, 0.0f, (i / crowdSide - crowdSide / 2) * spacing);
+            instances[i].world = glm::translate(glm::mat4(1.0f), offset) * world;
+            instances[i].timeOffsetSeconds = std::fmod(i * 0.37f, std::max(scene.animations[0].durationSeconds, 0.001f));
+        }
+        bakedCrowd.emplace(bakedAnimation, instances);
+
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            if (!HasFlag(submesh.flags, VertexAttribute::JOINTS))
+            {
+                bakedCrowdShaders.push_back(nullptr);
+                continue;
+            }
+            // Baked palettes carry no morph target weights
+            std::vector<std::string> defines = RenderQueue::GetGeometryPassDefines(submesh.flags & ~VertexAttribute::MORPH_TARGET0_POSITION,
+                submesh.flatShading);
+            defines.emplace_back("BAKED_ANIMATION");
+            bakedCrowdShaders.push_back(&shaderLibrary.Get("Shaders/geometryPass.vert", "Shaders/geometryPass.frag", defines));
+        }
+        std::cout << "Baked crowd: " << instances.size() << " instances, " << bakedAnimation.numFrames << " frames\n";
+    }
+
     framebuffer.Bind();
     glEnablei(GL_BLEND, framebuffer.colorTextures.size() - 1); 
     glBlendFunc(GL_SRC_COLOR, GL_DST_COLOR);
     glBlendEquation(GL_FUNC_ADD);
 
     DirectionalLight light{ glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f), 10.0f };
-    Shader renderGBufferShader = Shader("Shaders/fullscreen.vert", "Shaders/fullscreen.frag");
-    Shader lightingPassShader = Shader("Shaders/lighting.vert", "Shaders/lightingDirectional.frag");
+    Shader& renderGBufferShader = shaderLibrary.Get("Shaders/fullscreen.vert", "Shaders/fullscreen.frag");
+    Shader& lightingPassShader = shaderLibrary.Get("Shaders/lighting.vert", "Shaders/lightingDirectional.frag");
+
+    Shader& postprocessShader = shaderLibrary.Get("Shaders/fullscreen.vert", "Shaders/postprocess.frag");
 
-    Shader postprocessShader = Shader("Shaders/fullscreen.vert", "Shaders/postprocess.frag");
+    std::cout << "Shader programs: " << shaderLibrary.GetNumPrograms() << " (" << shaderLibrary.GetNumCacheHits() << " loaded from cache, "
+        << shaderLibrary.GetNumCacheMisses() << " compiled, " << shaderLibrary.GetNumReuses() << " reused)\n";
 
     GLfloat dirLightVertices[] = {
         -1.0f, -1.0f, -1.0f,
@@ -241,10 +397,22 @@ int main(void)
     camera.position.y = 0.1f;
     camera.position.z = 0.6f;
 
-    glm::mat4 duckWorldMat = glm::mat4(1.0f);
-    duckWorldMat = glm::rotate(duckWorldMat, -45.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-
     Input input;
+    JobSystem jobSystem;
+    AnimationSystem animationSystem;
+    TransformSystem transformSystem;
+    transformSystem.Build(scene);
+    transformSystem.Update(scene, &jobSystem);
+    BVH bvh;
+    bvh.Build(scene);
+    std::vector<int> movedEntities;
+    std::vector<int> visibleEntities;
+    OcclusionCulling occlusionCulling;
+
+    std::cout << "Startup: " << (glfwGetTime() - startupStartTime) * 1000.0 << " ms, async shader compilation "
+        << (useAsyncShaders ? (shaderLibrary.IsParallelCompileSupported() ? "on" : "on without KHR_parallel_shader_compile") : "off")
+        << ", " << shaderLibrary.GetNumPending() << " programs pending\n";
+    bool shadersPending = shaderLibrary.GetNumPending() > 0;
    
     float lastFrameStartTime = glfwGetTime();
 
@@ -263,100 +431,78 @@ int main(void)
 
         if (input.leftMousePressed) camera.ProcessMouseMovement(input.mouseDeltaX, input.mouseDeltaY);
 
+        animationSystem.Update(scene, currentTime, jobSystem, &camera);
+        transformSystem.Update(scene, &jobSystem);
+        movedEntities.clear();
+        transformSystem.GetUpdatedEntities(movedEntities);
+        bvh.Refit(scene, movedEntities);
+        if (useGpuCulling)
+        {
+            renderQueue.UpdateGpuDrawData(scene, movedEntities);
+        }
+        if (useCpuSkinning)
+        {
+            cpuSkinning.Update(scene, jobSystem);
+            if (checkCpuSkinning)
+            {
+                skinningPalettes.Update(scene);
+                skinningPrePass.Dispatch(scene, skinningPalettes);
+                std::cout << "CPU skinning max difference from the pre-pass: " << CompareCpuSkinningWithPrePass(scene, cpuSkinning, skinningPrePass) << '\n';
+                checkCpuSkinning = false;
+            }
+        }
+        else
+        {
+            skinningPalettes.Update(scene);
+            skinningPrePass.Dispatch(scene, skinningPalettes);
+        }
+
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Render
+        shaderLibrary.Poll();
+        if (shadersPending && shaderLibrary.GetNumPending() == 0)
+        {
+            std::cout << "All shader programs ready " << (glfwGetTime() - startupStartTime) * 1000.0 << " ms after startup\n";
+            shadersPending = false;
+        }
 
         glEnable(GL_DEPTH_TEST);
         framebuffer.Bind();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = camera.GetProjectionMatrix();
-        glm::mat4 worldView = view * duckWorldMat;
-        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(worldView)));
-
-        geometryPassShader.Use();
-        geometryPassShader.SetMat4("world", duckWorldMat);
-        geometryPassShader.SetMat4("view", view);
-        geometryPassShader.SetMat4("projection", projection);
-        geometryPassShader.SetMat3("normalMatrixVS", normalMatrix);
-
-        Submesh& mesh = duckMesh.submeshes[0];
-        PBRMaterial& material = scene.materials[mesh.materialIndex];
-
-        geometryPassShader.SetVec4("material.baseColorFactor", material.baseColorFactor);
-        geometryPassShader.SetFloat("material.metallicFactor", material.metallicFactor);
-        geometryPassShader.SetFloat("material.roughnessFactor", material.roughnessFactor);
-        geometryPassShader.SetFloat("material.occlusionStrength", material.occlusionStrength);
-
-        bool hasTextureCoords = HasFlag(mesh.flags, VertexAttribute::TEXCOORD);
-        if (hasTextureCoords)
+        const glm::mat4 viewProjection = camera.GetProjectionMatrix() * camera.GetViewMatrix();
+        visibleEntities.clear();
+        bvh.QueryFrustum(Frustum::FromMatrix(viewProjection), visibleEntities);
+        if (useGpuCulling)
         {
-            int textureUnit = 0;
-
-            glActiveTexture(GL_TEXTURE0 + textureUnit);
-            if (material.baseColorTextureIdx < 0)
-            {
-                glBindTexture(GL_TEXTURE_2D, Texture::White1x1TextureRGBA().id);
-            }
-            else
-            {
-                glBindTexture(GL_TEXTURE_2D, scene.textures[material.baseColorTextureIdx].id);
-            }
-            geometryPassShader.SetInt("material.baseColorTexture", textureUnit);
-            textureUnit++;
-
-            glActiveTexture(GL_TEXTURE0 + textureUnit);
-            if (material.metallicRoughnessTextureIdx < 0)
-            {
-                glBindTexture(GL_TEXTURE_2D, Texture::White1x1TextureRGBA().id);
-            }
-            else
-            {
-                glBindTexture(GL_TEXTURE_2D, scene.textures[material.metallicRoughnessTextureIdx].id);
-            }
-            geometryPassShader.SetInt("material.metallicRoughnessTexture", textureUnit);
-            textureUnit++;
-
-            if (material.normalTextureIdx >= 0)
-            {
-                glActiveTexture(GL_TEXTURE0 + textureUnit);
-                glBindTexture(GL_TEXTURE_2D, scene.textures[material.normalTextureIdx].id);
-                geometryPassShader.SetInt("material.normalTexture", textureUnit);
-                textureUnit++;
-
-                // This uniform variable is only used if tangents (which are synonymous with normal mapping for now)
-                // are provided
-                if (HasFlag(mesh.flags, VertexAttribute::TANGENT))
-                {
-                    geometryPassShader.SetFloat("material.normalScale", material.normalScale);
-                }
-            }
-
-            glActiveTexture(GL_TEXTURE0 + textureUnit);
-            if (material.occlusionTextureIdx < 0)
-            {
-                glBindTexture(GL_TEXTURE_2D, Texture::Max1x1TextureRed().id);
-            }
-            else 
-            {
-                glBindTexture(GL_TEXTURE_2D, scene.textures[material.occlusionTextureIdx].id);
-            }
-            geometryPassShader.SetInt("material.occlusionTexture", textureUnit);
-            textureUnit++;
+            // Only the packets drawn one at a time are left for these
+            renderQueue.Sort(scene, camera, visibleEntities);
         }
-        glBindVertexArray(mesh.VAO);
-        if (mesh.hasIndexBuffer)
+        else
         {
-            glDrawElements(GL_TRIANGLES, mesh.countVerticesOrIndices, GL_UNSIGNED_INT, 0);
+            occlusionCulling.Update(scene, viewProjection, visibleEntities, &jobSystem);
+            renderQueue.Sort(scene, camera, occlusionCulling.GetVisibleEntities());
         }
-        else
+        renderQueue.Submit(scene, camera);
+        if (bakedCrowd)
         {
-            glDrawArrays(GL_TRIANGLES, 0, mesh.countVerticesOrIndices);
+            const std::vector<Submesh>& submeshes = scene.meshes[scene.entities.meshIndices[bakedCrowdEntityIdx]].submeshes;
+            for (int i = 0; i < submeshes.size(); i++)
+            {
+                if (bakedCrowdShaders[i] == nullptr)
+                {
+                    continue;
+                }
+                Shader& shader = *bakedCrowdShaders[i];
+                shader.Use();
+                shader.SetMat4("view", camera.GetViewMatrix());
+                shader.SetMat4("projection", camera.GetProjectionMatrix());
+                RenderQueue::BindMaterial(shader, scene, submeshes[i].materialIndex, submeshes[i].flags);
+                bakedCrowd->Draw(shader, submeshes[i], currentTime, 4);
+            }
         }
 
-
         lightingPassShader.Use();
 
         glm::mat4 dirLightMVP = glm::mat4(1.0f);
@@ -406,4 +552,4 @@ int main(void)
 
     glfwTerminate();
     return 0;
-}
+}
\ No newline at end of file
@@ -11,8 +11,11 @@ struct Submesh
 {
 	// TODO: make one VAO for each vertex layout, not for each submesh
 	GLuint VAO;
+	GLuint VBO; // interleaved in GLTFMeshParser's vertex attribute order
+	GLuint IBO = 0;
 	VertexAttribute flags = VertexAttribute::POSITION;
 	int countVerticesOrIndices;
+	int numVertices;
 	int materialIndex;
 	bool hasIndexBuffer;
 	bool flatShading = false;
@@ -25,5 +28,9 @@ struct Mesh
 		.minXYZ = glm::vec3(FLT_MAX),
 		.maxXYZ = glm::vec3(-FLT_MAX)
 	};
+	// Model space triangles standing in for the mesh in software occlusion culling (see OcclusionCulling), its opaque
+	// submeshes' own triangles. Empty for meshes that can't occlude: skinned, morphed or too detailed to rasterize on the CPU
+	std::vector<glm::vec3> occluderPositions;
+	std::vector<std::uint32_t> occluderIndices;
 	bool HasMorphTargets() const;
 };
\ No newline at end of file
@@ -0,0 +1,363 @@
+#include "OcclusionCulling.h"
+
+#include "BVH.h"
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_CULLING_USE_SSE
+#include <emmintrin.h>
+#endif
+
+static_assert(OcclusionCulling::width % OcclusionCulling::tileSize == 0 && OcclusionCulling::height % OcclusionCulling::tileSize == 0);
+static_assert(OcclusionCulling::tileSize >> (OcclusionCulling::numLevels - 1) == 1, "Tiles own whole texels of every level");
+
+OcclusionCulling::ScreenRect OcclusionCulling::ProjectBox(const BBox& worldBox) const
+{
+	ScreenRect rect{ .minXY = glm::vec2(FLT_MAX), .maxXY = glm::vec2(-FLT_MAX), .maxDepth = 0.0f, .crossesNearPlane = false };
+	for (const glm::vec3& corner : worldBox.GetVertices())
+	{
+		const glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+		if (clip.z < -clip.w)
+		{
+			rect.crossesNearPlane = true;
+			return rect;
+		}
+		const glm::vec2 screen = (glm::vec2(clip.x, clip.y) / clip.w * 0.5f + 0.5f) * glm::vec2(width, height);
+		rect.minXY = glm::min(rect.minXY, screen);
+		rect.maxXY = glm::max(rect.maxXY, screen);
+		// w is linear over the box, so its nearest point is a corner
+		rect.maxDepth = std::max(rect.maxDepth, 1.0f / clip.w);
+	}
+	return rect;
+}
+
+bool OcclusionCulling::IsOccluded(const BBox& worldBox) const
+{
+	if (depthLevels[0].empty())
+	{
+		return false;
+	}
+	const ScreenRect rect = ProjectBox(worldBox);
+	if (rect.crossesNearPlane)
+	{
+		return false;
+	}
+
+	// Every pixel the rectangle touches
+	if (rect.maxXY.x < 0.0f || rect.maxXY.y < 0.0f || rect.minXY.x >= width || rect.minXY.y >= height)
+	{
+		return false;
+	}
+	const int x0 = (int)std::max(rect.minXY.x, 0.0f);
+	const int y0 = (int)std::max(rect.minXY.y, 0.0f);
+	const int x1 = (int)std::min(rect.maxXY.x, width - 1.0f);
+	const int y1 = (int)std::min(rect.maxXY.y, height - 1.0f);
+
+	// The finest level where the rectangle covers at most 4x4 texels
+	int level = 0;
+	while (level < numLevels - 1 && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4))
+	{
+		level++;
+	}
+	const std::vector<float>& depths = depthLevels[level];
+	const int levelWidth = width >> level;
+	for (int y = y0 >> level; y <= y1 >> level; y++)
+	{
+		for (int x = x0 >> level; x <= x1 >> level; x++)
+		{
+			if (depths[y * levelWidth + x] <= rect.maxDepth)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void OcclusionCulling::AddOccluder(const Scene& scene, int entityIdx)
+{
+	const Mesh& mesh = scene.meshes[scene.entities.meshIndices[entityIdx]];
+	const glm::mat4 modelViewProjection = viewProjection * glm::mat4(scene.globalTransforms[entityIdx]);
+	clipVertices.resize(mesh.occluderPositions.size());
+	for (int i = 0; i < (int)mesh.occluderPositions.size(); i++)
+	{
+		clipVertices[i] = modelViewProjection * glm::vec4(mesh.occluderPositions[i], 1.0f);
+	}
+
+	auto addScreenTriangle = [&](const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+	{
+		ScreenTriangle triangle;
+		const glm::vec4* clip[3] = { &a, &b, &c };
+		for (int v = 0; v < 3; v++)
+		{
+			triangle.depths[v] = 1.0f / clip[v]->w;
+			triangle.vertices[v] = (glm::vec2(clip[v]->x, clip[v]->y) * triangle.depths[v] * 0.5f + 0.5f) * glm::vec2(width, height);
+		}
+		// Both faces are drawn, so wind every triangle counterclockwise for the rasterizer's edge functions
+		const glm::vec2 e1 = triangle.vertices[1] - triangle.vertices[0];
+		const glm::vec2 e2 = triangle.vertices[2] - triangle.vertices[0];
+		const float doubleArea = e1.x * e2.y - e1.y * e2.x;
+		if (doubleArea == 0.0f)
+		{
+			return;
+		}
+		if (doubleArea < 0.0f)
+		{
+			std::swap(triangle.vertices[1], triangle.vertices[2]);
+			std::swap(triangle.depths[1], triangle.depths[2]);
+		}
+
+		const glm::vec2 minXY = glm::min(glm::min(triangle.vertices[0], triangle.vertices[1]), triangle.vertices[2]);
+		const glm::vec2 maxXY = glm::max(glm::max(triangle.vertices[0], triangle.vertices[1]), triangle.vertices[2]);
+		if (maxXY.x < 0.0f || maxXY.y < 0.0f || minXY.x >= width || minXY.y >= height)
+		{
+			return;
+		}
+		// Clamped before converting, vertices just past the near plane can be far off screen
+		triangle.minX = (int)std::max(minXY.x, 0.0f);
+		triangle.minY = (int)std::max(minXY.y, 0.0f);
+		triangle.maxX = (int)std::min(maxXY.x, width - 1.0f);
+		triangle.maxY = (int)std::min(maxXY.y, height - 1.0f);
+
+		const int triangleIdx = (int)triangles.size();
+		triangles.push_back(triangle);
+		for (int tileY = triangle.minY / tileSize; tileY <= triangle.maxY / tileSize; tileY++)
+		{
+			for (int tileX = triangle.minX / tileSize; tileX <= triangle.maxX / tileSize; tileX++)
+			{
+				tileTriangles[tileY * numTilesX + tileX].push_back(triangleIdx);
+			}
+		}
+	};
+
+	for (int i = 0; i + 2 < (int)mesh.occluderIndices.size(); i += 3)
+	{
+		const glm::vec4 triangle[3] = { clipVertices[mesh.occluderIndices[i]], clipVertices[mesh.occluderIndices[i + 1]], clipVertices[mesh.occluderIndices[i + 2]] };
+
+		// Clip against the near plane (z >= -w), what the camera doesn't draw mustn't hide anything. A triangle crossing it
+		// becomes a triangle or a quad
+		glm::vec4 clipped[4];
+		int numClipped = 0;
+		for (int v = 0; v < 3; v++)
+		{
+			const glm::vec4& current = triangle[v];
+			const glm::vec4& next = triangle[(v + 1) % 3];
+			const float currentDistance = current.z + current.w;
+			const float nextDistance = next.z + next.w;
+			if (currentDistance >= 0.0f)
+			{
+				clipped[numClipped++] = current;
+			}
+			if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+			{
+				clipped[numClipped++] = current + (next - current) * (currentDistance / (currentDistance - nextDistance));
+			}
+		}
+		for (int v = 2; v < numClipped; v++)
+		{
+			addScreenTriangle(clipped[0], clipped[v - 1], clipped[v]);
+		}
+	}
+}
+
+void OcclusionCulling::RasterizeTile(int tileIdx)
+{
+	const int tileX0 = (tileIdx % numTilesX) * tileSize;
+	const int tileY0 = (tileIdx / numTilesX) * tileSize;
+	float* depths = depthLevels[0].data();
+	for (int y = tileY0; y < tileY0 + tileSize; y++)
+	{
+		std::fill(depths + y * width + tileX0, depths + y * width + tileX0 + tileSize, 0.0f);
+	}
+
+	for (int triangleIdx : tileTriangles[tileIdx])
+	{
+		const ScreenTriangle& triangle = triangles[triangleIdx];
+		const glm::vec2* v = triangle.vertices;
+
+		// Edge i is opposite vertex i, edgeA * x + edgeB * y + edgeC >= 0 inside. They sum to twice the area, each edge's
+		// share is the barycentric weight of its opposite vertex
+		float edgeA[3], edgeB[3], edgeC[3];
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec2& from = v[(i + 1) % 3];
+			const glm::vec2& to = v[(i + 2) % 3];
+			edgeA[i] = from.y - to.y;
+			edgeB[i] = to.x - from.x;
+			edgeC[i] = -(edgeA[i] * from.x + edgeB[i] * from.y);
+		}
+		const float inverseDoubleArea = 1.0f / ((v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x));
+		// Depth as a plane over the screen
+		float depthA = 0.0f, depthB = 0.0f, depthC = 0.0f;
+		for (int i = 0; i < 3; i++)
+		{
+			depthA += edgeA[i] * triangle.depths[i] * inverseDoubleArea;
+			depthB += edgeB[i] * triangle.depths[i] * inverseDoubleArea;
+			depthC += edgeC[i] * triangle.depths[i] * inverseDoubleArea;
+		}
+
+		// Rows and groups of 4 columns of the tile under the triangle's bounds
+		const int x0 = std::max(tileX0, triangle.minX) & ~3;
+		const int y0 = std::max(tileY0, triangle.minY);
+		const int x1 = std::min(tileX0 + tileSize - 1, triangle.maxX);
+		const int y1 = std::min(tileY0 + tileSize - 1, triangle.maxY);
+
+#ifdef OCCLUSION_CULLING_USE_SSE
+		const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		for (int y = y0; y <= y1; y++)
+		{
+			const float pixelY = y + 0.5f;
+			const __m128 rowEdge0 = _mm_set1_ps(edgeB[0] * pixelY + edgeC[0]);
+			const __m128 rowEdge1 = _mm_set1_ps(edgeB[1] * pixelY + edgeC[1]);
+			const __m128 rowEdge2 = _mm_set1_ps(edgeB[2] * pixelY + edgeC[2]);
+			const __m128 rowDepth = _mm_set1_ps(depthB * pixelY + depthC);
+			for (int x = x0; x <= x1; x += 4)
+			{
+				const __m128 pixelX = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+				const __m128 edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), pixelX), rowEdge0);
+				const __m128 edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), pixelX), rowEdge1);
+				const __m128 edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), pixelX), rowEdge2);
+				// The sign bit is set where any edge is negative, flipped and spread over the lane it's the coverage mask
+				const __m128 anyNegative = _mm_or_ps(_mm_or_ps(edge0, edge1), edge2);
+				const __m128 inside = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(_mm_xor_ps(anyNegative, _mm_set1_ps(-0.0f))), 31));
+				if (_mm_movemask_ps(inside) == 0)
+				{
+					continue;
+				}
+				const __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthA), pixelX), rowDepth);
+				float* pixels = depths + y * width + x;
+				const __m128 previous = _mm_loadu_ps(pixels);
+				const __m128 nearest = _mm_max_ps(previous, depth);
+				_mm_storeu_ps(pixels, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, previous)));
+			}
+		}
+#else
+		for (int y = y0; y <= y1; y++)
+		{
+			const float pixelY = y + 0.5f;
+			for (int x = x0; x <= x1; x++)
+			{
+				const float pixelX = x + 0.5f;
+				bool inside = true;
+				for (int i = 0; i < 3; i++)
+				{
+					inside = inside && edgeA[i] * pixelX + edgeB[i] * pixelY + edgeC[i] >= 0.0f;
+				}
+				if (inside)
+				{
+					float& pixel = depths[y * width + x];
+					pixel = std::max(pixel, depthA * pixelX + depthB * pixelY + depthC);
+				}
+			}
+		}
+#endif
+	}
+
+	// The tile's part of each level, from the level below
+	for (int level = 1; level < numLevels; level++)
+	{
+		const std::vector<float>& below = depthLevels[level - 1];
+		std::vector<float>& current = depthLevels[level];
+		const int belowWidth = width >> (level - 1);
+		const int levelWidth = width >> level;
+		const int levelTileSize = tileSize >> level;
+		for (int y = tileY0 >> level; y < (tileY0 >> level) + levelTileSize; y++)
+		{
+			for (int x = tileX0 >> level; x < (tileX0 >> level) + levelTileSize; x++)
+			{
+				const float* texels = &below[2 * y * belowWidth + 2 * x];
+				current[y * levelWidth + x] = std::min(std::min(texels[0], texels[1]), std::min(texels[belowWidth], texels[belowWidth + 1]));
+			}
+		}
+	}
+}
+
+void OcclusionCulling::Update(const Scene& scene, const glm::mat4& viewProjection, std::span<const int> candidates, JobSystem* jobSystem)
+{
+	this->viewProjection = viewProjection;
+	for (int level = 0; level < numLevels; level++)
+	{
+		depthLevels[level].resize((width >> level) * (height >> level));
+	}
+
+	// The biggest candidates on screen that can occlude, a box crossing the near plane covers it all
+	constexpr float screenArea = (float)(width * height);
+	occluderCandidates.clear();
+	for (int entityIdx : candidates)
+	{
+		const Mesh& mesh = scene.meshes[scene.entities.meshIndices[entityIdx]];
+		// Only the first copy of an instanced mesh would be rasterized
+		if (mesh.occluderIndices.empty() || scene.entities.meshInstanceSetIndices[entityIdx] >= 0)
+		{
+			continue;
+		}
+		const ScreenRect rect = ProjectBox(TransformBox(mesh.boundingBox, scene.globalTransforms[entityIdx]));
+		const glm::vec2 size = glm::clamp(rect.maxXY, glm::vec2(0.0f), glm::vec2(width, height)) - glm::clamp(rect.minXY, glm::vec2(0.0f), glm::vec2(width, height));
+		const float area = rect.crossesNearPlane ? screenArea : std::max(size.x, 0.0f) * std::max(size.y, 0.0f);
+		if (area >= minOccluderScreenFraction * screenArea)
+		{
+			occluderCandidates.emplace_back(area, entityIdx);
+		}
+	}
+	const int numOccluders = std::min((int)occluderCandidates.size(), maxOccluders);
+	std::partial_sort(occluderCandidates.begin(), occluderCandidates.begin() + numOccluders, occluderCandidates.end(),
+		[](const auto& a, const auto& b) { return a.first > b.first; });
+
+	occluders.clear();
+	triangles.clear();
+	for (std::vector<int>& bin : tileTriangles)
+	{
+		bin.clear();
+	}
+	for (int i = 0; i < numOccluders; i++)
+	{
+		occluders.push_back(occluderCandidates[i].second);
+		AddOccluder(scene, occluderCandidates[i].second);
+	}
+
+	auto rasterizeTiles = [this](int begin, int end)
+	{
+		for (int tileIdx = begin; tileIdx < end; tileIdx++)
+		{
+			RasterizeTile(tileIdx);
+		}
+	};
+	if (jobSystem != nullptr)
+	{
+		jobSystem->ParallelFor(numTilesX * numTilesY, 1, rasterizeTiles);
+	}
+	else
+	{
+		rasterizeTiles(0, numTilesX * numTilesY);
+	}
+
+	numCandidates = (int)candidates.size();
+	candidateVisible.resize(candidates.size());
+	auto testCandidates = [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const int entityIdx = candidates[i];
+			const BBox worldBox = TransformBox(scene.GetModelBounds(entityIdx), scene.globalTransforms[entityIdx]);
+			candidateVisible[i] = !IsOccluded(worldBox);
+		}
+	};
+	if (jobSystem != nullptr && candidates.size() > 1024)
+	{
+		jobSystem->ParallelFor((int)candidates.size(), 1024, testCandidates);
+	}
+	else
+	{
+		testCandidates(0, (int)candidates.size());
+	}
+
+	visibleEntities.clear();
+	for (int i = 0; i < (int)candidates.size(); i++)
+	{
+		if (candidateVisible[i])
+		{
+			visibleEntities.push_back(candidates[i]);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Scene.h"
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+// Software rasterized occlusion culling, so it needs no GPU readback and behaves the same headless. Each frame Update
+// rasterizes the candidates that cover the most screen among those whose mesh has occluder triangles
+// (Mesh::occluderPositions) into a small depth buffer, then tests every candidate's world bounding box against a min-depth
+// hierarchy built from it.
+//
+// Depth is 1/w, which interpolates linearly in screen space and grows towards the camera (so a perspective projection is
+// assumed): 0 is the cleared, infinitely far value, a pixel keeps the max of the triangles covering it and each hierarchy
+// level keeps the min, the farthest, of the 2x2 texels below it. A box is occluded when its nearest corner is farther than
+// every texel under its screen rectangle. Coverage is sampled at pixel centers, so something peeking out from behind an
+// occluder by less than a pixel can be culled. Triangles are binned to tiles that the job system rasterizes in parallel, 4
+// pixels at a time with SSE when compiled for it, and every tile also builds its part of the hierarchy since tiles are
+// aligned to its coarsest level
+class OcclusionCulling
+{
+public:
+	static constexpr int width = 256;
+	static constexpr int height = 128;
+	static constexpr int tileSize = 32;
+	static constexpr int numTilesX = width / tileSize;
+	static constexpr int numTilesY = height / tileSize;
+	static constexpr int numLevels = 6; // 256x128 down to 8x4, one texel per tile
+	static constexpr int maxOccluders = 64;
+	static constexpr float minOccluderScreenFraction = 1.0f / 64.0f; // of the depth buffer's area, by bounding rectangle
+
+	// After TransformSystem::Update. candidates are the entities to test, typically the frustum culled ones, and also the
+	// ones occluders are picked from
+	void Update(const Scene& scene, const glm::mat4& viewProjection, std::span<const int> candidates, JobSystem* jobSystem = nullptr);
+
+	// The candidates that weren't occluded, in candidate order
+	std::span<const int> GetVisibleEntities() const { return visibleEntities; }
+	int GetNumOccluded() const { return numCandidates - (int)visibleEntities.size(); }
+	int GetNumOccluders() const { return (int)occluders.size(); }
+	int GetNumOccluderTriangles() const { return (int)triangles.size(); }
+
+	// Against the last Update's depth buffer
+	bool IsOccluded(const BBox& worldBox) const;
+	// Level 0 is the full resolution buffer, each further one half as wide and high, row major from the bottom row
+	std::span<const float> GetDepthLevel(int level) const { return depthLevels[level]; }
+
+private:
+	// In pixels, with y up
+	struct ScreenTriangle
+	{
+		glm::vec2 vertices[3];
+		float depths[3]; // 1/w
+		int minX, minY, maxX, maxY; // pixels under its bounds, on screen
+	};
+
+	struct ScreenRect
+	{
+		glm::vec2 minXY, maxXY;
+		float maxDepth; // of the nearest corner
+		bool crossesNearPlane;
+	};
+
+	ScreenRect ProjectBox(const BBox& worldBox) const;
+	void AddOccluder(const Scene& scene, int entityIdx);
+	void RasterizeTile(int tileIdx);
+
+	glm::mat4 viewProjection;
+	std::vector<float> depthLevels[numLevels];
+	std::vector<int> occluders; // entity indices
+	std::vector<std::pair<float, int>> occluderCandidates; // scratch, screen area and entity index
+	std::vector<glm::vec4> clipVertices; // scratch
+	std::vector<ScreenTriangle> triangles;
+	std::vector<int> tileTriangles[numTilesX * numTilesY]; // indices into triangles
+	std::vector<std::uint8_t> candidateVisible; // scratch
+	std::vector<int> visibleEntities;
+	int numCandidates = 0;
+};
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "PoseCache.h"
+
+void PoseCache::BeginFrame()
+{
+	for (auto iter = entries.begin(); iter != entries.end();)
+	{
+		if (iter->second.lastUsedFrame != frame)
+		{
+			freeSlots.push_back(iter->second.slot);
+			iter = entries.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	frame++;
+	frameHits = 0;
+	frameMisses = 0;
+}
+
+int PoseCache::Acquire(const PoseKey& key, bool& outNeedsCompute)
+{
+	auto [iter, inserted] = entries.try_emplace(key, Entry{ -1, frame });
+	Entry& entry = iter->second;
+	outNeedsCompute = inserted;
+	if (inserted)
+	{
+		if (!freeSlots.empty())
+		{
+			entry.slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			entry.slot = numSlots++;
+		}
+		frameMisses++;
+	}
+	else
+	{
+		frameHits++;
+	}
+	entry.lastUsedFrame = frame;
+	return entry.slot;
+}
\ No newline at end of file
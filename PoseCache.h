@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// A pose is fully determined by the clip, the joint layout it's played on and the playback time. Time is quantized so that
+// instances playing at nearly the same time share the pose
+struct PoseKey
+{
+	int animationIdx;
+	std::uint64_t layoutHash; // Skeleton::layoutHash
+	int timeBucket;
+
+	bool operator==(const PoseKey& other) const = default;
+};
+
+struct PoseKeyHash
+{
+	std::size_t operator()(const PoseKey& key) const
+	{
+		std::uint64_t hash = key.layoutHash ^ ((std::uint64_t)(std::uint32_t)key.animationIdx * 0x9E3779B97F4A7C15ull);
+		hash ^= (std::uint64_t)(std::uint32_t)key.timeBucket * 0xC2B2AE3D27D4EB4Full;
+		return (std::size_t)(hash ^ (hash >> 29));
+	}
+};
+
+// Hands out a slot per distinct pose requested during a frame. A pose requested again on the next frame keeps its slot and
+// doesn't have to be recomputed, poses not requested for a whole frame are evicted and their slots reused
+class PoseCache
+{
+public:
+	explicit PoseCache(float timeQuantumSeconds = 1.0f / 60.0f) : timeQuantumSeconds(timeQuantumSeconds) {}
+
+	void BeginFrame();
+	// outNeedsCompute is set if the slot's pose has to be (re)computed
+	int Acquire(const PoseKey& key, bool& outNeedsCompute);
+
+	int TimeToBucket(float timeSeconds) const { return (int)(timeSeconds / timeQuantumSeconds); }
+	// All instances in a bucket are sampled at its center, so they get bit-identical poses at most half a quantum off
+	float BucketToTime(int timeBucket) const { return (timeBucket + 0.5f) * timeQuantumSeconds; }
+
+	int GetNumSlots() const { return numSlots; }
+	int GetNumPoses() const { return (int)entries.size(); }
+	int GetFrameHits() const { return frameHits; }
+	int GetFrameMisses() const { return frameMisses; }
+
+private:
+	struct Entry
+	{
+		int slot;
+		std::uint32_t lastUsedFrame;
+	};
+
+	float timeQuantumSeconds;
+	std::unordered_map<PoseKey, Entry, PoseKeyHash> entries;
+	std::vector<int> freeSlots;
+	int numSlots = 0;
+	std::uint32_t frame = 0;
+	int frameHits = 0;
+	int frameMisses = 0;
+};
\ No newline at end of file
@@ -0,0 +1,825 @@
+#include "RenderQueue.h"
+#include "GLTFMeshParser.h"
+#include "GpuCulling.h"
+
+#include <algorithm>
+#include <array>
+#include <glm/glm.hpp>
+#include <string>
+
+void RadixSortDrawItems(std::vector<DrawSortItem>& items, std::vector<DrawSortItem>& scratch)
+{
+	const int n = (int)items.size();
+	if (n < 2)
+	{
+		return;
+	}
+
+	std::array<std::array<std::uint32_t, 256>, 8> histograms = {};
+	for (const DrawSortItem& item : items)
+	{
+		for (int pass = 0; pass < 8; pass++)
+		{
+			histograms[pass][(item.key >> (pass * 8)) & 0xFF]++;
+		}
+	}
+
+	scratch.resize(n);
+	for (int pass = 0; pass < 8; pass++)
+	{
+		std::array<std::uint32_t, 256>& histogram = histograms[pass];
+		const int shift = pass * 8;
+		if (histogram[(items[0].key >> shift) & 0xFF] == n)
+		{
+			continue;
+		}
+
+		std::uint32_t offset = 0;
+		for (std::uint32_t& count : histogram)
+		{
+			const std::uint32_t bucketSize = count;
+			count = offset;
+			offset += bucketSize;
+		}
+		for (const DrawSortItem& item : items)
+		{
+			scratch[histogram[(item.key >> shift) & 0xFF]++] = item;
+		}
+		items.swap(scratch);
+	}
+}
+
+// glTF's defaults for primitives without a material
+static const PBRMaterial defaultMaterial{
+	.baseColorFactor = glm::vec4(1.0f),
+	.baseColorTextureIdx = -1,
+	.metallicFactor = 1.0f,
+	.roughnessFactor = 1.0f,
+	.metallicRoughnessTextureIdx = -1,
+	.normalTextureIdx = -1,
+	.normalScale = 1.0f,
+	.occlusionStrength = 1.0f,
+	.occlusionTextureIdx = -1
+};
+
+std::vector<std::string> RenderQueue::GetGeometryPassDefines(VertexAttribute flags, bool flatShading)
+{
+	std::vector<std::string> defines;
+
+	if (HasFlag(flags, VertexAttribute::TEXCOORD))
+	{
+		defines.emplace_back("HAS_TEXCOORD");
+	}
+	if (HasFlag(flags, VertexAttribute::NORMAL))
+	{
+		defines.emplace_back("HAS_NORMALS");
+	}
+	if (HasFlag(flags, VertexAttribute::JOINTS))
+	{
+		defines.emplace_back("HAS_JOINTS");
+	}
+	if (HasFlag(flags, VertexAttribute::MORPH_TARGET0_POSITION))
+	{
+		defines.emplace_back("HAS_MORPH_TARGETS");
+	}
+	if (flatShading)
+	{
+		defines.emplace_back("FLAT_SHADING");
+	}
+	if (HasFlag(flags, VertexAttribute::TANGENT))
+	{
+		defines.emplace_back("HAS_TANGENTS");
+	}
+	if (HasFlag(flags, VertexAttribute::COLOR))
+	{
+		defines.emplace_back("HAS_VERTEX_COLORS");
+	}
+
+	return defines;
+}
+
+int RenderQueue::GetShaderIdx(VertexAttribute flags, bool flatShading, bool multiDraw, bool meshInstancing)
+{
+	const VertexAttribute variantFlags = flags & (VertexAttribute::TEXCOORD | VertexAttribute::NORMAL | VertexAttribute::JOINTS |
+		VertexAttribute::MORPH_TARGET0_POSITION | VertexAttribute::TANGENT | VertexAttribute::COLOR);
+	// Flat shading, multi-draw and mesh instancing go in bits no attribute uses
+	const std::uint32_t key = (std::uint32_t)variantFlags | (flatShading ? 1u << 31 : 0u) | (multiDraw ? 1u << 30 : 0u) |
+		(meshInstancing ? 1u << 29 : 0u);
+	auto iter = shaderIndices.find(key);
+	if (iter != shaderIndices.end())
+	{
+		return iter->second;
+	}
+
+	std::vector<std::string> defines = GetGeometryPassDefines(variantFlags, flatShading);
+	if (multiDraw)
+	{
+		defines.emplace_back("MULTI_DRAW_INDIRECT");
+	}
+	if (meshInstancing)
+	{
+		defines.emplace_back("MESH_INSTANCING");
+	}
+	ShaderVariant variant{ .flags = variantFlags };
+	if (asyncShaderCompilation)
+	{
+		variant.shader = &shaderLibrary.GetAsync("Shaders/geometryPass.vert", "Shaders/geometryPass.frag", defines);
+		variant.fallbackIdx = GetFallbackShaderIdx(multiDraw, meshInstancing);
+	}
+	else
+	{
+		variant.shader = &shaderLibrary.Get("Shaders/geometryPass.vert", "Shaders/geometryPass.frag", defines);
+		variant.fallbackIdx = (int)shaders.size();
+	}
+	const int shaderIdx = (int)shaders.size();
+	shaders.push_back(variant);
+	shaderIndices.emplace(key, shaderIdx);
+	return shaderIdx;
+}
+
+int RenderQueue::GetFallbackShaderIdx(bool multiDraw, bool meshInstancing)
+{
+	// In a bit of its own, so a packet asking for the same defines still gets a variant that may be pending
+	const std::uint32_t key = (1u << 28) | (multiDraw ? 1u << 30 : 0u) | (meshInstancing ? 1u << 29 : 0u);
+	auto iter = shaderIndices.find(key);
+	if (iter != shaderIndices.end())
+	{
+		return iter->second;
+	}
+
+	std::vector<std::string> defines = GetGeometryPassDefines(VertexAttribute{}, true);
+	if (multiDraw)
+	{
+		defines.emplace_back("MULTI_DRAW_INDIRECT");
+	}
+	if (meshInstancing)
+	{
+		defines.emplace_back("MESH_INSTANCING");
+	}
+	const int shaderIdx = (int)shaders.size();
+	shaders.push_back({ &shaderLibrary.Get("Shaders/geometryPass.vert", "Shaders/geometryPass.frag", defines), VertexAttribute{}, shaderIdx });
+	shaderIndices.emplace(key, shaderIdx);
+	return shaderIdx;
+}
+
+RenderQueue::~RenderQueue()
+{
+	Clear();
+	if (indirectBuffer != 0)
+	{
+		glDeleteBuffers(1, &indirectBuffer);
+		glDeleteBuffers(1, &drawDataBuffer);
+	}
+}
+
+void RenderQueue::Clear()
+{
+	for (MultiDrawBatch& batch : batches)
+	{
+		glDeleteVertexArrays(1, &batch.VAO);
+		glDeleteBuffers(1, &batch.VBO);
+		glDeleteBuffers(1, &batch.IBO);
+	}
+	batches.clear();
+	if (drawIndexBuffer != 0)
+	{
+		glDeleteBuffers(1, &drawIndexBuffer);
+		drawIndexBuffer = 0;
+	}
+	if (meshInstanceBuffer != 0)
+	{
+		glDeleteBuffers(1, &meshInstanceBuffer);
+		meshInstanceBuffer = 0;
+	}
+	meshInstanceOffsets.clear();
+	packets.clear();
+	layoutIndices.clear();
+	entityFirstPackets.clear();
+	gpuCommandPackets.clear();
+	packetGpuSlots.clear();
+	gpuMorphedSlots.clear();
+	gpuRuns.clear();
+	gpuDrawData.clear();
+	if (gpuDrawDataBuffer != 0)
+	{
+		glDeleteBuffers(1, &gpuDrawDataBuffer);
+		gpuDrawDataBuffer = 0;
+	}
+}
+
+void RenderQueue::Build(const Scene& scene, const AnimatedSubmeshLookup& animatedSubmeshes)
+{
+	Clear();
+
+	// A source submesh's place in its batch, shared by every entity drawing it
+	struct BatchRange
+	{
+		int batchIdx;
+		GLuint firstIndex;
+		GLint baseVertex;
+		const Submesh* source;
+	};
+	std::vector<BatchRange> batchRanges;
+	std::unordered_map<std::uint64_t, int> batchRangeIndices; // by mesh and submesh index
+	std::unordered_map<std::uint32_t, int> batchIndices; // by vertex layout
+
+	const EntityStorage& entities = scene.entities;
+	entityFirstPackets.resize(entities.Size() + 1);
+	for (int entityIdx = 0; entityIdx < entities.Size(); entityIdx++)
+	{
+		entityFirstPackets[entityIdx] = (int)packets.size();
+		const int meshIdx = entities.meshIndices[entityIdx];
+		if (!entities.alive[entityIdx] || meshIdx < 0)
+		{
+			continue;
+		}
+
+		const Mesh& mesh = scene.meshes[meshIdx];
+		for (int submeshIdx = 0; submeshIdx < mesh.submeshes.size(); submeshIdx++)
+		{
+			DrawPacket packet;
+			packet.entityIdx = entityIdx;
+			const Submesh* animated = animatedSubmeshes ? animatedSubmeshes(entityIdx, submeshIdx) : nullptr;
+			packet.submesh = animated != nullptr ? *animated : mesh.submeshes[submeshIdx];
+			// Joints without a skinning output (or skeleton) would need a palette, draw those in their bind pose instead
+			const VertexAttribute flags = packet.submesh.flags & ~VertexAttribute::JOINTS;
+			packet.morphed = HasFlag(flags, VertexAttribute::MORPH_TARGET0_POSITION);
+			packet.meshInstanceSetIdx = entities.meshInstanceSetIndices[entityIdx];
+			packet.multiDraw = animated == nullptr && packet.meshInstanceSetIdx < 0;
+			packet.shaderIdx = GetShaderIdx(flags, packet.submesh.flatShading, packet.multiDraw, packet.meshInstanceSetIdx >= 0);
+			packet.firstIndex = 0;
+			packet.baseVertex = 0;
+			packet.boundsCenter = scene.GetModelBounds(entityIdx).GetCenter();
+
+			int rangeIdx = -1;
+			if (packet.multiDraw)
+			{
+				auto [rangeIter, newRange] = batchRangeIndices.emplace(((std::uint64_t)meshIdx << 32) | (std::uint32_t)submeshIdx, (int)batchRanges.size());
+				if (newRange)
+				{
+					auto [batchIter, newBatch] = batchIndices.emplace((std::uint32_t)packet.submesh.flags, (int)batches.size());
+					if (newBatch)
+					{
+						batches.emplace_back().flags = packet.submesh.flags;
+					}
+					MultiDrawBatch& batch = batches[batchIter->second];
+					batchRanges.push_back({ batchIter->second, (GLuint)batch.numIndices, batch.numVertices, &mesh.submeshes[submeshIdx] });
+					batch.numVertices += packet.submesh.numVertices;
+					batch.numIndices += packet.submesh.countVerticesOrIndices;
+				}
+				rangeIdx = rangeIter->second;
+			}
+			packet.batchRangeIdx = rangeIdx;
+			packets.push_back(packet);
+		}
+	}
+	entityFirstPackets[entities.Size()] = (int)packets.size();
+
+	// Every instance set's transforms as 3 matrix rows each followed by 3 rows of their normal matrices, uploaded once
+	if (!scene.meshInstanceSets.empty())
+	{
+		std::vector<glm::vec4> instanceRows;
+		for (const MeshInstanceSet& instanceSet : scene.meshInstanceSets)
+		{
+			meshInstanceOffsets.push_back((GLuint)(instanceRows.size() / 6));
+			for (const glm::mat4x3& transform : instanceSet.localTransforms)
+			{
+				for (int r = 0; r < 3; r++)
+				{
+					instanceRows.emplace_back(transform[0][r], transform[1][r], transform[2][r], transform[3][r]);
+				}
+				const glm::mat3 normalMatrix = ComputeSkinningNormalMatrix(transform);
+				for (int r = 0; r < 3; r++)
+				{
+					instanceRows.emplace_back(normalMatrix[0][r], normalMatrix[1][r], normalMatrix[2][r], 0.0f);
+				}
+			}
+		}
+		glGenBuffers(1, &meshInstanceBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshInstanceBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, instanceRows.size() * sizeof(glm::vec4), instanceRows.data(), GL_STATIC_DRAW);
+	}
+
+	if (!batches.empty())
+	{
+		// Identity, each command's baseInstance offsets it to the command's DrawData
+		std::vector<GLuint> drawIndices(packets.size());
+		for (int i = 0; i < drawIndices.size(); i++)
+		{
+			drawIndices[i] = i;
+		}
+		glGenBuffers(1, &drawIndexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, drawIndices.size() * sizeof(GLuint), drawIndices.data(), GL_STATIC_DRAW);
+
+		if (indirectBuffer == 0)
+		{
+			glGenBuffers(1, &indirectBuffer);
+			glGenBuffers(1, &drawDataBuffer);
+		}
+	}
+
+	for (MultiDrawBatch& batch : batches)
+	{
+		glGenVertexArrays(1, &batch.VAO);
+		glBindVertexArray(batch.VAO);
+
+		glGenBuffers(1, &batch.VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, batch.VBO);
+		glBufferData(GL_ARRAY_BUFFER, batch.numVertices * GLTFMeshParser::GetVertexSizeBytes(batch.flags), nullptr, GL_STATIC_DRAW);
+		GLTFMeshParser::SetupVertexAttributes(batch.flags);
+
+		glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		glEnableVertexAttribArray(drawIndexLocation);
+		glVertexAttribIPointer(drawIndexLocation, 1, GL_UNSIGNED_INT, sizeof(GLuint), (const void*)0);
+		glVertexAttribDivisor(drawIndexLocation, 1);
+
+		glGenBuffers(1, &batch.IBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.IBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, batch.numIndices * sizeof(GLuint), nullptr, GL_STATIC_DRAW);
+	}
+	glBindVertexArray(0);
+
+	// Copied on the GPU, the source buffers stay as they are for anything else drawing or reading them
+	std::vector<GLuint> generatedIndices;
+	for (const BatchRange& range : batchRanges)
+	{
+		const MultiDrawBatch& batch = batches[range.batchIdx];
+		const Submesh& source = *range.source;
+		const int vertexSizeBytes = GLTFMeshParser::GetVertexSizeBytes(batch.flags);
+		glBindBuffer(GL_COPY_READ_BUFFER, source.VBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, batch.VBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, range.baseVertex * vertexSizeBytes, source.numVertices * vertexSizeBytes);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, batch.IBO);
+		if (source.hasIndexBuffer)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, source.IBO);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, range.firstIndex * sizeof(GLuint), source.countVerticesOrIndices * sizeof(GLuint));
+		}
+		else
+		{
+			// Indirect draws are indexed, non-indexed submeshes get 0, 1, 2, ...
+			generatedIndices.resize(source.countVerticesOrIndices);
+			for (int i = 0; i < generatedIndices.size(); i++)
+			{
+				generatedIndices[i] = i;
+			}
+			glBufferSubData(GL_COPY_WRITE_BUFFER, range.firstIndex * sizeof(GLuint), generatedIndices.size() * sizeof(GLuint), generatedIndices.data());
+		}
+	}
+
+	rangeCommands.assign(batchRanges.size(), -1);
+	for (DrawPacket& packet : packets)
+	{
+		if (packet.batchRangeIdx >= 0)
+		{
+			const BatchRange& range = batchRanges[packet.batchRangeIdx];
+			packet.submesh.VAO = batches[range.batchIdx].VAO;
+			packet.firstIndex = range.firstIndex;
+			packet.baseVertex = range.baseVertex;
+		}
+		packet.layoutIdx = layoutIndices.emplace(packet.submesh.VAO, (int)layoutIndices.size()).first->second;
+	}
+
+	if (gpuCulling != nullptr)
+	{
+		BuildGpuRuns(scene);
+	}
+}
+
+void RenderQueue::BuildGpuRuns(const Scene& scene)
+{
+	// Ordered like Sort's keys minus depth, which the GPU doesn't sort by
+	for (int i = 0; i < packets.size(); i++)
+	{
+		if (packets[i].multiDraw)
+		{
+			gpuCommandPackets.push_back(i);
+		}
+	}
+	const auto stateKey = [&](int packetIdx)
+	{
+		const DrawPacket& packet = packets[packetIdx];
+		return MakeSortKey(RenderPass::Geometry, packet.shaderIdx, packet.layoutIdx, packet.submesh.materialIndex + 1, 0);
+	};
+	std::stable_sort(gpuCommandPackets.begin(), gpuCommandPackets.end(), [&](int a, int b) { return stateKey(a) < stateKey(b); });
+
+	std::vector<DrawElementsIndirectCommand> commands(gpuCommandPackets.size());
+	std::vector<BBox> modelBounds(gpuCommandPackets.size());
+	std::vector<int> commandRuns(gpuCommandPackets.size());
+	packetGpuSlots.assign(packets.size(), -1);
+	gpuDrawData.resize(gpuCommandPackets.size());
+	for (int i = 0; i < gpuCommandPackets.size(); i++)
+	{
+		const DrawPacket& packet = packets[gpuCommandPackets[i]];
+		packetGpuSlots[gpuCommandPackets[i]] = i;
+		gpuDrawData[i] = MakeDrawData(scene, packet);
+		if (packet.morphed)
+		{
+			gpuMorphedSlots.push_back(i);
+		}
+		if (i == 0 || stateKey(gpuCommandPackets[i]) != stateKey(gpuCommandPackets[i - 1]))
+		{
+			gpuRuns.push_back({ i, 0, gpuCommandPackets[i] });
+		}
+		gpuRuns.back().numCommands++;
+
+		// The draw data is in slot order, so each command's baseInstance is its slot
+		commands[i] = {
+			.count = (GLuint)packet.submesh.countVerticesOrIndices,
+			.instanceCount = 1,
+			.firstIndex = packet.firstIndex,
+			.baseVertex = packet.baseVertex,
+			.baseInstance = (GLuint)i
+		};
+		modelBounds[i] = scene.meshes[scene.entities.meshIndices[packet.entityIdx]].boundingBox;
+		commandRuns[i] = (int)gpuRuns.size() - 1;
+	}
+	gpuCulling->Build(commands, modelBounds, commandRuns);
+
+	if (!gpuDrawData.empty())
+	{
+		glGenBuffers(1, &gpuDrawDataBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuDrawDataBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, gpuDrawData.size() * sizeof(DrawData), gpuDrawData.data(), GL_DYNAMIC_DRAW);
+	}
+}
+
+void RenderQueue::UpdateGpuDrawData(const Scene& scene, std::span<const int> movedEntities)
+{
+	if (gpuDrawData.empty())
+	{
+		return;
+	}
+
+	dirtyGpuSlots.clear();
+	for (int entityIdx : movedEntities)
+	{
+		// Entities created since Build have no packets
+		if (entityIdx + 1 >= entityFirstPackets.size())
+		{
+			continue;
+		}
+		for (int i = entityFirstPackets[entityIdx]; i < entityFirstPackets[entityIdx + 1]; i++)
+		{
+			if (packetGpuSlots[i] >= 0)
+			{
+				gpuDrawData[packetGpuSlots[i]] = MakeDrawData(scene, packets[i]);
+				dirtyGpuSlots.push_back(packetGpuSlots[i]);
+			}
+		}
+	}
+	for (int slot : gpuMorphedSlots)
+	{
+		std::span<const float> weights = scene.entities.GetMorphTargetWeights(packets[gpuCommandPackets[slot]].entityIdx);
+		DrawData& draw = gpuDrawData[slot];
+		const float weight0 = weights.size() > 0 ? weights[0] : 0.0f;
+		const float weight1 = weights.size() > 1 ? weights[1] : 0.0f;
+		if (draw.normalRows[0].w != weight0 || draw.normalRows[1].w != weight1)
+		{
+			draw.normalRows[0].w = weight0;
+			draw.normalRows[1].w = weight1;
+			dirtyGpuSlots.push_back(slot);
+		}
+	}
+	if (dirtyGpuSlots.empty())
+	{
+		return;
+	}
+
+	// One upload per run of consecutive dirty slots
+	std::sort(dirtyGpuSlots.begin(), dirtyGpuSlots.end());
+	dirtyGpuSlots.erase(std::unique(dirtyGpuSlots.begin(), dirtyGpuSlots.end()), dirtyGpuSlots.end());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuDrawDataBuffer);
+	for (int i = 0; i < dirtyGpuSlots.size();)
+	{
+		int end = i + 1;
+		while (end < dirtyGpuSlots.size() && dirtyGpuSlots[end] == dirtyGpuSlots[end - 1] + 1)
+		{
+			end++;
+		}
+		const int first = dirtyGpuSlots[i];
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(DrawData), (end - i) * sizeof(DrawData), &gpuDrawData[first]);
+		i = end;
+	}
+}
+
+void RenderQueue::Sort(const Scene& scene, const Camera& camera, std::span<const int> visibleEntities)
+{
+	const glm::mat4 view = camera.GetViewMatrix();
+	const float depthScale = ((1u << depthBits) - 1) / (camera.far - camera.near);
+
+	sortItems.clear();
+	for (int entityIdx : visibleEntities)
+	{
+		for (int i = entityFirstPackets[entityIdx]; i < entityFirstPackets[entityIdx + 1]; i++)
+		{
+			const DrawPacket& packet = packets[i];
+			if (packet.multiDraw && gpuCulling != nullptr)
+			{
+				continue;
+			}
+			const glm::vec3 centerWS = scene.globalTransforms[packet.entityIdx] * glm::vec4(packet.boundsCenter, 1.0f);
+			const float viewDepth = -(view * glm::vec4(centerWS, 1.0f)).z;
+			const float quantizedDepth = std::clamp((viewDepth - camera.near) * depthScale, 0.0f, (float)((1u << depthBits) - 1));
+			// Material index + 1 so submeshes without a material (-1) fit
+			const std::uint64_t key = MakeSortKey(RenderPass::Geometry, packet.shaderIdx, packet.layoutIdx, packet.submesh.materialIndex + 1,
+				(std::uint32_t)quantizedDepth);
+			sortItems.push_back({ key, (std::uint32_t)i });
+		}
+	}
+	RadixSortDrawItems(sortItems, sortScratch);
+}
+
+void RenderQueue::BindMaterial(Shader& shader, const Scene& scene, int materialIdx, VertexAttribute flags)
+{
+	const PBRMaterial& material = materialIdx >= 0 ? scene.materials[materialIdx] : defaultMaterial;
+	shader.SetVec4("material.baseColorFactor", material.baseColorFactor);
+	shader.SetFloat("material.metallicFactor", material.metallicFactor);
+	shader.SetFloat("material.roughnessFactor", material.roughnessFactor);
+	shader.SetFloat("material.occlusionStrength", material.occlusionStrength);
+
+	if (!HasFlag(flags, VertexAttribute::TEXCOORD))
+	{
+		return;
+	}
+
+	int textureUnit = 0;
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	if (material.baseColorTextureIdx < 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, Texture::White1x1TextureRGBA().id);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, scene.textures[material.baseColorTextureIdx].id);
+	}
+	shader.SetInt("material.baseColorTexture", textureUnit);
+	textureUnit++;
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	if (material.metallicRoughnessTextureIdx < 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, Texture::White1x1TextureRGBA().id);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, scene.textures[material.metallicRoughnessTextureIdx].id);
+	}
+	shader.SetInt("material.metallicRoughnessTexture", textureUnit);
+	textureUnit++;
+
+	if (material.normalTextureIdx >= 0)
+	{
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D, scene.textures[material.normalTextureIdx].id);
+		shader.SetInt("material.normalTexture", textureUnit);
+		textureUnit++;
+
+		// This uniform variable is only used if tangents (which are synonymous with normal mapping for now)
+		// are provided
+		if (HasFlag(flags, VertexAttribute::TANGENT))
+		{
+			shader.SetFloat("material.normalScale", material.normalScale);
+		}
+	}
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	if (material.occlusionTextureIdx < 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, Texture::Max1x1TextureRed().id);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, scene.textures[material.occlusionTextureIdx].id);
+	}
+	shader.SetInt("material.occlusionTexture", textureUnit);
+}
+
+RenderQueue::DrawData RenderQueue::MakeDrawData(const Scene& scene, const DrawPacket& packet)
+{
+	const glm::mat4x3& world = scene.globalTransforms[packet.entityIdx];
+	const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+	DrawData draw;
+	for (int r = 0; r < 3; r++)
+	{
+		draw.worldRows[r] = glm::vec4(world[0][r], world[1][r], world[2][r], world[3][r]);
+		draw.normalRows[r] = glm::vec4(normalMatrix[0][r], normalMatrix[1][r], normalMatrix[2][r], 0.0f);
+	}
+	if (packet.morphed)
+	{
+		std::span<const float> weights = scene.entities.GetMorphTargetWeights(packet.entityIdx);
+		draw.normalRows[0].w = weights.size() > 0 ? weights[0] : 0.0f;
+		draw.normalRows[1].w = weights.size() > 1 ? weights[1] : 0.0f;
+	}
+	return draw;
+}
+
+int RenderQueue::FindMultiDrawRunEnd(int first) const
+{
+	// Every following packet with the same program, vertex array and material joins the run
+	const DrawPacket& packet = packets[sortItems[first].packetIdx];
+	int runEnd = first + 1;
+	while (runEnd < sortItems.size())
+	{
+		const DrawPacket& next = packets[sortItems[runEnd].packetIdx];
+		if (!next.multiDraw || next.shaderIdx != packet.shaderIdx || next.submesh.VAO != packet.submesh.VAO ||
+			next.submesh.materialIndex != packet.submesh.materialIndex)
+		{
+			break;
+		}
+		runEnd++;
+	}
+	return runEnd;
+}
+
+void RenderQueue::DrawGpuRuns(const Scene& scene, const glm::mat4& view, const glm::mat4& projection)
+{
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulling->GetCommandBuffer());
+	for (const GpuRun& run : gpuRuns)
+	{
+		const DrawPacket& packet = packets[run.packetIdx];
+		const Submesh& submesh = packet.submesh;
+		const ShaderVariant& variant = shaders[GetReadyShaderIdx(packet.shaderIdx)];
+		Shader& shader = *variant.shader;
+		shader.Use();
+		shader.SetMat4("view", view);
+		shader.SetMat4("projection", projection);
+		glBindVertexArray(submesh.VAO);
+		BindMaterial(shader, scene, submesh.materialIndex, variant.flags);
+		// Slots past the run's survivors hold empty commands
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(run.firstCommand * sizeof(DrawElementsIndirectCommand)),
+			run.numCommands, 0);
+	}
+}
+
+void RenderQueue::Submit(const Scene& scene, const Camera& camera)
+{
+	const glm::mat4 view = camera.GetViewMatrix();
+	const glm::mat4 projection = camera.GetProjectionMatrix();
+
+	// Commands and draw data of the multi-draw packets, in sorted order so every run of them is contiguous. Within a run the
+	// packets drawing the same submesh become one instanced command, ordered by their nearest instance
+	indirectCommands.clear();
+	drawData.clear();
+	runNumCommands.clear();
+	for (int i = 0; i < sortItems.size(); i++)
+	{
+		if (!packets[sortItems[i].packetIdx].multiDraw)
+		{
+			continue;
+		}
+
+		const int runEnd = FindMultiDrawRunEnd(i);
+		const int firstCommand = (int)indirectCommands.size();
+		for (int j = i; j < runEnd; j++)
+		{
+			const DrawPacket& packet = packets[sortItems[j].packetIdx];
+			int& commandIdx = rangeCommands[packet.batchRangeIdx];
+			if (commandIdx < 0)
+			{
+				commandIdx = (int)indirectCommands.size();
+				indirectCommands.push_back({
+					.count = (GLuint)packet.submesh.countVerticesOrIndices,
+					.instanceCount = 0,
+					.firstIndex = packet.firstIndex,
+					.baseVertex = packet.baseVertex,
+					.baseInstance = 0
+				});
+			}
+			indirectCommands[commandIdx].instanceCount++;
+		}
+
+		// Each command's instances are contiguous in the draw data, baseInstance is where they start
+		GLuint baseInstance = (GLuint)drawData.size();
+		for (int c = firstCommand; c < indirectCommands.size(); c++)
+		{
+			indirectCommands[c].baseInstance = baseInstance;
+			baseInstance += indirectCommands[c].instanceCount;
+			indirectCommands[c].instanceCount = 0;
+		}
+		drawData.resize(baseInstance);
+		for (int j = i; j < runEnd; j++)
+		{
+			const DrawPacket& packet = packets[sortItems[j].packetIdx];
+			DrawElementsIndirectCommand& command = indirectCommands[rangeCommands[packet.batchRangeIdx]];
+			drawData[command.baseInstance + command.instanceCount++] = MakeDrawData(scene, packet);
+		}
+		for (int j = i; j < runEnd; j++)
+		{
+			rangeCommands[packets[sortItems[j].packetIdx].batchRangeIdx] = -1;
+		}
+		runNumCommands.push_back((int)indirectCommands.size() - firstCommand);
+		i = runEnd - 1;
+	}
+	if (!indirectCommands.empty())
+	{
+		// Orphaned every frame, see SkinningPaletteBuffer::Update
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCommands.size() * sizeof(DrawElementsIndirectCommand), indirectCommands.data(), GL_STREAM_DRAW);
+	}
+	if (!drawData.empty())
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, drawData.size() * sizeof(DrawData), drawData.data(), GL_STREAM_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawDataBinding, drawDataBuffer);
+	}
+
+	if (meshInstanceBuffer != 0)
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, meshInstancesBinding, meshInstanceBuffer);
+	}
+
+	int boundShaderIdx = -1;
+	GLuint boundVAO = 0;
+	int boundMaterialIdx = -2; // -1 is the default material
+	int commandIdx = 0;
+	int runIdx = 0;
+	for (int i = 0; i < sortItems.size(); i++)
+	{
+		const DrawPacket& packet = packets[sortItems[i].packetIdx];
+		const Submesh& submesh = packet.submesh;
+		const int shaderIdx = GetReadyShaderIdx(packet.shaderIdx);
+		const ShaderVariant& variant = shaders[shaderIdx];
+		Shader& shader = *variant.shader;
+
+		if (shaderIdx != boundShaderIdx)
+		{
+			shader.Use();
+			shader.SetMat4("view", view);
+			shader.SetMat4("projection", projection);
+			boundShaderIdx = shaderIdx;
+			// Material uniforms belong to the program
+			boundMaterialIdx = -2;
+		}
+		if (submesh.VAO != boundVAO)
+		{
+			glBindVertexArray(submesh.VAO);
+			boundVAO = submesh.VAO;
+		}
+		if (submesh.materialIndex != boundMaterialIdx)
+		{
+			BindMaterial(shader, scene, submesh.materialIndex, variant.flags);
+			boundMaterialIdx = submesh.materialIndex;
+		}
+
+		if (packet.multiDraw)
+		{
+			const int numCommands = runNumCommands[runIdx++];
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(commandIdx * sizeof(DrawElementsIndirectCommand)),
+				numCommands, 0);
+			commandIdx += numCommands;
+			i = FindMultiDrawRunEnd(i) - 1;
+			continue;
+		}
+
+		const glm::mat4 world(scene.globalTransforms[packet.entityIdx]);
+		shader.SetMat4("world", world);
+		if (HasFlag(variant.flags, VertexAttribute::NORMAL))
+		{
+			shader.SetMat3("normalMatrixVS", glm::transpose(glm::inverse(glm::mat3(view * world))));
+		}
+		if (packet.morphed && HasFlag(variant.flags, VertexAttribute::MORPH_TARGET0_POSITION))
+		{
+			std::span<const float> weights = scene.entities.GetMorphTargetWeights(packet.entityIdx);
+			shader.SetFloat("morph1Weight", weights.size() > 0 ? weights[0] : 0.0f);
+			shader.SetFloat("morph2Weight", weights.size() > 1 ? weights[1] : 0.0f);
+		}
+
+		if (packet.meshInstanceSetIdx >= 0)
+		{
+			shader.SetUint("meshInstanceOffset", meshInstanceOffsets[packet.meshInstanceSetIdx]);
+			const GLsizei numInstances = (GLsizei)scene.meshInstanceSets[packet.meshInstanceSetIdx].localTransforms.size();
+			if (submesh.hasIndexBuffer)
+			{
+				glDrawElementsInstanced(GL_TRIANGLES, submesh.countVerticesOrIndices, GL_UNSIGNED_INT, 0, numInstances);
+			}
+			else
+			{
+				glDrawArraysInstanced(GL_TRIANGLES, 0, submesh.countVerticesOrIndices, numInstances);
+			}
+		}
+		else if (submesh.hasIndexBuffer)
+		{
+			glDrawElements(GL_TRIANGLES, submesh.countVerticesOrIndices, GL_UNSIGNED_INT, 0);
+		}
+		else
+		{
+			glDrawArrays(GL_TRIANGLES, 0, submesh.countVerticesOrIndices);
+		}
+	}
+
+	if (!gpuRuns.empty())
+	{
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawDataBinding, gpuDrawDataBuffer);
+		// Last frame's visible packets lay down the depth the rest are tested against, see GpuCulling.h
+		const glm::mat4 viewProjection = projection * view;
+		gpuCulling->Cull(GpuCulling::Phase::LastFrameVisible, viewProjection);
+		DrawGpuRuns(scene, view, projection);
+		gpuCulling->BuildHiZ();
+		gpuCulling->Cull(GpuCulling::Phase::Disoccluded, viewProjection);
+		DrawGpuRuns(scene, view, projection);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include "Camera.h"
+#include "Mesh.h"
+#include "Scene.h"
+#include "Shader.h"
+#include "ShaderLibrary.h"
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+enum class RenderPass : std::uint8_t
+{
+	Geometry, // opaque surfaces into the G-buffer
+};
+
+struct DrawSortItem
+{
+	std::uint64_t key;
+	std::uint32_t packetIdx;
+};
+
+// Stable LSD radix sort by key, 8 bits per pass. Histograms for all 8 passes come from one read of the items, and passes
+// where every key has the same byte are skipped, so the cost scales with the key bits that actually vary. Leaves the
+// result in items, scratch is resized to match
+void RadixSortDrawItems(std::vector<DrawSortItem>& items, std::vector<DrawSortItem>& scratch);
+
+// Record of GL_DRAW_INDIRECT_BUFFER, see glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Skinning output to draw in place of an entity's animated submesh, or nullptr to draw the source submesh
+using AnimatedSubmeshLookup = std::function<const Submesh*(int entityIdx, int submeshIdx)>;
+
+class GpuCulling;
+
+// Draws every submesh of every live entity with a mesh. Build makes one draw packet per submesh; each frame Sort gives every
+// packet a 64 bit key (pass, shader variant, vertex array, material, depth from most to least significant bits) and
+// radix sorts them, and Submit draws them in key order, only rebinding the program, vertex array and material textures
+// when they differ from the previous draw's. geometryPass.vert variants are compiled per distinct vertex layout.
+//
+// Static submeshes are copied into one vertex and index buffer per vertex layout, so that every run of them sharing a
+// program, layout and material is a single glMultiDrawElementsIndirect. Their world and normal matrices go in a per-frame
+// shader storage buffer at drawDataBinding, which the MULTI_DRAW_INDIRECT variant indexes with an instanced attribute
+// (GL 4.3 has no gl_DrawID) holding 0, 1, 2, ... offset by each command's baseInstance. Within a run, every entity
+// drawing the same submesh is an instance of one command, their draw data contiguous, so repeated meshes cost one command
+// however many entities share them; morph target weights ride along in the draw data. Skinned submeshes, whose vertices
+// live in per-entity buffers, are drawn one at a time, as are entities with a MeshInstanceSet: one instanced draw per
+// submesh, the MESH_INSTANCING variant reading the instance transforms and their normal matrices uploaded at Build from
+// meshInstancesBinding.
+//
+// With SetGpuCulling the multi-draw packets instead get fixed command slots at Build, grouped in runs by program, layout
+// and material, and are culled and compacted on the GPU every frame (see GpuCulling.h): Sort leaves them out and Submit
+// draws each run as one glMultiDrawElementsIndirect from GpuCulling's command buffer, whatever survived. Their draw data
+// stays in its own buffer across frames, UpdateGpuDrawData only rewrites the slots of entities that moved or morphed.
+//
+// With SetAsyncShaderCompilation, Build submits every variant it needs through ShaderLibrary::GetAsync without waiting
+// for any. Until a variant is ready its packets are drawn with a position-only, flat shaded fallback variant (with the same
+// multi-draw and mesh instancing defines), which draws any vertex layout in its material's base color factor
+class RenderQueue
+{
+public:
+	static constexpr GLuint drawDataBinding = 3;
+	static constexpr GLuint meshInstancesBinding = 9;
+	static constexpr GLuint drawIndexLocation = 13;
+
+	static constexpr int passBits = 4;
+	static constexpr int shaderBits = 12;
+	static constexpr int layoutBits = 16;
+	static constexpr int materialBits = 16;
+	static constexpr int depthBits = 16;
+	static_assert(passBits + shaderBits + layoutBits + materialBits + depthBits <= 64, "Sort key fields must fit in 64 bits");
+
+	// Geometry pass variants come from shaderLibrary, which must outlive the queue
+	explicit RenderQueue(ShaderLibrary& shaderLibrary) : shaderLibrary(shaderLibrary) {}
+	RenderQueue(const RenderQueue&) = delete;
+	RenderQueue& operator=(const RenderQueue&) = delete;
+	~RenderQueue();
+
+	// Every field must fit its bits, an overflowing one would spill into the next and break the ordering
+	static std::uint64_t MakeSortKey(RenderPass pass, int shaderIdx, int layoutIdx, int materialIdx, std::uint32_t depth)
+	{
+		assert((std::uint64_t)pass < (1ull << passBits));
+		assert(shaderIdx >= 0 && shaderIdx < (1 << shaderBits));
+		assert(layoutIdx >= 0 && layoutIdx < (1 << layoutBits));
+		assert(materialIdx >= 0 && materialIdx < (1 << materialBits));
+		assert(depth < (1u << depthBits));
+		std::uint64_t key = (std::uint64_t)pass;
+		key = (key << shaderBits) | (std::uint64_t)shaderIdx;
+		key = (key << layoutBits) | (std::uint64_t)layoutIdx;
+		key = (key << materialBits) | (std::uint64_t)materialIdx;
+		return (key << depthBits) | depth;
+	}
+
+	// Needs the GL context, compiles any shader variant it hasn't seen yet. Call again when entities change, after the
+	// skinning paths' Build since animatedSubmeshes points into their outputs
+	void Build(const Scene& scene, const AnimatedSubmeshLookup& animatedSubmeshes);
+	// Before Build, nullptr to cull and sort multi-draw packets on the CPU
+	void SetGpuCulling(GpuCulling* culling) { gpuCulling = culling; }
+	// Before Build. The library must be polled every frame for pending variants to replace their fallbacks
+	void SetAsyncShaderCompilation(bool async) { asyncShaderCompilation = async; }
+	// After TransformSystem::Update. Only the packets of visibleEntities (see BVH::QueryFrustum and OcclusionCulling) are drawn. Opaque draws are
+	// ordered front to back within a state run
+	void Sort(const Scene& scene, const Camera& camera, std::span<const int> visibleEntities);
+	// With SetGpuCulling, after TransformSystem::Update. Rewrites the draw data of movedEntities' GPU culled packets (see
+	// TransformSystem::GetUpdatedEntities) and the morph target weights of morphed ones
+	void UpdateGpuDrawData(const Scene& scene, std::span<const int> movedEntities);
+	// Into the bound framebuffer
+	void Submit(const Scene& scene, const Camera& camera);
+
+	int GetNumPackets() const { return (int)packets.size(); }
+
+	// For passes drawing geometryPass variants themselves. The defines selecting a variant for a vertex layout
+	static std::vector<std::string> GetGeometryPassDefines(VertexAttribute flags, bool flatShading);
+	// Material uniforms and textures, on units 0 to 3. materialIdx -1 is the default material
+	static void BindMaterial(Shader& shader, const Scene& scene, int materialIdx, VertexAttribute flags);
+
+private:
+	struct DrawPacket
+	{
+		int entityIdx;
+		Submesh submesh; // the skinning output for animated submeshes, the VAO is the batch's for multi-draw packets
+		int shaderIdx;
+		int layoutIdx; // dense index of the submesh's VAO
+		bool morphed; // its draw data carries the entity's morph target weights
+		bool multiDraw;
+		int batchRangeIdx; // the submesh's place in its batch, shared by every packet drawing it, -1 if not multi-draw
+		int meshInstanceSetIdx; // the entity's, -1 if it has none
+		GLuint firstIndex; // into the batch's buffers, for multi-draw packets
+		GLint baseVertex;
+		glm::vec3 boundsCenter; // in model space
+	};
+
+	// Static submeshes sharing a vertex layout, each copied in once however many entities draw it
+	struct MultiDrawBatch
+	{
+		VertexAttribute flags;
+		GLuint VAO = 0;
+		GLuint VBO = 0;
+		GLuint IBO = 0;
+		int numVertices = 0;
+		int numIndices = 0;
+	};
+
+	// Command slots that GpuCulling compacts a run's surviving packets into, all sharing the first packet's state
+	struct GpuRun
+	{
+		int firstCommand;
+		int numCommands;
+		int packetIdx;
+	};
+
+	struct ShaderVariant
+	{
+		Shader* shader; // owned by shaderLibrary
+		VertexAttribute flags; // the ones selecting the variant
+		int fallbackIdx; // drawn with while shader is pending, itself if it never is
+	};
+
+	// Per multi-draw packet, see geometryPass.vert
+	struct DrawData
+	{
+		glm::vec4 worldRows[3];
+		glm::vec4 normalRows[3]; // xyz, w of the first two holds morph target weights
+	};
+
+	void Clear();
+	int GetShaderIdx(VertexAttribute flags, bool flatShading, bool multiDraw, bool meshInstancing);
+	// Compiled right away, there are at most four
+	int GetFallbackShaderIdx(bool multiDraw, bool meshInstancing);
+	// The variant to draw shaderIdx's packets with this frame
+	int GetReadyShaderIdx(int shaderIdx) const
+	{
+		return shaders[shaderIdx].shader->IsLinkPending() ? shaders[shaderIdx].fallbackIdx : shaderIdx;
+	}
+	static DrawData MakeDrawData(const Scene& scene, const DrawPacket& packet);
+	int FindMultiDrawRunEnd(int first) const;
+	void BuildGpuRuns(const Scene& scene);
+	void DrawGpuRuns(const Scene& scene, const glm::mat4& view, const glm::mat4& projection);
+
+	std::vector<DrawPacket> packets;
+	std::vector<DrawSortItem> sortItems;
+	std::vector<DrawSortItem> sortScratch;
+	ShaderLibrary& shaderLibrary;
+	std::vector<ShaderVariant> shaders;
+	std::unordered_map<std::uint32_t, int> shaderIndices; // by the VertexAttribute flags (and flat shading, multi-draw) selecting the variant
+	std::unordered_map<GLuint, int> layoutIndices; // by VAO
+	std::vector<int> entityFirstPackets; // per entity plus one past the last, an entity's packets are contiguous
+	GLuint meshInstanceBuffer = 0; // every MeshInstanceSet's transforms, see geometryPass.vert
+	std::vector<GLuint> meshInstanceOffsets; // per MeshInstanceSet, in instances
+
+	std::vector<MultiDrawBatch> batches;
+	GLuint drawIndexBuffer = 0;
+	GLuint indirectBuffer = 0;
+	GLuint drawDataBuffer = 0;
+	std::vector<DrawElementsIndirectCommand> indirectCommands; // scratch
+	std::vector<DrawData> drawData; // scratch
+	std::vector<int> runNumCommands; // scratch, per multi-draw run in sorted order
+	std::vector<int> rangeCommands; // scratch, per batch range its command in the current run or -1
+
+	GpuCulling* gpuCulling = nullptr;
+	bool asyncShaderCompilation = false;
+	std::vector<int> gpuCommandPackets; // packet index per command slot
+	std::vector<int> packetGpuSlots; // per packet its command slot, -1 if it isn't GPU culled
+	std::vector<int> gpuMorphedSlots; // slots of morphed packets, whose weights are rewritten every frame
+	std::vector<GpuRun> gpuRuns;
+	GLuint gpuDrawDataBuffer = 0; // per command slot, persistent
+	std::vector<DrawData> gpuDrawData; // what gpuDrawDataBuffer holds
+	std::vector<int> dirtyGpuSlots; // scratch
+};
\ No newline at end of file
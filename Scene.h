@@ -14,14 +14,39 @@
 
 #include <vector>
 
+// Plays an animation on a skeleton other than the one it targets, which must have the same joint layout. Only the skinning
+// palette is animated, the skeleton's joint entities keep their transforms, so the instance is placed by its root entity
+struct SkeletonAnimationInstance
+{
+	int skeletonIdx;
+	int animationIdx;
+	float timeOffsetSeconds = 0.0f;
+};
+
+// Copies of an entity's mesh placed relative to it, from EXT_mesh_gpu_instancing. The entity is culled by the bounds of all
+// of them and RenderQueue draws each of its submeshes as one instanced draw, so scattered instances cost no entities
+struct MeshInstanceSet
+{
+	std::vector<glm::mat4x3> localTransforms; // relative to the entity
+	BBox modelBounds; // of the mesh over every instance, in the entity's space
+};
+
 struct Scene
 {
-	std::vector<Entity> entities;
-	std::vector<glm::mat4> globalTransforms;
+	EntityStorage entities;
+	std::vector<glm::mat4x3> globalTransforms; // filled by TransformSystem
+	std::vector<std::uint8_t> transformDirty; // see MarkTransformDirty
+	std::vector<int> dirtyTransforms;
 	std::vector<Animation> animations;
 	std::vector<std::uint8_t> animationEnabled;
 	std::vector<Skeleton> skeletons;
+	std::vector<SkeletonAnimationInstance> skeletonAnimationInstances;
+	// Filled by AnimationSystem. Skeletons without an animation instance own the palette at their own index, instanced
+	// skeletons point at palettes shared through the pose cache, stored after those
+	std::vector<SkinningPalette> skinningPalettes;
+	std::vector<int> skeletonPaletteIndices; // per skeleton, into skinningPalettes
 	std::vector<Mesh> meshes;
+	std::vector<MeshInstanceSet> meshInstanceSets;
 	std::vector<PBRMaterial> materials;
 	std::vector<Texture> textures;
 	std::vector<Light> lights;
@@ -29,4 +54,11 @@ struct Scene
 	Camera controllableCamera;
 	Camera* currentCamera = &controllableCamera;
 	float exposure = 1.0f;
+
+	// What an entity with a mesh draws, in its own space
+	const BBox& GetModelBounds(int entityIdx) const
+	{
+		const int setIdx = entities.meshInstanceSetIndices[entityIdx];
+		return setIdx >= 0 ? meshInstanceSets[setIdx].modelBounds : meshes[entities.meshIndices[entityIdx]].boundingBox;
+	}
 };
\ No newline at end of file
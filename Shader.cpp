@@ -2,22 +2,32 @@
 
 Shader::Shader(const char * vertexPath, const char * fragmentPath, const char * geometryPath, const std::vector<std::string>& defines)
 {
-	static const std::string version = "#version 430 core\n";
+	std::vector<std::pair<GLenum, const char*>> stages = { { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } };
+	if (geometryPath != nullptr)
+	{
+		stages.emplace_back(GL_GEOMETRY_SHADER, geometryPath);
+	}
+	SubmitStages(stages, defines);
+	FinishLink();
 
-	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	Use();
+}
 
-	std::string defaultDefinesString;
-	defaultDefinesString += "#define MAX_NUM_POINT_LIGHTS " + std::to_string(maxPointLights) + "\n";
-	defaultDefinesString += "#define MAX_NUM_SPOT_LIGHTS " + std::to_string(maxSpotLights) + "\n";
-	defaultDefinesString += "#define MAX_NUM_DIR_LIGHTS " + std::to_string(maxDirLights) + "\n";
-	defaultDefinesString += "#define PI 3.14159265359\n";
+Shader Shader::Compute(const char* computePath, const std::vector<std::string>& defines)
+{
+	Shader shader;
+	shader.SubmitStages({ { GL_COMPUTE_SHADER, computePath } }, defines);
+	shader.FinishLink();
 
-	auto vertexSource = get_file_contents(vertexPath);
-	auto fragmentSource = get_file_contents(fragmentPath);
+	shader.Use();
+	return shader;
+}
 
-	auto vShaderCode = vertexSource.c_str();
-	auto fShaderCode = fragmentSource.c_str();
+void Shader::SubmitStages(const std::vector<std::pair<GLenum, const char*>>& stages, const std::vector<std::string>& defines)
+{
+	static const std::string version = "#version 430 core\n";
+
+	std::string defaultDefinesString = GetDefaultDefines();
 
 	std::string definesString;
 	for (const std::string& define : defines)
@@ -26,71 +36,82 @@ Shader::Shader(const char * vertexPath, const char * fragmentPath, const char *
 		std::cout << define << '\n';
 	}
 
-	const char* vShaderSources[4] = { version.c_str(), definesString.c_str(), defaultDefinesString.c_str(),  vShaderCode};
-	const char* fShaderSources[4] = { version.c_str(), definesString.c_str(), defaultDefinesString.c_str(), fShaderCode};
-
-	glShaderSource(vertexShader, 4, vShaderSources, NULL);
-	glShaderSource(fragmentShader, 4, fShaderSources, NULL);
-
-	glCompileShader(vertexShader);
+	// Nothing here waits for the driver, the statuses are only queried in FinishLink
+	id = glCreateProgram();
+	for (const auto& [type, path] : stages)
+	{
+		unsigned int stage = glCreateShader(type);
+		auto source = get_file_contents(path);
+		const char* sources[4] = { version.c_str(), definesString.c_str(), defaultDefinesString.c_str(), source.c_str() };
+		glShaderSource(stage, 4, sources, NULL);
+		glCompileShader(stage);
+		glAttachShader(id, stage);
+		pendingStages.push_back({ stage, type, path });
+	}
+	glLinkProgram(id);
+}
 
-	int success;
-	char infoLog[512];
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-	if (!success)
+bool Shader::IsLinkComplete() const
+{
+	if (pendingStages.empty())
 	{
-		glGetShaderInfoLog(vertexShader, sizeof(infoLog), NULL, infoLog);
-		std::cout << "Error compiling vertex shader '" << vertexPath << "'\n" << infoLog << std::endl;
-		//std::cout << "Vertex shader source:\n" << version + defaultDefinesString + definesString + vShaderCode;
-		// TODO find a solution for this. It's affecting the next Shader object created
-		// when this one fails
+		return true;
 	}
+	int complete;
+	glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete != 0;
+}
 
-	glCompileShader(fragmentShader);
-	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-	if (!success)
+void Shader::FinishLink()
+{
+	if (pendingStages.empty())
 	{
-		glGetShaderInfoLog(fragmentShader, sizeof(infoLog), NULL, infoLog);
-		std::cout << "Error compiling fragment shader '" << fragmentPath << "'\n" << infoLog << std::endl;
-		//std::cout << "Fragment shader source:\n" << version + defaultDefinesString + definesString + fShaderCode;
+		return;
 	}
 
-	id = glCreateProgram();
-	glAttachShader(id, vertexShader);
-	glAttachShader(id, fragmentShader);
-
-	if (geometryPath != nullptr) {
-		unsigned int geomShader = glCreateShader(GL_GEOMETRY_SHADER);
-		auto geomSource = get_file_contents(geometryPath);
-		auto code = geomSource.c_str();
-		const char* gShaderSources[4] = { version.c_str(), definesString.c_str(), defaultDefinesString.c_str(), code };
-		glShaderSource(geomShader, 4, gShaderSources, NULL);
-		glCompileShader(geomShader);
-		glGetShaderiv(geomShader, GL_COMPILE_STATUS, &success);
+	int success;
+	char infoLog[512];
+	for (const PendingStage& stage : pendingStages)
+	{
+		glGetShaderiv(stage.shader, GL_COMPILE_STATUS, &success);
 		if (!success)
 		{
-			glGetShaderInfoLog(geomShader, sizeof(infoLog), NULL, infoLog);
-			std::cout << "Error compiling geometry shader '" << geometryPath << "'\n" << infoLog << std::endl;
+			glGetShaderInfoLog(stage.shader, sizeof(infoLog), NULL, infoLog);
+			const char* stageName = stage.type == GL_VERTEX_SHADER ? "vertex" : stage.type == GL_FRAGMENT_SHADER ? "fragment" :
+				stage.type == GL_GEOMETRY_SHADER ? "geometry" : "compute";
+			std::cout << "Error compiling " << stageName << " shader '" << stage.path << "'\n" << infoLog << std::endl;
+			// TODO find a solution for this. It's affecting the next Shader object created
+			// when this one fails
 		}
-
-		glAttachShader(id, geomShader);
 	}
 
-	glLinkProgram(id);
-
 	glGetProgramiv(id, GL_LINK_STATUS, &success);
 	if (!success)
 	{
 		glGetProgramInfoLog(id, sizeof(infoLog), NULL, infoLog);
-		std::cout << "Error compiling shader program.\nVertex Shader: " << vertexPath << "\nFragment Shader: " << fragmentPath << "'\n" << infoLog << std::endl;
-		//std::cout << "Vertex shader source:\n" << version + defaultDefinesString + definesString + vShaderCode << std::endl;
-		//std::cout << "Fragment shader source:\n" << version + defaultDefinesString + definesString + fShaderCode << std::endl;
+		std::cout << "Error compiling shader program.\n";
+		for (const PendingStage& stage : pendingStages)
+		{
+			std::cout << "Shader: " << stage.path << '\n';
+		}
+		std::cout << infoLog << std::endl;
 	}
 
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
+	for (const PendingStage& stage : pendingStages)
+	{
+		glDeleteShader(stage.shader);
+	}
+	pendingStages.clear();
+}
 
-	Use();
+std::string Shader::GetDefaultDefines()
+{
+	std::string defaultDefinesString;
+	defaultDefinesString += "#define MAX_NUM_POINT_LIGHTS " + std::to_string(maxPointLights) + "\n";
+	defaultDefinesString += "#define MAX_NUM_SPOT_LIGHTS " + std::to_string(maxSpotLights) + "\n";
+	defaultDefinesString += "#define MAX_NUM_DIR_LIGHTS " + std::to_string(maxDirLights) + "\n";
+	defaultDefinesString += "#define PI 3.14159265359\n";
+	return defaultDefinesString;
 }
 
 void Shader::Use()
@@ -195,4 +216,4 @@ std::string Shader::get_file_contents(const char * path)
 		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: '" << path << "'\n";
 		return {};
 	}
-}
+}
\ No newline at end of file
@@ -7,10 +7,16 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <glm/gtc/type_ptr.hpp>
 
+// KHR_parallel_shader_compile (and ARB_parallel_shader_compile), which glad isn't generated with
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 class Shader
 {
 public:
@@ -19,7 +25,12 @@ public:
 	static constexpr int maxSpotLights = 5;
 	static constexpr int maxDirLights = 5;
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::vector<std::string>& defines = {});
+	// Program with a single compute shader stage
+	static Shader Compute(const char* computePath, const std::vector<std::string>& defines = {});
+
 
+	// Only programs from ShaderLibrary::GetAsync can be pending, they can't be used until it finishes them
+	bool IsLinkPending() const { return !pendingStages.empty(); }
 
 	void Use();
 
@@ -40,8 +51,27 @@ public:
 	void SetVec4(const char* name, const glm::vec4& vec);
 	void SetVec3Array(const char* name, float* values, unsigned int count);
 private:
+	friend class ShaderLibrary;
+
+	// A stage compiled into the program whose status hasn't been checked yet
+	struct PendingStage
+	{
+		unsigned int shader;
+		GLenum type;
+		std::string path;
+	};
+
+	Shader() = default;
+	// Compiles the stages and links them into id without waiting for either to finish
+	void SubmitStages(const std::vector<std::pair<GLenum, const char*>>& stages, const std::vector<std::string>& defines);
+	// Whether FinishLink would return without waiting for the driver. Needs KHR_parallel_shader_compile if the link is pending
+	bool IsLinkComplete() const;
+	// Waits for the link if it's pending, reports compile and link errors and deletes the stage shaders
+	void FinishLink();
+	static std::string GetDefaultDefines();
 	std::string get_file_contents(const char* path);
 	std::unordered_map<std::string, int> cachedUniformLocations;
+	std::vector<PendingStage> pendingStages;
 
 	int GetUniformLocation(const std::string& name)
 	{
@@ -0,0 +1,300 @@
+#include "ShaderLibrary.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+namespace
+{
+	// Bump when the cache file layout changes
+	constexpr std::uint32_t cacheMagic = 0x31424C53; // "SLB1"
+
+	// FNV-1a
+	std::uint64_t HashBytes(const void* data, std::size_t size, std::uint64_t hash = 14695981039346656037ull)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::uint64_t HashString(const std::string& string, std::uint64_t hash)
+	{
+		// The length separates consecutive strings, so {"AB", "C"} and {"A", "BC"} differ
+		const std::uint64_t length = string.size();
+		hash = HashBytes(&length, sizeof(length), hash);
+		return HashBytes(string.data(), string.size(), hash);
+	}
+}
+
+ShaderLibrary::ShaderLibrary(std::string cacheDirectory) :
+	cacheDirectory(std::move(cacheDirectory))
+{
+	driver = std::string((const char*)glGetString(GL_VENDOR)) + '|' + (const char*)glGetString(GL_RENDERER) + '|' +
+		(const char*)glGetString(GL_VERSION);
+
+	GLint numExtensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions; i++)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (std::strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(extension, "GL_ARB_parallel_shader_compile") == 0)
+		{
+			parallelCompileSupported = true;
+		}
+	}
+
+	GLint numBinaryFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+	binariesSupported = numBinaryFormats > 0;
+	if (binariesSupported)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(this->cacheDirectory, error);
+		if (error)
+		{
+			std::cout << "Warning: can't create shader cache directory '" << this->cacheDirectory << "', programs won't be cached\n";
+			binariesSupported = false;
+		}
+	}
+}
+
+Shader& ShaderLibrary::Get(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines)
+{
+	const std::uint64_t key = GetKey({ vertexPath, fragmentPath }, defines);
+	auto iter = programs.find(key);
+	if (iter != programs.end())
+	{
+		++numReuses;
+		if (iter->second.IsLinkPending())
+		{
+			Finish(key, iter->second);
+			pendingKeys.erase(std::find(pendingKeys.begin(), pendingKeys.end(), key));
+		}
+		return iter->second;
+	}
+
+	if (GLuint program = LoadProgramBinary(key))
+	{
+		++numCacheHits;
+		Shader shader;
+		shader.id = program;
+		return programs.emplace(key, std::move(shader)).first->second;
+	}
+
+	++numCacheMisses;
+	Shader& shader = programs.emplace(key, Shader(vertexPath, fragmentPath, nullptr, defines)).first->second;
+	SaveProgramBinary(key, shader.id);
+	return shader;
+}
+
+Shader& ShaderLibrary::GetCompute(const char* computePath, const std::vector<std::string>& defines)
+{
+	const std::uint64_t key = GetKey({ computePath }, defines);
+	auto iter = programs.find(key);
+	if (iter != programs.end())
+	{
+		++numReuses;
+		return iter->second;
+	}
+
+	if (GLuint program = LoadProgramBinary(key))
+	{
+		++numCacheHits;
+		Shader shader;
+		shader.id = program;
+		return programs.emplace(key, std::move(shader)).first->second;
+	}
+
+	++numCacheMisses;
+	Shader& shader = programs.emplace(key, Shader::Compute(computePath, defines)).first->second;
+	SaveProgramBinary(key, shader.id);
+	return shader;
+}
+
+Shader& ShaderLibrary::GetAsync(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines)
+{
+	const std::uint64_t key = GetKey({ vertexPath, fragmentPath }, defines);
+	auto iter = programs.find(key);
+	if (iter != programs.end())
+	{
+		++numReuses;
+		return iter->second;
+	}
+
+	if (GLuint program = LoadProgramBinary(key))
+	{
+		++numCacheHits;
+		Shader shader;
+		shader.id = program;
+		return programs.emplace(key, std::move(shader)).first->second;
+	}
+
+	++numCacheMisses;
+	Shader& shader = programs.emplace(key, Shader()).first->second;
+	shader.SubmitStages({ { GL_VERTEX_SHADER, vertexPath }, { GL_FRAGMENT_SHADER, fragmentPath } }, defines);
+	pendingKeys.push_back(key);
+	return shader;
+}
+
+void ShaderLibrary::Poll()
+{
+	for (int i = 0; i < pendingKeys.size();)
+	{
+		Shader& shader = programs.at(pendingKeys[i]);
+		if (parallelCompileSupported && !shader.IsLinkComplete())
+		{
+			i++;
+			continue;
+		}
+		Finish(pendingKeys[i], shader);
+		pendingKeys[i] = pendingKeys.back();
+		pendingKeys.pop_back();
+	}
+}
+
+void ShaderLibrary::FinishPending()
+{
+	for (std::uint64_t key : pendingKeys)
+	{
+		Finish(key, programs.at(key));
+	}
+	pendingKeys.clear();
+}
+
+void ShaderLibrary::Finish(std::uint64_t key, Shader& shader)
+{
+	shader.FinishLink();
+	SaveProgramBinary(key, shader.id);
+}
+
+std::uint64_t ShaderLibrary::GetSourceHash(const char* path)
+{
+	auto iter = sourceHashes.find(path);
+	if (iter != sourceHashes.end())
+	{
+		return iter->second;
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	std::stringstream contents;
+	contents << in.rdbuf();
+	const std::uint64_t hash = HashString(contents.str(), HashBytes(path, std::strlen(path)));
+	sourceHashes.emplace(path, hash);
+	return hash;
+}
+
+std::uint64_t ShaderLibrary::GetKey(std::initializer_list<const char*> paths, const std::vector<std::string>& defines)
+{
+	// The stage count keeps a compute program from colliding with a graphics one over the same files
+	const std::uint64_t numStages = paths.size();
+	std::uint64_t key = HashBytes(&numStages, sizeof(numStages));
+	for (const char* path : paths)
+	{
+		const std::uint64_t sourceHash = GetSourceHash(path);
+		key = HashBytes(&sourceHash, sizeof(sourceHash), key);
+	}
+	for (const std::string& define : defines)
+	{
+		key = HashString(define, key);
+	}
+	return HashString(Shader::GetDefaultDefines(), key);
+}
+
+std::string ShaderLibrary::GetCachePath(std::uint64_t key) const
+{
+	char name[17];
+	std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+	return cacheDirectory + '/' + name + ".bin";
+}
+
+GLuint ShaderLibrary::LoadProgramBinary(std::uint64_t key) const
+{
+	if (!binariesSupported)
+	{
+		return 0;
+	}
+
+	std::ifstream in(GetCachePath(key), std::ios::binary);
+	if (!in)
+	{
+		return 0;
+	}
+
+	// Layout: magic, driver string length and bytes, binary format, binary length and bytes
+	std::uint32_t magic = 0;
+	std::uint32_t driverLength = 0;
+	in.read((char*)&magic, sizeof(magic));
+	in.read((char*)&driverLength, sizeof(driverLength));
+	if (!in || magic != cacheMagic || driverLength != driver.size())
+	{
+		return 0;
+	}
+	std::string fileDriver(driverLength, '\0');
+	in.read(fileDriver.data(), driverLength);
+	if (!in || fileDriver != driver)
+	{
+		return 0;
+	}
+
+	GLenum binaryFormat = 0;
+	std::uint32_t binaryLength = 0;
+	in.read((char*)&binaryFormat, sizeof(binaryFormat));
+	in.read((char*)&binaryLength, sizeof(binaryLength));
+	std::vector<char> binary(binaryLength);
+	in.read(binary.data(), binaryLength);
+	if (!in)
+	{
+		return 0;
+	}
+
+	// The driver may still reject a binary it produced, e.g. after an update that kept the version string
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, binaryFormat, binary.data(), (GLsizei)binaryLength);
+	GLint success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+void ShaderLibrary::SaveProgramBinary(std::uint64_t key, GLuint program) const
+{
+	if (!binariesSupported)
+	{
+		return;
+	}
+
+	GLint success = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	GLint binaryLength = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+	if (!success || binaryLength <= 0)
+	{
+		return;
+	}
+
+	std::vector<char> binary(binaryLength);
+	GLenum binaryFormat = 0;
+	glGetProgramBinary(program, binaryLength, nullptr, &binaryFormat, binary.data());
+
+	std::ofstream out(GetCachePath(key), std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		return;
+	}
+	const std::uint32_t driverLength = (std::uint32_t)driver.size();
+	const std::uint32_t length = (std::uint32_t)binaryLength;
+	out.write((const char*)&cacheMagic, sizeof(cacheMagic));
+	out.write((const char*)&driverLength, sizeof(driverLength));
+	out.write(driver.data(), driverLength);
+	out.write((const char*)&binaryFormat, sizeof(binaryFormat));
+	out.write((const char*)&length, sizeof(length));
+	out.write(binary.data(), length);
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Shader.h"
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Programs keyed by the hashes of their stages' sources and their define set, so every system asking for the same variant
+// shares one program (and its uniform location cache). Linked programs are also saved with glGetProgramBinary under
+// cacheDirectory, one file per key, and later runs load them with glProgramBinary instead of compiling. Each file records
+// the driver (GL_VENDOR, GL_RENDERER and GL_VERSION) it came from; a file from another driver, or one the driver rejects,
+// is a miss that compiles from source and overwrites it. Editing a source changes its hash, so stale files are never
+// loaded, just left behind.
+//
+// GetAsync submits a program's compile and link without waiting for them, so every variant a scene needs can be handed to
+// the driver up front and compiled on its threads. With KHR_parallel_shader_compile, Poll finishes the programs whose link
+// is complete and the rest stay pending (see Shader::IsLinkPending), to be drawn with something else meanwhile. Without it
+// there is no way to ask, so Poll finishes every pending program, waiting for them.
+//
+// Needs the GL context. References returned stay valid as long as the library
+class ShaderLibrary
+{
+public:
+	explicit ShaderLibrary(std::string cacheDirectory = "ShaderCache");
+	ShaderLibrary(const ShaderLibrary&) = delete;
+	ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+	Shader& Get(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines = {});
+	Shader& GetCompute(const char* computePath, const std::vector<std::string>& defines = {});
+	// Like Get but doesn't wait for a program that has to be compiled, which stays pending until Poll or FinishPending
+	// finishes it. Get of a pending program finishes it
+	Shader& GetAsync(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines = {});
+	// Once per frame. Finishes and caches the pending programs whose link is done
+	void Poll();
+	// Waits for every pending program
+	void FinishPending();
+
+	bool IsParallelCompileSupported() const { return parallelCompileSupported; }
+	int GetNumPending() const { return (int)pendingKeys.size(); }
+
+	// Programs loaded from the disk cache and compiled from source. Gets of an already loaded program count as reuses
+	int GetNumCacheHits() const { return numCacheHits; }
+	int GetNumCacheMisses() const { return numCacheMisses; }
+	int GetNumReuses() const { return numReuses; }
+	int GetNumPrograms() const { return (int)programs.size(); }
+
+private:
+	std::uint64_t GetSourceHash(const char* path);
+	std::uint64_t GetKey(std::initializer_list<const char*> paths, const std::vector<std::string>& defines);
+	std::string GetCachePath(std::uint64_t key) const;
+	// 0 if there is no usable binary for the key
+	GLuint LoadProgramBinary(std::uint64_t key) const;
+	void SaveProgramBinary(std::uint64_t key, GLuint program) const;
+	// Of a pending program, doesn't remove it from pendingKeys
+	void Finish(std::uint64_t key, Shader& shader);
+
+	std::string cacheDirectory;
+	std::string driver; // identifies the driver that produced a binary
+	bool binariesSupported;
+	bool parallelCompileSupported = false;
+	std::unordered_map<std::uint64_t, Shader> programs; // by key, nodes so references stay valid
+	std::unordered_map<std::string, std::uint64_t> sourceHashes; // by path, each file is read once
+	std::vector<std::uint64_t> pendingKeys;
+	int numCacheHits = 0;
+	int numCacheMisses = 0;
+	int numReuses = 0;
+};
\ No newline at end of file
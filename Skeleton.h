@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <glm/mat4x3.hpp>
 #include <string>
 #include <vector>
@@ -9,9 +11,55 @@ struct Joint
 	glm::mat4x3 localToJoint; // AKA "inverse bind matrix". Apparently 4x3 actually means 3 rows 4 columns in glm so this is fine
 	int entityIndex;
 	int parent; // not to be confused with entity.parent. That refers to the scene's entity hierarachy, while this refers to the skeleton's joint hierarchy
+	int paletteIdx; // index of the joint in the glTF skin, which is what the JOINTS vertex attribute refers to
 };
 
+// How the skinning shaders blend a vertex's joints. Dual quaternions keep volume at twisting and bending joints where linear
+// blending collapses (candy-wrapper elbows and wrists), but ignore joint scale
+enum class SkinningMode
+{
+	LinearBlend,
+	DualQuaternion
+};
+
+// Joints are sorted so that parents always come before their children
 struct Skeleton
 {
 	std::vector<Joint> joints;
+	std::uint64_t layoutHash = 0; // see ComputeLayoutHash
+	SkinningMode skinningMode = SkinningMode::LinearBlend; // not part of the layout, skeletons sharing a palette can differ
+
+	// Skeletons with equal hashes have the same joint hierarchy, palette order and inverse bind matrices, so one can play poses
+	// sampled for the other
+	std::uint64_t ComputeLayoutHash() const
+	{
+		// FNV-1a
+		std::uint64_t hash = 14695981039346656037ull;
+		auto hashBytes = [&hash](const void* data, std::size_t size)
+		{
+			const unsigned char* bytes = (const unsigned char*)data;
+			for (std::size_t i = 0; i < size; i++)
+			{
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+		};
+		for (const Joint& joint : joints)
+		{
+			hashBytes(&joint.localToJoint, sizeof(joint.localToJoint));
+			hashBytes(&joint.parent, sizeof(joint.parent));
+			hashBytes(&joint.paletteIdx, sizeof(joint.paletteIdx));
+		}
+		return hash;
+	}
+};
+
+// Caller-owned storage for a skeleton's palette, sized once so that updating it every frame doesn't allocate.
+// skinningMatrices is indexed by Joint::paletteIdx, globalMatrices by joint index
+struct SkinningPalette
+{
+	std::vector<glm::mat4x3> globalMatrices;
+	std::vector<glm::mat4x3> skinningMatrices;
+
+	SkinningPalette() = default;
+	explicit SkinningPalette(int numJoints) : globalMatrices(numJoints), skinningMatrices(numJoints) {}
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "SkinningPaletteBuffer.h"
+
+SkinningPaletteBuffer::~SkinningPaletteBuffer()
+{
+	if (buffer != 0)
+	{
+		glDeleteBuffers(1, &buffer);
+	}
+}
+
+void SkinningPaletteBuffer::Update(const Scene& scene)
+{
+	const int numPalettes = (int)scene.skinningPalettes.size();
+	paletteModes.assign(numPalettes, 0);
+	for (int skeletonIdx = 0; skeletonIdx < scene.skeletons.size(); skeletonIdx++)
+	{
+		paletteModes[scene.skeletonPaletteIndices[skeletonIdx]] |= 1 << (int)scene.skeletons[skeletonIdx].skinningMode;
+	}
+
+	rows.clear();
+	linearBlendOffsets.resize(numPalettes);
+	dualQuaternionOffsets.resize(numPalettes);
+	for (int i = 0; i < numPalettes; i++)
+	{
+		const std::vector<glm::mat4x3>& skinningMatrices = scene.skinningPalettes[i].skinningMatrices;
+		if (paletteModes[i] & (1 << (int)SkinningMode::LinearBlend))
+		{
+			linearBlendOffsets[i] = (std::uint32_t)rows.size();
+			for (const glm::mat4x3& m : skinningMatrices)
+			{
+				for (int r = 0; r < 3; r++)
+				{
+					rows.emplace_back(m[0][r], m[1][r], m[2][r], m[3][r]);
+				}
+				const glm::mat3 normalMatrix = ComputeSkinningNormalMatrix(m);
+				for (int r = 0; r < 3; r++)
+				{
+					rows.emplace_back(normalMatrix[0][r], normalMatrix[1][r], normalMatrix[2][r], 0.0f);
+				}
+			}
+		}
+		if (paletteModes[i] & (1 << (int)SkinningMode::DualQuaternion))
+		{
+			dualQuaternionOffsets[i] = (std::uint32_t)rows.size();
+			dualQuaternions.resize(skinningMatrices.size());
+			ComputeSkinningDualQuaternions(skinningMatrices, dualQuaternions);
+			for (const DualQuaternion& dq : dualQuaternions)
+			{
+				rows.emplace_back(dq.real.x, dq.real.y, dq.real.z, dq.real.w);
+				rows.emplace_back(dq.dual.x, dq.dual.y, dq.dual.z, dq.dual.w);
+			}
+		}
+	}
+
+	if (rows.empty())
+	{
+		return;
+	}
+	if (buffer == 0)
+	{
+		glGenBuffers(1, &buffer);
+	}
+	// Respecifying the whole store every frame orphans the old one: the driver hands out fresh memory instead of waiting for
+	// last frame's draws to finish reading it
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, rows.size() * sizeof(glm::vec4), rows.data(), GL_STREAM_DRAW);
+	Bind();
+}
+
+void SkinningPaletteBuffer::Bind() const
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/vec4.hpp>
+#include "Scene.h"
+#include <cstdint>
+#include <vector>
+
+// Every skinning palette of the frame in one shader storage buffer, so all skinned draws and dispatches of a frame share a
+// single upload. A palette is uploaded in the layout of each skinning mode its skeletons use. For linear blending each joint
+// takes rowsPerJoint vec4 rows: the 3 rows of its 3x4 skinning matrix, then the 3 rows of its normal matrix (see
+// ComputeSkinningNormalMatrix) in xyz. For dual quaternions it takes rowsPerJointDualQuaternion rows, the real then the dual
+// part as xyzw. Shaders read it at SkinningPaletteBuffer::binding and find their skeleton's palette through a per-draw
+// paletteOffset uniform, see FetchSkinningMatrix and FetchDualQuaternion in geometryPass.vert. Joint indices are 16 bit, so
+// there's no limit on joints per skeleton besides that
+class SkinningPaletteBuffer
+{
+public:
+	static constexpr GLuint binding = 2;
+	static constexpr int rowsPerJoint = 6;
+	static constexpr int rowsPerJointDualQuaternion = 2;
+
+	SkinningPaletteBuffer() = default;
+	SkinningPaletteBuffer(const SkinningPaletteBuffer&) = delete;
+	SkinningPaletteBuffer& operator=(const SkinningPaletteBuffer&) = delete;
+	~SkinningPaletteBuffer();
+
+	// After AnimationSystem::Update. Uploads all of scene.skinningPalettes and binds the buffer
+	void Update(const Scene& scene);
+	void Bind() const;
+
+	// In rows, for the paletteOffset uniform. Points at the layout of the skeleton's skinning mode
+	std::uint32_t GetPaletteOffset(const Scene& scene, int skeletonIdx) const
+	{
+		const int paletteIdx = scene.skeletonPaletteIndices[skeletonIdx];
+		return scene.skeletons[skeletonIdx].skinningMode == SkinningMode::DualQuaternion ? dualQuaternionOffsets[paletteIdx] : linearBlendOffsets[paletteIdx];
+	}
+
+private:
+	GLuint buffer = 0;
+	std::vector<glm::vec4> rows; // scratch
+	std::vector<DualQuaternion> dualQuaternions; // scratch
+	std::vector<std::uint8_t> paletteModes; // scratch, per palette a bit per SkinningMode its skeletons use
+	// Per scene.skinningPalettes entry, only valid for the modes the palette was uploaded in
+	std::vector<std::uint32_t> linearBlendOffsets;
+	std::vector<std::uint32_t> dualQuaternionOffsets;
+};
\ No newline at end of file
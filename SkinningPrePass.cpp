@@ -0,0 +1,266 @@
+#include "SkinningPrePass.h"
+#include "GLTFMeshParser.h"
+
+#include <string>
+
+// Attributes the pre-pass replaces, everything else is read from the source vertex buffer
+static constexpr VertexAttribute animatedAttributes = VertexAttribute::WEIGHTS | VertexAttribute::JOINTS |
+	VertexAttribute::MORPH_TARGET0_POSITION | VertexAttribute::MORPH_TARGET1_POSITION |
+	VertexAttribute::MORPH_TARGET0_NORMAL | VertexAttribute::MORPH_TARGET1_NORMAL |
+	VertexAttribute::MORPH_TARGET0_TANGENT | VertexAttribute::MORPH_TARGET1_TANGENT;
+
+int GetSkinnedVertexStrideFloats(VertexAttribute sourceFlags)
+{
+	return GetSkinnedTangentOffsetFloats(sourceFlags) + (HasFlag(sourceFlags, VertexAttribute::TANGENT) ? 4 : 0);
+}
+
+int GetSkinnedTangentOffsetFloats(VertexAttribute sourceFlags)
+{
+	return 3 + (HasFlag(sourceFlags, VertexAttribute::NORMAL) ? 3 : 0);
+}
+
+Submesh CreateSkinnedOutputSubmesh(const Submesh& source, GLuint outputBuffer)
+{
+	Submesh submesh = source;
+	submesh.flags = source.flags & ~animatedAttributes;
+	submesh.VBO = outputBuffer;
+
+	// Same attribute locations as GLTFMeshParser, see geometryPass.vert
+	glGenVertexArrays(1, &submesh.VAO);
+	glBindVertexArray(submesh.VAO);
+
+	const int outputStride = GetSkinnedVertexStrideFloats(source.flags) * sizeof(float);
+	glBindBuffer(GL_ARRAY_BUFFER, outputBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, outputStride, (const void*)0);
+	if (HasFlag(source.flags, VertexAttribute::NORMAL))
+	{
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, outputStride, (const void*)12);
+	}
+	if (HasFlag(source.flags, VertexAttribute::TANGENT))
+	{
+		glEnableVertexAttribArray(9);
+		glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, outputStride, (const void*)(GetSkinnedTangentOffsetFloats(source.flags) * sizeof(float)));
+	}
+
+	const int sourceStride = GLTFMeshParser::GetVertexSizeBytes(source.flags);
+	glBindBuffer(GL_ARRAY_BUFFER, source.VBO);
+	if (HasFlag(source.flags, VertexAttribute::TEXCOORD))
+	{
+		const int offset = GLTFMeshParser::GetAttributeByteOffset(source.flags, VertexAttribute::TEXCOORD);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sourceStride, (const void*)offset);
+	}
+	if (HasFlag(source.flags, VertexAttribute::COLOR))
+	{
+		const int offset = GLTFMeshParser::GetAttributeByteOffset(source.flags, VertexAttribute::COLOR);
+		glEnableVertexAttribArray(12);
+		glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, sourceStride, (const void*)offset);
+	}
+
+	if (source.hasIndexBuffer)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, source.IBO);
+	}
+	glBindVertexArray(0);
+
+	return submesh;
+}
+
+SkinningPrePass::~SkinningPrePass()
+{
+	Clear();
+}
+
+void SkinningPrePass::Clear()
+{
+	for (Output& output : outputs)
+	{
+		glDeleteVertexArrays(1, &output.submesh.VAO);
+		glDeleteBuffers(1, &output.buffer);
+	}
+	outputs.clear();
+	entityFirstOutputs.clear();
+}
+
+void SkinningPrePass::Build(const Scene& scene)
+{
+	Clear();
+
+	const EntityStorage& entities = scene.entities;
+	entityFirstOutputs.assign(entities.Size(), -1);
+
+	for (int entityIdx = 0; entityIdx < entities.Size(); entityIdx++)
+	{
+		const int meshIdx = entities.meshIndices[entityIdx];
+		if (!entities.alive[entityIdx] || meshIdx < 0)
+		{
+			continue;
+		}
+
+		const Mesh& mesh = scene.meshes[meshIdx];
+		for (int submeshIdx = 0; submeshIdx < mesh.submeshes.size(); submeshIdx++)
+		{
+			const Submesh& source = mesh.submeshes[submeshIdx];
+			const bool skinned = HasFlag(source.flags, VertexAttribute::JOINTS) && entities.skeletonIndices[entityIdx] >= 0;
+			const bool morphed = HasFlag(source.flags, VertexAttribute::MORPH_TARGET0_POSITION);
+			if (!skinned && !morphed)
+			{
+				continue;
+			}
+
+			Output output;
+			output.entityIdx = entityIdx;
+			output.meshIdx = meshIdx;
+			output.submeshIdx = submeshIdx;
+			output.skeletonIdx = skinned ? entities.skeletonIndices[entityIdx] : -1;
+			output.strideFloats = GetSkinnedVertexStrideFloats(source.flags);
+
+			glGenBuffers(1, &output.buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, output.buffer);
+			glBufferData(GL_ARRAY_BUFFER, source.numVertices * output.strideFloats * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+			output.submesh = CreateSkinnedOutputSubmesh(source, output.buffer);
+
+			if (entityFirstOutputs[entityIdx] < 0)
+			{
+				entityFirstOutputs[entityIdx] = (int)outputs.size();
+			}
+			outputs.push_back(output);
+		}
+	}
+}
+
+void SkinningPrePass::Dispatch(const Scene& scene, const SkinningPaletteBuffer& palettes)
+{
+	if (outputs.empty())
+	{
+		return;
+	}
+
+	palettes.Bind();
+
+	for (const Output& output : outputs)
+	{
+		const Submesh& source = scene.meshes[output.meshIdx].submeshes[output.submeshIdx];
+		VertexAttribute flags = source.flags;
+		SkinningMode skinningMode = SkinningMode::LinearBlend;
+		if (output.skeletonIdx < 0)
+		{
+			flags &= ~VertexAttribute::JOINTS;
+		}
+		else
+		{
+			skinningMode = scene.skeletons[output.skeletonIdx].skinningMode;
+		}
+
+		Shader& shader = GetShader(flags, skinningMode);
+		shader.Use();
+		shader.SetUint("numVertices", source.numVertices);
+		shader.SetUint("inputStride", GLTFMeshParser::GetVertexSizeBytes(source.flags) / sizeof(float));
+		shader.SetUint("outputStride", output.strideFloats);
+
+		auto setOffset = [&shader, &source](const char* name, VertexAttribute attribute)
+		{
+			shader.SetUint(name, GLTFMeshParser::GetAttributeByteOffset(source.flags, attribute) / sizeof(float));
+		};
+		if (HasFlag(flags, VertexAttribute::NORMAL))
+		{
+			setOffset("normalOffset", VertexAttribute::NORMAL);
+		}
+		if (HasFlag(flags, VertexAttribute::TANGENT))
+		{
+			setOffset("tangentOffset", VertexAttribute::TANGENT);
+		}
+		if (HasFlag(flags, VertexAttribute::JOINTS))
+		{
+			setOffset("weightsOffset", VertexAttribute::WEIGHTS);
+			setOffset("jointsOffset", VertexAttribute::JOINTS);
+			shader.SetUint("paletteOffset", palettes.GetPaletteOffset(scene, output.skeletonIdx));
+		}
+		if (HasFlag(flags, VertexAttribute::MORPH_TARGET0_POSITION))
+		{
+			std::span<const float> weights = scene.entities.GetMorphTargetWeights(output.entityIdx);
+			shader.SetFloat("morph1Weight", weights.size() > 0 ? weights[0] : 0.0f);
+			shader.SetFloat("morph2Weight", weights.size() > 1 ? weights[1] : 0.0f);
+			setOffset("morphPosOffset", VertexAttribute::MORPH_TARGET0_POSITION);
+			if (HasFlag(flags, VertexAttribute::NORMAL) && HasFlag(flags, VertexAttribute::MORPH_TARGET0_NORMAL))
+			{
+				setOffset("morphNormalOffset", VertexAttribute::MORPH_TARGET0_NORMAL);
+			}
+			if (HasFlag(flags, VertexAttribute::TANGENT) && HasFlag(flags, VertexAttribute::MORPH_TARGET0_TANGENT))
+			{
+				setOffset("morphTangentOffset", VertexAttribute::MORPH_TARGET0_TANGENT);
+			}
+		}
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source.VBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output.buffer);
+		glDispatchCompute((source.numVertices + 63) / 64, 1, 1);
+	}
+
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+int SkinningPrePass::GetOutputIndex(int entityIdx, int submeshIdx) const
+{
+	if (entityIdx >= entityFirstOutputs.size() || entityFirstOutputs[entityIdx] < 0)
+	{
+		return -1;
+	}
+
+	for (int i = entityFirstOutputs[entityIdx]; i < outputs.size() && outputs[i].entityIdx == entityIdx; i++)
+	{
+		if (outputs[i].submeshIdx == submeshIdx)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+Shader& SkinningPrePass::GetShader(VertexAttribute flags, SkinningMode skinningMode)
+{
+	const VertexAttribute variantFlags = flags & (VertexAttribute::NORMAL | VertexAttribute::TANGENT | VertexAttribute::JOINTS |
+		VertexAttribute::MORPH_TARGET0_POSITION | VertexAttribute::MORPH_TARGET0_NORMAL | VertexAttribute::MORPH_TARGET0_TANGENT);
+	const bool dualQuaternion = HasFlag(variantFlags, VertexAttribute::JOINTS) && skinningMode == SkinningMode::DualQuaternion;
+	// The mode goes in a bit no attribute uses
+	const std::uint32_t key = (std::uint32_t)variantFlags | (dualQuaternion ? 1u << 31 : 0u);
+	auto iter = shaders.find(key);
+	if (iter != shaders.end())
+	{
+		return *iter->second;
+	}
+
+	std::vector<std::string> defines;
+	if (HasFlag(variantFlags, VertexAttribute::NORMAL))
+	{
+		defines.emplace_back("HAS_NORMALS");
+	}
+	if (HasFlag(variantFlags, VertexAttribute::TANGENT))
+	{
+		defines.emplace_back("HAS_TANGENTS");
+	}
+	if (HasFlag(variantFlags, VertexAttribute::JOINTS))
+	{
+		defines.emplace_back("HAS_JOINTS");
+	}
+	if (dualQuaternion)
+	{
+		defines.emplace_back("DUAL_QUATERNION_SKINNING");
+	}
+	if (HasFlag(variantFlags, VertexAttribute::MORPH_TARGET0_POSITION))
+	{
+		defines.emplace_back("HAS_MORPH_TARGETS");
+		// Only morphed if the targets carry them too
+		if (HasFlag(variantFlags, VertexAttribute::NORMAL) && HasFlag(variantFlags, VertexAttribute::MORPH_TARGET0_NORMAL))
+		{
+			defines.emplace_back("HAS_MORPH_NORMALS");
+		}
+		if (HasFlag(variantFlags, VertexAttribute::TANGENT) && HasFlag(variantFlags, VertexAttribute::MORPH_TARGET0_TANGENT))
+		{
+			defines.emplace_back("HAS_MORPH_TANGENTS");
+		}
+	}
+	return *shaders.emplace(key, &shaderLibrary.GetCompute("Shaders/skinning.comp", defines)).first->second;
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "Mesh.h"
+#include "Scene.h"
+#include "Shader.h"
+#include "ShaderLibrary.h"
+#include "SkinningPaletteBuffer.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Vertex layout written by the skinning pre-pass and CPU skinning: position, then normal and tangent if the source has them
+int GetSkinnedVertexStrideFloats(VertexAttribute sourceFlags);
+// Right after the position, or after the normal if there is one
+int GetSkinnedTangentOffsetFloats(VertexAttribute sourceFlags);
+// Submesh with a static vertex layout, reading position, normal and tangent from outputBuffer and the other attributes from
+// source's vertex buffer. Creates only a VAO, outputBuffer must hold source.numVertices vertices
+Submesh CreateSkinnedOutputSubmesh(const Submesh& source, GLuint outputBuffer);
+
+// Skins and morphs every animated submesh of the scene once per frame with a compute shader (Shaders/skinning.comp), instead
+// of once per vertex in every pass that draws it. Each entity's animated submeshes get an output vertex buffer holding their
+// skinned positions, normals and tangents; texture coordinates and vertex colors are still read from the source buffer.
+// GetOutputSubmesh returns a submesh with a static vertex layout over both, to be drawn with the static-mesh variant of
+// geometryPass.vert (or any later pass) with the entity's world matrix
+class SkinningPrePass
+{
+public:
+	// Variants come from shaderLibrary, which must outlive the pre-pass
+	explicit SkinningPrePass(ShaderLibrary& shaderLibrary) : shaderLibrary(shaderLibrary) {}
+	SkinningPrePass(const SkinningPrePass&) = delete;
+	SkinningPrePass& operator=(const SkinningPrePass&) = delete;
+	~SkinningPrePass();
+
+	// Creates the output buffers for every live entity with a skinned or morphed mesh. Call again when entities change
+	void Build(const Scene& scene);
+	// After the palette buffer's update for the frame. Dispatches once per output and issues the barrier that makes the
+	// results visible to vertex fetching
+	void Dispatch(const Scene& scene, const SkinningPaletteBuffer& palettes);
+
+	// -1 if the submesh isn't animated
+	int GetOutputIndex(int entityIdx, int submeshIdx) const;
+	const Submesh& GetOutputSubmesh(int outputIdx) const { return outputs[outputIdx].submesh; }
+	int GetNumOutputs() const { return (int)outputs.size(); }
+
+private:
+	struct Output
+	{
+		int entityIdx;
+		int meshIdx;
+		int submeshIdx;
+		int skeletonIdx; // -1 for morph target only submeshes
+		GLuint buffer;
+		int strideFloats;
+		Submesh submesh;
+	};
+
+	void Clear();
+	Shader& GetShader(VertexAttribute flags, SkinningMode skinningMode);
+
+	std::vector<Output> outputs;
+	std::vector<int> entityFirstOutputs; // per entity, -1 if none. An entity's outputs are contiguous and in submesh order
+	ShaderLibrary& shaderLibrary;
+	std::unordered_map<std::uint32_t, Shader*> shaders; // by the VertexAttribute flags that select the variant and the skinning mode
+};
\ No newline at end of file
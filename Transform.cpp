@@ -1,7 +1,16 @@
 #include "Transform.h"
 
+#include <cassert>
 #include <glm/gtx/matrix_decompose.hpp>
 
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_USE_SSE
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(Transform) == 10 * sizeof(float), "Batched conversion expects translation, scale and rotation (x, y, z, w) packed");
+static_assert(sizeof(glm::mat4x3) == 12 * sizeof(float));
+
 Transform GetNodeTransform(const tinygltf::Node& node)
 {
 	Transform transform{
@@ -59,4 +68,95 @@ Transform GetNodeTransform(const tinygltf::Node& node)
 	}
 
 	return transform;
+}
+
+void ComputeAffineMatricesScalar(std::span<const Transform> transforms, std::span<const int> indices, std::span<glm::mat4x3> outMatrices)
+{
+	assert(outMatrices.size() >= indices.size());
+	for (std::size_t i = 0; i < indices.size(); i++)
+	{
+		outMatrices[i] = transforms[indices[i]].GetAffineMatrix();
+	}
+}
+
+#ifdef TRANSFORM_USE_SSE
+// Converts the 4 transforms starting at the given floats. Loads them transposed into one register per component, so every
+// register holds the same component of all 4 transforms, does the quaternion to matrix math once for all of them, then
+// transposes the 12 matrix components back into 4 column-major 3x4 matrices
+static void ComputeAffineMatrices4(const float* t0, const float* t1, const float* t2, const float* t3, float* outMatrices)
+{
+	// Floats 0-3: translation xyz, scale x. 4-7: scale yz, rotation xy. 8-9: rotation zw
+	__m128 tx = _mm_loadu_ps(t0), ty = _mm_loadu_ps(t1), tz = _mm_loadu_ps(t2), sx = _mm_loadu_ps(t3);
+	_MM_TRANSPOSE4_PS(tx, ty, tz, sx);
+	__m128 sy = _mm_loadu_ps(t0 + 4), sz = _mm_loadu_ps(t1 + 4), qx = _mm_loadu_ps(t2 + 4), qy = _mm_loadu_ps(t3 + 4);
+	_MM_TRANSPOSE4_PS(sy, sz, qx, qy);
+	// Only the first 2 floats of the last group belong to the transform, don't read past the end of the array
+	__m128 qz = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(t0 + 8));
+	__m128 qw = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(t1 + 8));
+	__m128 unused0 = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(t2 + 8));
+	__m128 unused1 = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)(t3 + 8));
+	_MM_TRANSPOSE4_PS(qz, qw, unused0, unused1);
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 x2 = _mm_mul_ps(qx, two), y2 = _mm_mul_ps(qy, two), z2 = _mm_mul_ps(qz, two);
+	const __m128 xx = _mm_mul_ps(qx, x2), yy = _mm_mul_ps(qy, y2), zz = _mm_mul_ps(qz, z2);
+	const __m128 xy = _mm_mul_ps(qx, y2), xz = _mm_mul_ps(qx, z2), yz = _mm_mul_ps(qy, z2);
+	const __m128 wx = _mm_mul_ps(qw, x2), wy = _mm_mul_ps(qw, y2), wz = _mm_mul_ps(qw, z2);
+
+	__m128 m[12];
+	m[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+	m[1] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+	m[2] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+	m[3] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+	m[4] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+	m[5] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+	m[6] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+	m[7] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+	m[8] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+	m[9] = tx;
+	m[10] = ty;
+	m[11] = tz;
+
+	for (int group = 0; group < 3; group++)
+	{
+		__m128 r0 = m[group * 4], r1 = m[group * 4 + 1], r2 = m[group * 4 + 2], r3 = m[group * 4 + 3];
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps(outMatrices + group * 4, r0);
+		_mm_storeu_ps(outMatrices + 12 + group * 4, r1);
+		_mm_storeu_ps(outMatrices + 24 + group * 4, r2);
+		_mm_storeu_ps(outMatrices + 36 + group * 4, r3);
+	}
+}
+#endif
+
+void ComputeAffineMatrices(std::span<const Transform> transforms, std::span<const int> indices, std::span<glm::mat4x3> outMatrices)
+{
+	assert(outMatrices.size() >= indices.size());
+	std::size_t i = 0;
+#ifdef TRANSFORM_USE_SSE
+	for (; i + 4 <= indices.size(); i += 4)
+	{
+		ComputeAffineMatrices4((const float*)&transforms[indices[i]], (const float*)&transforms[indices[i + 1]],
+			(const float*)&transforms[indices[i + 2]], (const float*)&transforms[indices[i + 3]], (float*)&outMatrices[i]);
+	}
+#endif
+	ComputeAffineMatricesScalar(transforms, indices.subspan(i), outMatrices.subspan(i));
+}
+
+void ComputeAffineMatrices(std::span<const Transform> transforms, std::span<glm::mat4x3> outMatrices)
+{
+	assert(outMatrices.size() >= transforms.size());
+	std::size_t i = 0;
+#ifdef TRANSFORM_USE_SSE
+	for (; i + 4 <= transforms.size(); i += 4)
+	{
+		const float* first = (const float*)&transforms[i];
+		ComputeAffineMatrices4(first, first + 10, first + 20, first + 30, (float*)&outMatrices[i]);
+	}
+#endif
+	for (; i < transforms.size(); i++)
+	{
+		outMatrices[i] = transforms[i].GetAffineMatrix();
+	}
 }
\ No newline at end of file
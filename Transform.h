@@ -2,7 +2,9 @@
 
 #include <glm/vec3.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <glm/mat4x3.hpp>
 #include <glm/mat4x4.hpp>
+#include <span>
 #include <tiny_gltf.h>
 
 struct Transform
@@ -19,6 +21,32 @@ struct Transform
 		mat = glm::scale(mat, scale);
 		return mat;
 	}
+
+	// Same transform as GetMatrix() without the implicit (0, 0, 0, 1) row, built straight from the quaternion instead of
+	// multiplying out translate * rotate * scale
+	glm::mat4x3 GetAffineMatrix() const
+	{
+		const glm::mat3 rotationMatrix = glm::mat3_cast(rotation);
+		return glm::mat4x3(rotationMatrix[0] * scale.x, rotationMatrix[1] * scale.y, rotationMatrix[2] * scale.z, translation);
+	}
 };
 
+// a * b for affine matrices, treating both as 4x4 matrices with an implicit (0, 0, 0, 1) bottom row
+inline glm::mat4x3 MultiplyAffine(const glm::mat4x3& a, const glm::mat4x3& b)
+{
+	return glm::mat4x3(
+		a[0] * b[0].x + a[1] * b[0].y + a[2] * b[0].z,
+		a[0] * b[1].x + a[1] * b[1].y + a[2] * b[1].z,
+		a[0] * b[2].x + a[1] * b[2].y + a[2] * b[2].z,
+		a[0] * b[3].x + a[1] * b[3].y + a[2] * b[3].z + a[3]);
+}
+
+// Batched GetAffineMatrix(): outMatrices[i] = transforms[i].GetAffineMatrix(). Converts 4 transforms at a time with SSE when
+// available, otherwise falls back to ComputeAffineMatricesScalar
+void ComputeAffineMatrices(std::span<const Transform> transforms, std::span<glm::mat4x3> outMatrices);
+// Gathering variant: outMatrices[i] = transforms[indices[i]].GetAffineMatrix()
+void ComputeAffineMatrices(std::span<const Transform> transforms, std::span<const int> indices, std::span<glm::mat4x3> outMatrices);
+// Reference implementation of the above, one transform at a time
+void ComputeAffineMatricesScalar(std::span<const Transform> transforms, std::span<const int> indices, std::span<glm::mat4x3> outMatrices);
+
 Transform GetNodeTransform(const tinygltf::Node& node);
\ No newline at end of file
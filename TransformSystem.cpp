@@ -0,0 +1,145 @@
+#include "TransformSystem.h"
+
+#include <algorithm>
+#include <cassert>
+
+void TransformSystem::Build(const Scene& scene)
+{
+	const EntityStorage& entities = scene.entities;
+	const int numEntities = entities.Size();
+	order.clear();
+	order.reserve(numEntities);
+	orderPosition.resize(numEntities);
+	subtreeEnd.resize(numEntities);
+	builtHierarchyVersion = entities.hierarchyVersion;
+
+	// Depth first walk along the child/sibling links, no stack needed. An entity's subtree ends once the walk climbs back out
+	// of it. Destroyed entities have no links and end up as lone roots
+	for (int rootIdx = 0; rootIdx < numEntities; rootIdx++)
+	{
+		if (entities.parents[rootIdx] >= 0)
+		{
+			continue;
+		}
+
+		int entityIdx = rootIdx;
+		while (entityIdx >= 0)
+		{
+			orderPosition[entityIdx] = (int)order.size();
+			order.push_back(entityIdx);
+			if (entities.firstChildren[entityIdx] >= 0)
+			{
+				entityIdx = entities.firstChildren[entityIdx];
+				continue;
+			}
+
+			while (true)
+			{
+				subtreeEnd[orderPosition[entityIdx]] = (int)order.size();
+				if (entityIdx == rootIdx)
+				{
+					entityIdx = -1;
+					break;
+				}
+				if (entities.nextSiblings[entityIdx] >= 0)
+				{
+					entityIdx = entities.nextSiblings[entityIdx];
+					break;
+				}
+				entityIdx = entities.parents[entityIdx];
+			}
+		}
+	}
+	assert(order.size() == numEntities);
+}
+
+void TransformSystem::Update(Scene& scene, JobSystem* jobSystem)
+{
+	// Created entities have no global transform yet and reparented ones have a stale one. Hierarchy changes are rare, so
+	// rather than track which entities they touched every root is recomputed, even if nothing was marked dirty
+	if (order.empty() || builtHierarchyVersion != scene.entities.hierarchyVersion)
+	{
+		Build(scene);
+		scene.globalTransforms.resize(scene.entities.Size());
+		for (int entityIdx = 0; entityIdx < scene.entities.Size(); entityIdx++)
+		{
+			if (scene.entities.parents[entityIdx] < 0)
+			{
+				MarkTransformDirty(scene, entityIdx);
+			}
+		}
+	}
+
+	if (scene.dirtyTransforms.empty())
+	{
+		dirtyRanges.clear();
+		return;
+	}
+
+	dirtyPositions.clear();
+	for (int entityIdx : scene.dirtyTransforms)
+	{
+		dirtyPositions.push_back(orderPosition[entityIdx]);
+		scene.transformDirty[entityIdx] = false;
+	}
+	scene.dirtyTransforms.clear();
+	std::sort(dirtyPositions.begin(), dirtyPositions.end());
+
+	// Dirty entities inside an already collected subtree are covered by it
+	dirtyRanges.clear();
+	int coveredEnd = 0;
+	for (int position : dirtyPositions)
+	{
+		if (position >= coveredEnd)
+		{
+			coveredEnd = subtreeEnd[position];
+			dirtyRanges.push_back(DirtyRange{ position, coveredEnd });
+		}
+	}
+
+	// Ranges are disjoint and their roots' parents aren't dirty, so they don't depend on each other
+	if (jobSystem != nullptr && dirtyRanges.size() > 1)
+	{
+		jobSystem->ParallelFor((int)dirtyRanges.size(), 8,
+			[&](int begin, int end)
+			{
+				for (int i = begin; i < end; i++)
+				{
+					UpdateRange(scene, dirtyRanges[i]);
+				}
+			});
+	}
+	else
+	{
+		for (const DirtyRange& range : dirtyRanges)
+		{
+			UpdateRange(scene, range);
+		}
+	}
+}
+
+void TransformSystem::GetUpdatedEntities(std::vector<int>& outEntities) const
+{
+	for (const DirtyRange& range : dirtyRanges)
+	{
+		outEntities.insert(outEntities.end(), order.begin() + range.begin, order.begin() + range.end);
+	}
+}
+
+void TransformSystem::UpdateRange(Scene& scene, DirtyRange range) const
+{
+	constexpr int batchSize = 64;
+	glm::mat4x3 localMatrices[batchSize];
+	for (int batchBegin = range.begin; batchBegin < range.end; batchBegin += batchSize)
+	{
+		const int batchCount = std::min(batchSize, range.end - batchBegin);
+		ComputeAffineMatrices(scene.entities.localTransforms, std::span<const int>(order.data() + batchBegin, batchCount), localMatrices);
+
+		for (int i = 0; i < batchCount; i++)
+		{
+			const int entityIdx = order[batchBegin + i];
+			const int parentIdx = scene.entities.parents[entityIdx];
+			scene.globalTransforms[entityIdx] = parentIdx >= 0 ? MultiplyAffine(scene.globalTransforms[parentIdx], localMatrices[i]) : localMatrices[i];
+		}
+	}
+}
\ No newline at end of file
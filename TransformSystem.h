@@ -0,0 +1,50 @@
+#pragma once
+
+#include "JobSystem.h"
+#include "Scene.h"
+
+#include <vector>
+
+// Flags an entity whose localTransform changed so the next TransformSystem::Update recomputes it and everything below it
+inline void MarkTransformDirty(Scene& scene, int entityIdx)
+{
+	// Entities created since the last Update aren't covered yet
+	if (entityIdx >= scene.transformDirty.size())
+	{
+		scene.transformDirty.resize(scene.entities.Size(), false);
+	}
+	if (!scene.transformDirty[entityIdx])
+	{
+		scene.transformDirty[entityIdx] = true;
+		scene.dirtyTransforms.push_back(entityIdx);
+	}
+}
+
+// Keeps Scene::globalTransforms up to date. Entities are laid out in depth-first order, which puts every entity before its
+// children and makes every subtree a contiguous range. A dirty entity updates its whole subtree in one linear sweep, disjoint
+// dirty subtrees can be swept in parallel, and a frame where nothing was marked dirty costs nothing.
+class TransformSystem
+{
+public:
+	// Update calls it again when the entity hierarchy has changed since
+	void Build(const Scene& scene);
+	void Update(Scene& scene, JobSystem* jobSystem = nullptr);
+
+	// Appends the entities whose global transform the last Update recomputed, for systems caching world space data
+	void GetUpdatedEntities(std::vector<int>& outEntities) const;
+
+private:
+	struct DirtyRange
+	{
+		int begin, end; // positions in order
+	};
+
+	void UpdateRange(Scene& scene, DirtyRange range) const;
+
+	std::uint32_t builtHierarchyVersion = 0; // EntityStorage::hierarchyVersion at the last Build
+	std::vector<int> order; // entity indices, depth first
+	std::vector<int> orderPosition; // inverse of order
+	std::vector<int> subtreeEnd; // per position in order, one past the position of the subtree's last entity
+	std::vector<int> dirtyPositions; // scratch
+	std::vector<DirtyRange> dirtyRanges; // scratch
+};
\ No newline at end of file
@@ -10,7 +10,7 @@ layout(location = 2) in vec3 aBaseNormal;
 
 #ifdef HAS_JOINTS
 layout(location = 3) in vec4 aWeights;
-layout(location = 4) in uint aJoints;
+layout(location = 4) in uvec4 aJoints;
 #endif // HAS_JOINTS
 
 #ifdef HAS_MORPH_TARGETS
@@ -42,11 +42,122 @@ uniform mat4 projection;
 uniform mat3 normalMatrixVS;
 #endif // HAS_NORMALS
 
+#ifdef MULTI_DRAW_INDIRECT
+// See RenderQueue.h. Instanced attribute holding 0, 1, 2, ... so that each indirect command's baseInstance picks its draw
+layout(location = 13) in uint aDrawIndex;
+// 3 rows of the world matrix, then 3 rows of its normal matrix in xyz with the morph target weights in the first two w
+struct DrawData
+{
+    vec4 worldRows[3];
+    vec4 normalRows[3];
+};
+layout(std430, binding = 3) readonly buffer Draws
+{
+    DrawData draws[];
+};
+#endif // MULTI_DRAW_INDIRECT
+
+#ifdef MESH_INSTANCING
+// See RenderQueue.h. Per instance, 3 rows of its transform relative to the entity then 3 rows of that transform's normal
+// matrix, this draw's instances from meshInstanceOffset
+layout(std430, binding = 9) readonly buffer MeshInstances
+{
+    vec4 meshInstanceRows[];
+};
+uniform uint meshInstanceOffset;
+#endif // MESH_INSTANCING
+
 #ifdef HAS_JOINTS
-uniform mat4 skinningMatrices[128];
+    #ifdef BAKED_ANIMATION
+        // See BakedAnimation.h. Every instance has its own world matrix and time offset, the palettes come from a texture
+        // with one row per frame and 6 texels per joint, the rows of its skinning matrix then of its normal matrix
+        struct BakedInstance
+        {
+            mat4 world;
+            float timeOffsetSeconds;
+        };
+        layout(std430, binding = 0) readonly buffer BakedInstances
+        {
+            BakedInstance bakedInstances[];
+        };
+        uniform sampler2D bakedPalettes;
+        uniform float bakedTimeSeconds;
+        uniform float bakedFramesPerSecond;
+        uniform int bakedNumFrames;
+
+        mat4 FetchBakedSkinningMatrix(int frame, uint joint)
+        {
+            int x = int(joint) * 6;
+            vec4 row0 = texelFetch(bakedPalettes, ivec2(x, frame), 0);
+            vec4 row1 = texelFetch(bakedPalettes, ivec2(x + 1, frame), 0);
+            vec4 row2 = texelFetch(bakedPalettes, ivec2(x + 2, frame), 0);
+            return transpose(mat4(row0, row1, row2, vec4(0.0, 0.0, 0.0, 1.0)));
+        }
+
+        mat3 FetchBakedSkinningNormalMatrix(int frame, uint joint)
+        {
+            int x = int(joint) * 6 + 3;
+            vec3 row0 = texelFetch(bakedPalettes, ivec2(x, frame), 0).xyz;
+            vec3 row1 = texelFetch(bakedPalettes, ivec2(x + 1, frame), 0).xyz;
+            vec3 row2 = texelFetch(bakedPalettes, ivec2(x + 2, frame), 0).xyz;
+            return transpose(mat3(row0, row1, row2));
+        }
+    #else
+        // See SkinningPaletteBuffer.h, palettes of all skeletons in one buffer
+        layout(std430, binding = 2) readonly buffer SkinningPalettes
+        {
+            vec4 paletteRows[];
+        };
+        uniform uint paletteOffset; // in rows
+
+        #ifdef DUAL_QUATERNION_SKINNING
+        // 2 rows per joint: the real and dual parts of its unit dual quaternion, xyzw
+        mat2x4 FetchDualQuaternion(uint joint)
+        {
+            uint row = paletteOffset + joint * 2u;
+            return mat2x4(paletteRows[row], paletteRows[row + 1u]);
+        }
+
+        // Rigid transform of the normalized weighted sum of the joints' dual quaternions, each flipped into the first one's
+        // hemisphere so the blend takes the shortest path
+        mat4 BlendDualQuaternions(uvec4 joints, vec4 weights)
+        {
+            mat2x4 dq0 = FetchDualQuaternion(joints.x);
+            mat2x4 blended = weights.x * dq0;
+            for (int i = 1; i < 4; i++)
+            {
+                mat2x4 dq = FetchDualQuaternion(joints[i]);
+                blended += (dot(dq0[0], dq[0]) < 0.0 ? -weights[i] : weights[i]) * dq;
+            }
+            float invLength = 1.0 / length(blended[0]);
+            vec4 r = blended[0] * invLength;
+            vec4 d = blended[1] * invLength;
+
+            vec3 translation = 2.0 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));
+            mat3 rotation = mat3(
+                1.0 - 2.0 * (r.y * r.y + r.z * r.z), 2.0 * (r.x * r.y + r.w * r.z), 2.0 * (r.x * r.z - r.w * r.y),
+                2.0 * (r.x * r.y - r.w * r.z), 1.0 - 2.0 * (r.x * r.x + r.z * r.z), 2.0 * (r.y * r.z + r.w * r.x),
+                2.0 * (r.x * r.z + r.w * r.y), 2.0 * (r.y * r.z - r.w * r.x), 1.0 - 2.0 * (r.x * r.x + r.y * r.y));
+            return mat4(vec4(rotation[0], 0.0), vec4(rotation[1], 0.0), vec4(rotation[2], 0.0), vec4(translation, 1.0));
+        }
+        #else
+        // Per joint 3 rows of the 3x4 skinning matrix then 3 rows of its normal matrix
+        mat4 FetchSkinningMatrix(uint joint)
+        {
+            uint row = paletteOffset + joint * 6u;
+            return transpose(mat4(paletteRows[row], paletteRows[row + 1u], paletteRows[row + 2u], vec4(0.0, 0.0, 0.0, 1.0)));
+        }
+
+        mat3 FetchSkinningNormalMatrix(uint joint)
+        {
+            uint row = paletteOffset + joint * 6u + 3u;
+            return transpose(mat3(paletteRows[row].xyz, paletteRows[row + 1u].xyz, paletteRows[row + 2u].xyz));
+        }
+        #endif // DUAL_QUATERNION_SKINNING
+    #endif // BAKED_ANIMATION
 #endif // HAS_JOINTS
 
-#ifdef HAS_MORPH_TARGETS
+#if defined(HAS_MORPH_TARGETS) && !defined(MULTI_DRAW_INDIRECT)
 uniform float morph1Weight; 
 uniform float morph2Weight;
 #endif // HAS_MORPH_TARGETS
@@ -86,12 +197,66 @@ void main()
 #endif // HAS_NORMALS
 
 // TODO: make sure skeletal animation is independent of morph target animation
+#ifdef MULTI_DRAW_INDIRECT
+    DrawData draw = draws[aDrawIndex];
+    mat4 worldMatrix = transpose(mat4(draw.worldRows[0], draw.worldRows[1], draw.worldRows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+    #ifdef HAS_MORPH_TARGETS
+        // Per instance, in the normal rows' unused w
+        float morph1Weight = draw.normalRows[0].w;
+        float morph2Weight = draw.normalRows[1].w;
+    #endif // HAS_MORPH_TARGETS
+#else
+    mat4 worldMatrix = world;
+    #ifdef MESH_INSTANCING
+        uint instanceRow = (meshInstanceOffset + uint(gl_InstanceID)) * 6u;
+        mat4 instanceMatrix = transpose(mat4(meshInstanceRows[instanceRow], meshInstanceRows[instanceRow + 1u], meshInstanceRows[instanceRow + 2u],
+            vec4(0.0, 0.0, 0.0, 1.0)));
+        worldMatrix = worldMatrix * instanceMatrix;
+    #endif // MESH_INSTANCING
+#endif // MULTI_DRAW_INDIRECT
+
 #ifdef HAS_JOINTS
     vec4 modelSpaceVertex = vec4(surfacePos, 1.0);
-    mat4 skinningMatrix = aWeights.x * skinningMatrices[aJoints & 0xFFu] +
-                  aWeights.y * skinningMatrices[(aJoints >> 8) & 0xFFu] +
-                  aWeights.z * skinningMatrices[(aJoints >> 16) & 0xFFu] +
-                  aWeights.w * skinningMatrices[(aJoints >> 24) & 0xFFu];
+    #ifdef BAKED_ANIMATION
+        worldMatrix = bakedInstances[gl_InstanceID].world;
+        float frame = (bakedTimeSeconds + bakedInstances[gl_InstanceID].timeOffsetSeconds) * bakedFramesPerSecond;
+        int frame0 = int(mod(floor(frame), float(bakedNumFrames)));
+        int frame1 = (frame0 + 1) % bakedNumFrames;
+        float frameT = fract(frame);
+        mat4 skinningMatrix = mat4(0.0);
+        #ifdef HAS_NORMALS
+            // Blend of the baked normal matrices, like the live path, instead of inverting the blended matrix per vertex
+            mat3 skinningNormalMatrix = mat3(0.0);
+        #endif // HAS_NORMALS
+        for (int i = 0; i < 4; i++)
+        {
+            uint joint = aJoints[i];
+            mat4 matrix0 = FetchBakedSkinningMatrix(frame0, joint);
+            skinningMatrix += aWeights[i] * (matrix0 + (FetchBakedSkinningMatrix(frame1, joint) - matrix0) * frameT);
+            #ifdef HAS_NORMALS
+                mat3 normalMatrix0 = FetchBakedSkinningNormalMatrix(frame0, joint);
+                skinningNormalMatrix += aWeights[i] * (normalMatrix0 + (FetchBakedSkinningNormalMatrix(frame1, joint) - normalMatrix0) * frameT);
+            #endif // HAS_NORMALS
+        }
+    #elif defined(DUAL_QUATERNION_SKINNING)
+        mat4 skinningMatrix = BlendDualQuaternions(aJoints, aWeights);
+        #ifdef HAS_NORMALS
+            // Rigid, so the rotation is its own normal matrix
+            mat3 skinningNormalMatrix = mat3(skinningMatrix);
+        #endif // HAS_NORMALS
+    #else
+        mat4 skinningMatrix = aWeights.x * FetchSkinningMatrix(aJoints.x) +
+                      aWeights.y * FetchSkinningMatrix(aJoints.y) +
+                      aWeights.z * FetchSkinningMatrix(aJoints.z) +
+                      aWeights.w * FetchSkinningMatrix(aJoints.w);
+        #ifdef HAS_NORMALS
+            // Blend of the joints' precomputed normal matrices instead of inverting the blended matrix per vertex
+            mat3 skinningNormalMatrix = aWeights.x * FetchSkinningNormalMatrix(aJoints.x) +
+                                        aWeights.y * FetchSkinningNormalMatrix(aJoints.y) +
+                                        aWeights.z * FetchSkinningNormalMatrix(aJoints.z) +
+                                        aWeights.w * FetchSkinningNormalMatrix(aJoints.w);
+        #endif // HAS_NORMALS
+    #endif // BAKED_ANIMATION
     surfacePos = vec3(skinningMatrix * modelSpaceVertex);
 #endif // HAS_JOINTS
 
@@ -104,15 +269,26 @@ void main()
     #endif // HAS_NORMALS
 #endif // HAS_MORPH_TARGETS
 
-    vec4 surfacePosWS = world * vec4(surfacePos, 1.0);
+    vec4 surfacePosWS = worldMatrix * vec4(surfacePos, 1.0);
     vsOut.surfacePosVS = vec3(view * surfacePosWS);
 
 
 #ifdef HAS_NORMALS
-    mat3 finalNormalMatrix = normalMatrixVS;
+    #if defined(BAKED_ANIMATION)
+        mat3 finalNormalMatrix = transpose(inverse(mat3(view * worldMatrix)));
+    #elif defined(MULTI_DRAW_INDIRECT)
+        // The view matrix is rigid, so it's its own normal matrix
+        mat3 finalNormalMatrix = mat3(view) * transpose(mat3(draw.normalRows[0].xyz, draw.normalRows[1].xyz, draw.normalRows[2].xyz));
+    #else
+        mat3 finalNormalMatrix = normalMatrixVS;
+        #ifdef MESH_INSTANCING
+            finalNormalMatrix = finalNormalMatrix * transpose(mat3(meshInstanceRows[instanceRow + 3u].xyz, meshInstanceRows[instanceRow + 4u].xyz,
+                meshInstanceRows[instanceRow + 5u].xyz));
+        #endif // MESH_INSTANCING
+    #endif // BAKED_ANIMATION
     #ifdef HAS_JOINTS
         // take into account skinning matrix transformation
-        finalNormalMatrix = finalNormalMatrix * transpose(inverse(mat3(skinningMatrix)));
+        finalNormalMatrix = finalNormalMatrix * skinningNormalMatrix;
     #endif
     normal = normalize(finalNormalMatrix * normal);
 